@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+
+
+bool aot_init(chip_8* c, const aot_program* const* programs, int count){
+    const aot_program* best = NULL;
+    for(int i = 0; i < count; i++){
+        const aot_program* p = programs[i];
+        if(p->quirks != c->quirks || p->rom_size > MEMORY_SIZE - LOAD_ADDRESS || memcmp(c->memory + LOAD_ADDRESS, p->rom, p->rom_size) != 0) continue;
+        if(!best || p->rom_size > best->rom_size){
+            best = p;
+        }
+    }
+    if(!best){
+        return false;
+    }
+    struct aot_state* a = malloc(sizeof(struct aot_state));
+    if(!a){
+        return false;
+    }
+    a->program = best;
+    memset(a->modified, 0, sizeof(a->modified));
+    a->modified_count = 0;
+    c->aot = a;
+    c->core = CORE_AOT;
+    return true;
+}
+
+void aot_free(chip_8* c){
+    if(!c->aot) return;
+    free(c->aot);
+    c->aot = NULL;
+    if(c->core == CORE_AOT){
+        c->core = CORE_CACHED;
+    }
+}
+
+//compares instead of just marking, so writing back the original bytes makes the translation usable again
+void aot_invalidate(chip_8* c, uint16_t address, int length){
+    struct aot_state* a = c->aot;
+    for(int i = 0; i < length; i++){
+        int written = (address + i) & (MEMORY_SIZE - 1);
+        int offset = written - LOAD_ADDRESS;
+        if(offset < 0 || offset >= a->program->rom_size) continue;
+        uint64_t bit = 1ULL << (written & 63);
+        bool was = a->modified[written >> 6] & bit;
+        bool is = c->memory[written] != a->program->rom[offset];
+        if(is && !was){
+            a->modified[written >> 6] |= bit;
+            a->modified_count++;
+        }
+        else if(was && !is){
+            a->modified[written >> 6] &= ~bit;
+            a->modified_count--;
+        }
+    }
+}
+
+bool aot_step(chip_8* c, int* left, bool* drew){
+    int res = step(c);
+    if(res == 2){
+        *drew = true;
+    }
+    int used = 0;
+    bool more = step_budget(c, res, &used, *left);
+    *left -= used;
+    return more && *left > 0;
+}
@@ -0,0 +1,52 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//ahead-of-time translated roms. aotc.out turns roms into C with one label per instruction it
+//can reach from LOAD_ADDRESS; make AOT_ROMS="..." links the result in and --core aot runs it.
+//Anything the translation doesn't cover (unresolved jumps, instructions it leaves out, rom bytes
+//that were overwritten since loading) goes through step() instead
+
+typedef struct{
+    const char* name;
+    const uint8_t* rom;
+    uint16_t rom_size;
+    uint8_t quirks; //quirk_profile it was translated for, only chips running that profile use it
+    //same contract as run_instructions()
+    bool (*run_instructions)(chip_8* c, int count);
+}aot_program;
+
+struct aot_state{
+    const aot_program* program;
+    uint64_t modified[MEMORY_SIZE / 64]; //rom bytes that no longer hold the value they were translated from
+    int modified_count;
+};
+
+//the translations linked into this binary, from the aot_roms.c that aotc.out generates
+extern const aot_program* const aot_programs[];
+extern const int aot_program_count;
+
+//picks the longest program whose rom is loaded in c, translated for c's quirk profile, and switches
+//the chip to CORE_AOT
+bool aot_init(chip_8* c, const aot_program* const* programs, int count);
+void aot_free(chip_8* c);
+
+//called by memory_written()
+void aot_invalidate(chip_8* c, uint16_t address, int length);
+
+//for the generated code: true if the instruction at pc was overwritten after translation
+static inline bool aot_modified(const chip_8* c, uint16_t pc){
+    uint16_t next = (pc + 1) & (MEMORY_SIZE - 1);
+    return ((c->aot->modified[pc >> 6] >> (pc & 63)) & 1) || ((c->aot->modified[next >> 6] >> (next & 63)) & 1);
+}
+
+//for the generated code: one step() for an instruction without translation, with the budget
+//rules of run_instructions(). false once the run is over
+bool aot_step(chip_8* c, int* left, bool* drew);
+
+#endif
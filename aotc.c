@@ -0,0 +1,566 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+
+//translates roms into C for aot.h. Starting at LOAD_ADDRESS it follows every branch, call and
+//skip to find the reachable instructions, and emits one function per rom with a label per
+//instruction. Straight-line code falls through, direct jumps become gotos and everything else
+//(returns, Bnnn, instructions outside the translation) goes through a switch on the pc.
+//The budget is counted per instruction like the interpreter does, so a translated rom can stop
+//after any instruction and resume there
+
+#define MAX_JUMP_TABLE 128
+
+typedef struct{
+    const char* path;
+    uint8_t profile; //quirk_profile the rom is translated for
+    uint8_t quirks; //and its quirk_flags
+    uint8_t memory[MEMORY_SIZE];
+    int size;
+    bool code[MEMORY_SIZE]; //translated instruction at this address
+    bool leader[MEMORY_SIZE]; //reachable from somewhere else than the instruction before
+    bool queued[MEMORY_SIZE];
+    uint16_t worklist[MEMORY_SIZE];
+    int pending;
+}rom;
+
+void print_usage(void){
+    fprintf(stderr, "./aotc.out -o FILE [[--quirks NAME] romfile...]\n");
+    fprintf(stderr, "  writes C for every rom into FILE, see aot.h. FILE is left alone if it wouldn't change\n");
+    fprintf(stderr, "  --quirks NAME translates the roms after it for that profile: modern (default), vip, chip48, schip\n");
+    fprintf(stderr, "                or xochip. Roms still have to fit below 0x1000\n");
+}
+
+static bool read_rom(rom* r, const char* path, uint8_t profile){
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+    r->profile = profile;
+    r->quirks = quirk_flags[profile];
+    FILE* fp = fopen(path, "rb");
+    if(!fp){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    r->size = fread(r->memory + LOAD_ADDRESS, 1, MEMORY_SIZE - LOAD_ADDRESS, fp);
+    bool too_large = fgetc(fp) != EOF;
+    bool ok = !ferror(fp);
+    fclose(fp);
+    if(!ok || too_large){
+        fprintf(stderr, too_large ? "file too large!!!\n" : "could not read file!!!\n");
+        return false;
+    }
+    return true;
+}
+
+static uint16_t instruction_at(const rom* r, uint16_t a){
+    return (r->memory[a] << 8) | r->memory[a + 1];
+}
+
+//the instruction as the rom's profile runs it
+static decoded_instruction decode_at(const rom* r, uint16_t a){
+    return profile_instruction(decode_instruction(instruction_at(r, a)), r->quirks);
+}
+
+//XO-CHIP skips can step over F000 nnnn, how far depends on the instruction after them
+static bool xo_skip(const rom* r, decoded_instruction d){
+    switch(d.op){
+        case OP_SKIP_EQUAL: case OP_SKIP_NOT_EQUAL: case OP_SKIP_EQUAL_REG: case OP_SKIP_NOT_EQUAL_REG:
+        case OP_SKIP_IF_KEY_PRESSED: case OP_SKIP_IF_KEY_NOT_PRESSED:
+            return r->quirks & QUIRK_XO;
+        default:
+            return false;
+    }
+}
+
+//the extension instructions and XO-CHIP skips aren't translated, the dispatcher steps them
+static bool interpreted(const rom* r, decoded_instruction d){
+    return (d.op >= OP_SCROLL_DOWN && d.op < OP_NOT_IMPLEMENTED) || xo_skip(r, d);
+}
+
+static bool in_rom(const rom* r, int a){
+    return a >= LOAD_ADDRESS && a + 1 < LOAD_ADDRESS + r->size;
+}
+
+static void add_root(rom* r, int a){
+    if(in_rom(r, a) && !r->queued[a]){
+        r->queued[a] = true;
+        r->worklist[r->pending++] = a;
+    }
+}
+
+static void add_target(rom* r, int a){
+    if(in_rom(r, a)){
+        r->leader[a] = true;
+    }
+    add_root(r, a);
+}
+
+//marks everything reachable from the queued addresses
+static void discover(rom* r){
+    while(r->pending > 0){
+        uint16_t a = r->worklist[--r->pending];
+        decoded_instruction d = decode_at(r, a);
+        uint16_t nnn = (d.x << 8) | d.kk;
+        if(d.op == OP_NOT_IMPLEMENTED){
+            continue; //left to the interpreter, which reports the fault
+        }
+        r->code[a] = true;
+        if(xo_skip(r, d)){
+            add_target(r, a + INSTRUCTION_SIZE);
+            add_target(r, a + 2 * INSTRUCTION_SIZE);
+            if(in_rom(r, a + INSTRUCTION_SIZE) && instruction_at(r, a + INSTRUCTION_SIZE) == 0xF000){
+                add_target(r, a + 3 * INSTRUCTION_SIZE);
+            }
+            continue;
+        }
+        switch(d.op){
+            case OP_RETURN_FROM_SUBROUTINE:
+                break;
+            case OP_GOTO_ADDRESS:
+                add_target(r, nnn);
+                break;
+            case OP_CALL_SUBROUTINE:
+                add_target(r, nnn);
+                add_target(r, a + INSTRUCTION_SIZE);
+                break;
+            case OP_SKIP_EQUAL: case OP_SKIP_NOT_EQUAL: case OP_SKIP_EQUAL_REG: case OP_SKIP_NOT_EQUAL_REG:
+            case OP_SKIP_IF_KEY_PRESSED: case OP_SKIP_IF_KEY_NOT_PRESSED:
+                add_target(r, a + INSTRUCTION_SIZE);
+                add_target(r, a + 2 * INSTRUCTION_SIZE);
+                break;
+            case OP_GOTO_ADDRESS_PLUS_V0:
+                break; //see resolve_jump()
+            case OP_EXIT:
+                break;
+            case OP_SET_ADDRESS_REG_LONG:
+                add_target(r, a + 2 * INSTRUCTION_SIZE);
+                break;
+            default:
+                add_root(r, a + INSTRUCTION_SIZE);
+        }
+    }
+}
+
+static bool writes_register(decoded_instruction d, uint8_t reg){
+    switch(d.op){
+        case OP_LOAD_IMM: case OP_ADD_IMM: case OP_MOV: case OP_BIT_OR: case OP_BIT_AND: case OP_BIT_XOR:
+        case OP_RAND_MOD: case OP_GET_DELAY: case OP_WAIT_FOR_KEY:
+            return d.x == reg;
+        case OP_ADD_REG: case OP_SUB_REG: case OP_SHIFT_RIGHT: case OP_SUB_REG_SWITCH: case OP_SHIFT_LEFT:
+            return d.x == reg || reg == VF;
+        case OP_DRAW_SPRITE:
+            return reg == VF;
+        case OP_REG_LOAD: case OP_LOAD_FLAGS:
+            return reg <= d.x;
+        case OP_LOAD_RANGE:
+            return (reg >= d.x && reg <= d.y) || (reg >= d.y && reg <= d.x);
+        default:
+            return false;
+    }
+}
+
+static bool falls_through(decoded_instruction d){
+    switch(d.op){
+        case OP_RETURN_FROM_SUBROUTINE: case OP_GOTO_ADDRESS: case OP_CALL_SUBROUTINE:
+        case OP_SKIP_EQUAL: case OP_SKIP_NOT_EQUAL: case OP_SKIP_EQUAL_REG: case OP_SKIP_NOT_EQUAL_REG:
+        case OP_SKIP_IF_KEY_PRESSED: case OP_SKIP_IF_KEY_NOT_PRESSED: case OP_GOTO_ADDRESS_PLUS_V0:
+        case OP_EXIT: case OP_SET_ADDRESS_REG_LONG: case OP_NOT_IMPLEMENTED:
+            return false;
+        default:
+            return true;
+    }
+}
+
+//the register Bnnn adds, V0 or Vx with QUIRK_JUMP_VX
+static uint8_t jump_register(const rom* r, decoded_instruction d){
+    return r->quirks & QUIRK_JUMP_VX ? d.x : 0;
+}
+
+//the value of reg at the Bnnn at a if the straight-line code leading to it loads a constant, -1 otherwise
+static int known_register(const rom* r, uint16_t a, uint8_t reg){
+    for(int b = a - INSTRUCTION_SIZE; !r->leader[b + INSTRUCTION_SIZE] && r->code[b]; b -= INSTRUCTION_SIZE){
+        decoded_instruction d = decode_at(r, b);
+        if(!falls_through(d)){
+            return -1;
+        }
+        if(writes_register(d, reg)){
+            return d.op == OP_LOAD_IMM ? d.kk : -1;
+        }
+    }
+    return -1;
+}
+
+//a jump table is a run of 1nnn at nnn, each entry picked with an even register value
+static int jump_table_entries(const rom* r, uint16_t nnn){
+    int entries = 0;
+    while(entries < MAX_JUMP_TABLE && in_rom(r, nnn + entries * INSTRUCTION_SIZE)
+          && decode_at(r, nnn + entries * INSTRUCTION_SIZE).op == OP_GOTO_ADDRESS){
+        entries++;
+    }
+    return entries;
+}
+
+//queues the targets of every Bnnn, false if there were none left to add
+static bool resolve_jumps(rom* r){
+    for(int a = LOAD_ADDRESS; a < MEMORY_SIZE; a++){
+        if(!r->code[a]) continue;
+        decoded_instruction d = decode_at(r, a);
+        if(d.op != OP_GOTO_ADDRESS_PLUS_V0) continue;
+        uint16_t nnn = (d.x << 8) | d.kk;
+        int value = known_register(r, a, jump_register(r, d));
+        if(value >= 0){
+            add_target(r, nnn + value);
+            continue;
+        }
+        add_target(r, nnn);
+        int entries = jump_table_entries(r, nnn);
+        for(int i = 0; i < entries; i++){
+            add_target(r, nnn + i * INSTRUCTION_SIZE);
+        }
+    }
+    return r->pending > 0;
+}
+
+static void analyze(rom* r){
+    add_target(r, LOAD_ADDRESS);
+    do{
+        discover(r);
+    }while(resolve_jumps(r));
+}
+
+//continues at target: falls through if it's the next label, jumps to it if it's translated and
+//lets the dispatcher sort it out otherwise
+static void emit_goto(FILE* fp, const rom* r, int target, int next_label){
+    if(target < MEMORY_SIZE && r->code[target]){
+        if(target != next_label){
+            fprintf(fp, "    goto L_%03x;\n", target);
+        }
+    }
+    else{
+        fprintf(fp, "    c->program_counter = 0x%03x;\n", target & 0xffff);
+        fprintf(fp, "    goto dispatch;\n");
+    }
+}
+
+static void emit_instruction(FILE* fp, const rom* r, uint16_t a, int next_label, int* jump_tables){
+    uint16_t instr = instruction_at(r, a);
+    decoded_instruction d = decode_at(r, a);
+    uint16_t nnn = (d.x << 8) | d.kk;
+    uint8_t source = r->quirks & QUIRK_SHIFT_VY ? d.y : d.x;
+    const int next = a + INSTRUCTION_SIZE;
+    const int skip = a + 2 * INSTRUCTION_SIZE;
+
+    fprintf(fp, "L_%03x: //%04x  ", a, instr);
+    //the profile can run an instruction as something else, 5xy2 is 5xy0 outside XO-CHIP
+    if(d.op != decode_instruction(instr).op){
+        fprintf(fp, "%s 0x%02x 0x%02x", op_name(d.op), d.x, d.y);
+    }
+    else{
+        fprint_instruction(fp, instr);
+    }
+    fprintf(fp, "\n");
+    if(interpreted(r, d)){
+        fprintf(fp, "    c->program_counter = 0x%03x;\n", a);
+        fprintf(fp, "    goto interpret;\n");
+        return;
+    }
+    switch(d.op){
+        case OP_CLEAR_SCREEN:
+            //only the selected planes on the extended machines
+            if(r->quirks & QUIRK_HIRES){
+                fprintf(fp, "    clear_screen(c);\n");
+            }
+            else{
+                fprintf(fp, "    memset(&c->display[0], 0, VIRTUAL_SCREEN_HEIGHT * sizeof(c->display[0]));\n");
+            }
+            fprintf(fp, "    drew = true;\n");
+            break;
+        case OP_RETURN_FROM_SUBROUTINE:
+            fprintf(fp, "    return_from_subroutine(c);\n");
+            fprintf(fp, "    NEXT_INDIRECT();\n");
+            return;
+        case OP_GOTO_ADDRESS:
+            fprintf(fp, "    NEXT(0x%03x);\n", nnn);
+            emit_goto(fp, r, nnn, next_label);
+            return;
+        case OP_CALL_SUBROUTINE:
+            fprintf(fp, "    c->program_counter = 0x%03x;\n", a);
+            fprintf(fp, "    call_subroutine(c, 0x%03x);\n", nnn);
+            fprintf(fp, "    NEXT(0x%03x);\n", nnn);
+            emit_goto(fp, r, nnn, next_label);
+            return;
+        case OP_SKIP_EQUAL:
+        case OP_SKIP_NOT_EQUAL:
+        case OP_SKIP_EQUAL_REG:
+        case OP_SKIP_NOT_EQUAL_REG:
+        case OP_SKIP_IF_KEY_PRESSED:
+        case OP_SKIP_IF_KEY_NOT_PRESSED:
+            switch(d.op){
+                case OP_SKIP_EQUAL: fprintf(fp, "    if(V[0x%x] == 0x%02x){\n", d.x, d.kk); break;
+                case OP_SKIP_NOT_EQUAL: fprintf(fp, "    if(V[0x%x] != 0x%02x){\n", d.x, d.kk); break;
+                //a register against itself is known here, and the compiler warns about the compare
+                case OP_SKIP_EQUAL_REG:
+                    if(d.x == d.y) fprintf(fp, "    if(1){\n");
+                    else fprintf(fp, "    if(V[0x%x] == V[0x%x]){\n", d.x, d.y);
+                    break;
+                case OP_SKIP_NOT_EQUAL_REG:
+                    if(d.x == d.y) fprintf(fp, "    if(0){\n");
+                    else fprintf(fp, "    if(V[0x%x] != V[0x%x]){\n", d.x, d.y);
+                    break;
+                case OP_SKIP_IF_KEY_PRESSED: fprintf(fp, "    if(c->keys[V[0x%x] & 0xf] == 1){\n", d.x); break;
+                default: fprintf(fp, "    if(c->keys[V[0x%x] & 0xf] == 0){\n", d.x); break;
+            }
+            fprintf(fp, "    NEXT(0x%03x);\n", skip);
+            emit_goto(fp, r, skip, -1);
+            fprintf(fp, "    }\n");
+            fprintf(fp, "    NEXT(0x%03x);\n", next);
+            emit_goto(fp, r, next, next_label);
+            return;
+        case OP_LOAD_IMM:
+            fprintf(fp, "    V[0x%x] = 0x%02x;\n", d.x, d.kk);
+            break;
+        case OP_ADD_IMM:
+            fprintf(fp, "    V[0x%x] += 0x%02x;\n", d.x, d.kk);
+            break;
+        case OP_MOV:
+            fprintf(fp, "    V[0x%x] = V[0x%x];\n", d.x, d.y);
+            break;
+        case OP_BIT_OR:
+            fprintf(fp, "    V[0x%x] |= V[0x%x];\n", d.x, d.y);
+            break;
+        case OP_BIT_AND:
+            fprintf(fp, "    V[0x%x] &= V[0x%x];\n", d.x, d.y);
+            break;
+        case OP_BIT_XOR:
+            fprintf(fp, "    V[0x%x] ^= V[0x%x];\n", d.x, d.y);
+            break;
+        //VF before Vx like the handlers, which matters when x is F
+        case OP_ADD_REG:
+            fprintf(fp, "    r = V[0x%x] + V[0x%x];\n", d.x, d.y);
+            fprintf(fp, "    V[VF] = r > 0xff;\n");
+            fprintf(fp, "    V[0x%x] = r & 0xff;\n", d.x);
+            break;
+        case OP_SUB_REG:
+            fprintf(fp, "    r = V[0x%x] - V[0x%x];\n", d.x, d.y);
+            fprintf(fp, "    V[VF] = r >= 0;\n");
+            fprintf(fp, "    V[0x%x] = r & 0xff;\n", d.x);
+            break;
+        case OP_SUB_REG_SWITCH:
+            fprintf(fp, "    r = V[0x%x] - V[0x%x];\n", d.y, d.x);
+            fprintf(fp, "    V[VF] = r >= 0;\n");
+            fprintf(fp, "    V[0x%x] = r & 0xff;\n", d.x);
+            break;
+        case OP_SHIFT_RIGHT:
+            fprintf(fp, "    V[VF] = V[0x%x] & 1;\n", source);
+            fprintf(fp, "    V[0x%x] = V[0x%x] >> 1;\n", d.x, source);
+            break;
+        case OP_SHIFT_LEFT:
+            fprintf(fp, "    V[VF] = (V[0x%x] >> 7) & 1;\n", source);
+            fprintf(fp, "    V[0x%x] = V[0x%x] << 1;\n", d.x, source);
+            break;
+        case OP_SET_ADDRESS_REG:
+            fprintf(fp, "    c->address_register = 0x%03x;\n", nnn);
+            break;
+        case OP_GOTO_ADDRESS_PLUS_V0:{
+            uint8_t reg = jump_register(r, d);
+            int value = known_register(r, a, reg);
+            if(value < 0 && jump_table_entries(r, nnn) > 1){
+                (*jump_tables)++;
+            }
+            if(value >= 0){
+                //checked anyway, the constant may come from code that was overwritten since
+                fprintf(fp, "    if(V[0x%x] == 0x%02x){\n", reg, value);
+                fprintf(fp, "    NEXT(0x%03x);\n", nnn + value);
+                emit_goto(fp, r, nnn + value, -1);
+                fprintf(fp, "    }\n");
+            }
+            fprintf(fp, "    c->program_counter = 0x%03x + V[0x%x];\n", nnn, reg);
+            fprintf(fp, "    NEXT_INDIRECT();\n");
+            return;
+        }
+        case OP_RAND_MOD:
+            fprintf(fp, "    rand_mod(c, 0x%x, 0x%02x);\n", d.x, d.kk);
+            break;
+        case OP_DRAW_SPRITE:
+            fprintf(fp, "    draw_sprite(c, 0x%x, 0x%x, 0x%x);\n", d.x, d.y, d.kk & 0xf);
+            fprintf(fp, "    drew = true;\n");
+            break;
+        case OP_GET_DELAY:
+            fprintf(fp, "    V[0x%x] = c->delay_timer;\n", d.x);
+            break;
+        case OP_WAIT_FOR_KEY:
+            //the dispatcher hands the wait to step()
+            fprintf(fp, "    c->program_counter = 0x%03x;\n", a);
+            fprintf(fp, "    wait_for_key(c, 0x%x);\n", d.x);
+            fprintf(fp, "    NEXT_INDIRECT();\n");
+            return;
+        case OP_SET_DELAY:
+            fprintf(fp, "    c->delay_timer = V[0x%x];\n", d.x);
+            break;
+        case OP_SET_SOUND:
+            fprintf(fp, "    c->sound_timer = V[0x%x];\n", d.x);
+            break;
+        case OP_ADD_ADDRESS_REG:
+            fprintf(fp, "    c->address_register += V[0x%x];\n", d.x);
+            break;
+        case OP_SET_FONT_CHAR:
+            fprintf(fp, "    c->address_register = FONTSET_MEMORY_OFFSET + V[0x%x] * 5;\n", d.x);
+            break;
+        //the writers go back through the dispatcher, they may have overwritten translated code
+        case OP_SET_BCD:
+        case OP_REG_DUMP:
+            fprintf(fp, "    c->program_counter = 0x%03x;\n", a);
+            fprintf(fp, "    %s(c, 0x%x);\n", d.op == OP_SET_BCD ? "set_bcd" : "reg_dump", d.x);
+            fprintf(fp, "    NEXT_INDIRECT();\n");
+            return;
+        case OP_REG_LOAD:
+            fprintf(fp, "    reg_load(c, 0x%x);\n", d.x);
+            break;
+    }
+    fprintf(fp, "    NEXT(0x%03x);\n", next);
+    emit_goto(fp, r, next, next_label);
+}
+
+static void emit_rom(FILE* fp, const rom* r, int index){
+    fprintf(fp, "\n//%s\n", r->path);
+    fprintf(fp, "static const uint8_t rom_%d[] = {", index);
+    for(int i = 0; i < r->size; i++){
+        fprintf(fp, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", r->memory[LOAD_ADDRESS + i]);
+    }
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "static bool run_%d(chip_8* c, int count){\n", index);
+    fprintf(fp, "    uint8_t* V = c->registers;\n");
+    fprintf(fp, "    (void)V;\n");
+    fprintf(fp, "    bool drew = false;\n");
+    fprintf(fp, "    bool trusted;\n");
+    fprintf(fp, "    int left = count;\n");
+    fprintf(fp, "    int r;\n");
+    fprintf(fp, "    (void)r;\n");
+    fprintf(fp, "dispatch:\n");
+    fprintf(fp, "    if(left <= 0) goto done;\n");
+    fprintf(fp, "    trusted = c->aot->modified_count == 0;\n");
+    fprintf(fp, "    if(c->waiting_for_key || (!trusted && aot_modified(c, c->program_counter & (MEMORY_SIZE - 1)))) goto interpret;\n");
+    fprintf(fp, "    switch(c->program_counter & (MEMORY_SIZE - 1)){\n");
+    for(int a = LOAD_ADDRESS; a < MEMORY_SIZE; a++){
+        if(r->code[a]){
+            fprintf(fp, "        case 0x%03x: goto L_%03x;\n", a, a);
+        }
+    }
+    fprintf(fp, "        default: goto interpret;\n");
+    fprintf(fp, "    }\n");
+    fprintf(fp, "interpret:\n");
+    fprintf(fp, "    if(!aot_step(c, &left, &drew)) goto done;\n");
+    fprintf(fp, "    goto dispatch;\n");
+
+    int translated = 0;
+    int jump_tables = 0;
+    for(int a = LOAD_ADDRESS; a < MEMORY_SIZE; a++){
+        if(!r->code[a]) continue;
+        int next_label = a + 1;
+        while(next_label < MEMORY_SIZE && !r->code[next_label]){
+            next_label++;
+        }
+        emit_instruction(fp, r, a, next_label, &jump_tables);
+        translated++;
+    }
+
+    fprintf(fp, "done:\n");
+    fprintf(fp, "    c->cycles += count - left;\n");
+    fprintf(fp, "    return drew;\n");
+    fprintf(fp, "}\n\n");
+    fprintf(fp, "static const aot_program program_%d = {\"%s\", rom_%d, %d, %d, run_%d};\n",
+            index, r->path, index, r->size, r->profile, index);
+    fprintf(stderr, "%s: %d instructions translated, %d jump tables, %s quirks\n", r->path, translated, jump_tables,
+            quirks_name(r->profile));
+}
+
+//the generated code keeps the budget like run_instructions(): NEXT() ends the run once it is used
+//up, and goes through the dispatcher after every instruction while rom bytes are overwritten
+static const char* const preamble =
+    "//generated by aotc.out, do not edit\n"
+    "\n"
+    "#include <string.h>\n"
+    "\n"
+    "#include \"aot.h\"\n"
+    "\n"
+    "#define NEXT(next) do{ if(--left == 0 || !trusted){ c->program_counter = (next); goto dispatch; } }while(0)\n"
+    "#define NEXT_INDIRECT() do{ --left; goto dispatch; }while(0)\n";
+
+static bool same_file(const char* path, const char* data, size_t size){
+    FILE* fp = fopen(path, "rb");
+    if(!fp){
+        return false;
+    }
+    bool same = true;
+    for(size_t i = 0; i < size && same; i++){
+        same = fgetc(fp) == (unsigned char)data[i];
+    }
+    same = same && fgetc(fp) == EOF;
+    fclose(fp);
+    return same;
+}
+
+int main(int argc, char** argv){
+    if(argc < 3 || strcmp(argv[1], "-o") != 0){
+        print_usage();
+        return 1;
+    }
+    const char* output = argv[2];
+    int count = 0;
+    uint8_t profile = QUIRKS_MODERN;
+
+    char* data = NULL;
+    size_t size = 0;
+    FILE* fp = open_memstream(&data, &size);
+    rom* r = malloc(sizeof(rom));
+    if(!fp || !r){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fputs(preamble, fp);
+    for(int i = 3; i < argc; i++){
+        if(strcmp(argv[i], "--quirks") == 0){
+            if(i + 1 == argc || !parse_quirks(argv[++i], &profile)){
+                print_usage();
+                return 1;
+            }
+            continue;
+        }
+        if(!read_rom(r, argv[i], profile)){
+            return 1;
+        }
+        analyze(r);
+        emit_rom(fp, r, count++);
+    }
+    fprintf(fp, "\nconst aot_program* const aot_programs[] = {");
+    for(int i = 0; i < count; i++){
+        fprintf(fp, "&program_%d, ", i);
+    }
+    fprintf(fp, "NULL};\n");
+    fprintf(fp, "const int aot_program_count = %d;\n", count);
+    fclose(fp);
+    free(r);
+
+    bool ok = true;
+    if(!same_file(output, data, size)){
+        FILE* out = fopen(output, "wb");
+        if(!out){
+            fprintf(stderr, "could not open file!!!\n");
+            free(data);
+            return 1;
+        }
+        ok = fwrite(data, 1, size, out) == size;
+        ok = fclose(out) == 0 && ok;
+        if(!ok){
+            fprintf(stderr, "could not write file!!!\n");
+        }
+    }
+    free(data);
+    return ok ? 0 : 1;
+}
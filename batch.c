@@ -0,0 +1,506 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "romindex.h"
+
+
+//runs many roms headless, one chip_8 per job, and prints one tab separated result line per rom.
+//jobs are split into one contiguous range per worker, idle workers steal half of the largest remaining range.
+//with --index each rom runs with the profile and speed recorded for it, and for as many frames as its
+//known-good framebuffer hash was taken after unless --cycles or --frames says otherwise
+
+#define DEFAULT_INSTRUCTIONS_PER_FRAME 10
+#define DEFAULT_FRAMES 600
+
+typedef struct{
+    const char* input;
+    uint64_t max_cycles;
+    uint64_t max_frames;
+    int instructions_per_frame;
+    int threads;
+    execution_core core;
+    uint8_t quirks;
+    bool has_quirks;
+    bool has_ipf;
+    const char* index;
+    const char* write_index;
+}batch_options;
+
+typedef struct{
+    char* path;
+    bool loaded;
+    uint64_t rom_hash;
+    uint32_t size;
+    uint8_t quirks;
+    int instructions_per_frame;
+    uint64_t frames; //whole frames the run was given, 0 if --cycles cut one short
+    rom_entry known; //flags are 0 if the rom isn't in the index
+    uint64_t framebuffer_hash;
+    uint16_t program_counter;
+    uint16_t address_register;
+    uint8_t registers[16];
+    uint64_t cycles;
+    bool faulted;
+    uint16_t fault_instruction;
+}job;
+
+//next job in the low half, end of the range in the high half, so both move with one CAS
+typedef struct{
+    _Atomic uint64_t range;
+    char padding[64 - sizeof(uint64_t)]; //one cache line per queue
+}work_queue;
+
+typedef struct{
+    const batch_options* opt;
+    const rom_index* index;
+    job* jobs;
+    work_queue* queues;
+    int worker_count;
+}batch;
+
+typedef struct{
+    batch* b;
+    int id;
+}worker;
+
+static uint64_t pack_range(uint32_t next, uint32_t end){
+    return ((uint64_t)end << 32) | next;
+}
+
+void print_usage(void){
+    fprintf(stderr, "./batch.out [options] romdir|manifest\n");
+    fprintf(stderr, "  --cycles N          stop every rom after N instructions\n");
+    fprintf(stderr, "  --frames N          stop every rom after N emulated frames (default %d)\n", DEFAULT_FRAMES);
+    fprintf(stderr, "  --ipf N             instructions per 60Hz frame (default %d)\n", DEFAULT_INSTRUCTIONS_PER_FRAME);
+    fprintf(stderr, "  --threads N         worker threads (default: one per online cpu)\n");
+    fprintf(stderr, "  --core NAME         interpreter core: cached (default), switch or jit\n");
+    fprintf(stderr, "  --quirks NAME       profile for every rom: modern (default), vip, chip48, schip\n");
+    fprintf(stderr, "                      or xochip\n");
+    fprintf(stderr, "  --index FILE        take profile, speed and frames per rom from an index, check the results\n");
+    fprintf(stderr, "                      against it and add an index column\n");
+    fprintf(stderr, "  --write-index FILE  write an index of every rom that loaded, with the profile, speed and\n");
+    fprintf(stderr, "                      final framebuffer hash it ran with, keeping the other roms of --index\n");
+    fprintf(stderr, "a manifest is a text file with one rom path per line, # starts a comment\n");
+}
+
+bool parse_args(batch_options* opt, int argc, char** argv){
+    opt->input = NULL;
+    opt->max_cycles = 0;
+    opt->max_frames = 0;
+    opt->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    opt->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    opt->core = CORE_CACHED;
+    opt->quirks = QUIRKS_MODERN;
+    opt->has_quirks = false;
+    opt->has_ipf = false;
+    opt->index = NULL;
+    opt->write_index = NULL;
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(strcmp(arg, "--cycles") == 0 && has_value){
+            opt->max_cycles = strtoull(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--frames") == 0 && has_value){
+            opt->max_frames = strtoull(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--ipf") == 0 && has_value){
+            opt->instructions_per_frame = atoi(argv[++i]);
+            opt->has_ipf = true;
+        }
+        else if(strcmp(arg, "--threads") == 0 && has_value){
+            opt->threads = atoi(argv[++i]);
+        }
+        else if(strcmp(arg, "--core") == 0 && has_value){
+            const char* name = argv[++i];
+            if(strcmp(name, "cached") == 0) opt->core = CORE_CACHED;
+            else if(strcmp(name, "switch") == 0) opt->core = CORE_SWITCH;
+            else if(strcmp(name, "jit") == 0) opt->core = CORE_JIT;
+            else return false;
+        }
+        else if(strcmp(arg, "--quirks") == 0 && has_value){
+            if(!parse_quirks(argv[++i], &opt->quirks)) return false;
+            opt->has_quirks = true;
+        }
+        else if(strcmp(arg, "--index") == 0 && has_value){
+            opt->index = argv[++i];
+        }
+        else if(strcmp(arg, "--write-index") == 0 && has_value){
+            opt->write_index = argv[++i];
+        }
+        else if(arg[0] == '-' || opt->input != NULL){
+            return false;
+        }
+        else{
+            opt->input = arg;
+        }
+    }
+    if(opt->instructions_per_frame <= 0) return false;
+    if(opt->threads <= 0) opt->threads = 1;
+    return opt->input != NULL;
+}
+
+double seconds_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool add_job(job** jobs, int* count, int* capacity, const char* path){
+    if(*count == *capacity){
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        job* grown = realloc(*jobs, new_capacity * sizeof(job));
+        if(!grown) return false;
+        *jobs = grown;
+        *capacity = new_capacity;
+    }
+    job* j = &(*jobs)[*count];
+    memset(j, 0, sizeof(*j));
+    j->path = strdup(path);
+    if(!j->path) return false;
+    (*count)++;
+    return true;
+}
+
+static int compare_jobs(const void* a, const void* b){
+    return strcmp(((const job*)a)->path, ((const job*)b)->path);
+}
+
+//every regular file in a directory (sorted, so the table is stable) or every line of a manifest
+int collect_jobs(const char* input, job** jobs){
+    int count = 0;
+    int capacity = 0;
+    *jobs = NULL;
+    struct stat st;
+    if(stat(input, &st) != 0){
+        fprintf(stderr, "could not open %s\n", input);
+        return -1;
+    }
+    char path[4096];
+    if(S_ISDIR(st.st_mode)){
+        DIR* dir = opendir(input);
+        if(!dir){
+            fprintf(stderr, "could not open %s\n", input);
+            return -1;
+        }
+        struct dirent* entry;
+        while((entry = readdir(dir)) != NULL){
+            if(entry->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", input, entry->d_name);
+            if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if(!add_job(jobs, &count, &capacity, path)){
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        qsort(*jobs, count, sizeof(job), compare_jobs);
+        return count;
+    }
+
+    FILE* fp = fopen(input, "r");
+    if(!fp){
+        fprintf(stderr, "could not open %s\n", input);
+        return -1;
+    }
+    while(fgets(path, sizeof(path), fp)){
+        path[strcspn(path, "#\r\n")] = '\0';
+        size_t length = strlen(path);
+        while(length > 0 && (path[length - 1] == ' ' || path[length - 1] == '\t')){
+            path[--length] = '\0';
+        }
+        if(length == 0) continue;
+        if(!add_job(jobs, &count, &capacity, path)){
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+static uint64_t cycle_budget(const batch_options* opt, int ipf, uint64_t default_frames){
+    uint64_t max_cycles = opt->max_cycles;
+    uint64_t frames = opt->max_frames != 0 ? opt->max_frames : (max_cycles == 0 ? default_frames : 0);
+    if(frames != 0){
+        uint64_t frame_cycles = frames * ipf;
+        if(max_cycles == 0 || frame_cycles < max_cycles) max_cycles = frame_cycles;
+    }
+    return max_cycles;
+}
+
+//the rom is read once, its hash picks the index entry before anything is loaded
+void run_job(const batch_options* opt, const rom_index* index, chip_8* c, job* j){
+    uint8_t rom[EXTENDED_MEMORY_SIZE - LOAD_ADDRESS];
+    int size;
+    if(!read_rom_file(j->path, rom, sizeof(rom), &size)){
+        return;
+    }
+    j->rom_hash = data_hash(rom, size);
+    j->size = size;
+    const rom_entry* known = index ? rom_index_find(index, j->rom_hash, size) : NULL;
+    if(known){
+        j->known = *known;
+    }
+    j->quirks = known && !opt->has_quirks ? known->quirks : opt->quirks;
+    j->instructions_per_frame = known && !opt->has_ipf ? (int)known->instructions_per_frame : opt->instructions_per_frame;
+    if(j->quirks >= QUIRKS_COUNT || j->instructions_per_frame <= 0){
+        fprintf(stderr, "bad index entry for %s\n", j->path);
+        return;
+    }
+    init_chip_8(c);
+    c->quirks = j->quirks;
+    if(!load_program_data(c, rom, size)){
+        return;
+    }
+    j->loaded = true;
+    c->core = opt->core;
+    if(opt->core == CORE_JIT && !jit_init(c)){
+        c->core = CORE_CACHED;
+    }
+    const int ipf = j->instructions_per_frame;
+    const uint64_t max_cycles = cycle_budget(opt, ipf, known && (known->flags & ROM_ENTRY_CHECKED) ? known->frames : DEFAULT_FRAMES);
+    while(max_cycles - c->cycles >= (uint64_t)ipf && !c->faulted){
+        run_frame(c, ipf);
+    }
+    run_instructions(c, max_cycles - c->cycles);
+    jit_free(c);
+
+    j->framebuffer_hash = framebuffer_hash(c);
+    j->program_counter = c->program_counter;
+    j->address_register = c->address_register;
+    memcpy(j->registers, c->registers, sizeof(j->registers));
+    j->cycles = c->cycles;
+    j->faulted = c->faulted;
+    j->fault_instruction = c->fault_instruction;
+    if(max_cycles % ipf == 0){
+        j->frames = max_cycles / ipf;
+    }
+}
+
+//takes the next job from the front of the worker's own range
+static bool take_own(work_queue* q, uint32_t* index){
+    uint64_t range = atomic_load(&q->range);
+    for(;;){
+        uint32_t next = (uint32_t)range;
+        uint32_t end = range >> 32;
+        if(next >= end) return false;
+        if(atomic_compare_exchange_weak(&q->range, &range, pack_range(next + 1, end))){
+            *index = next;
+            return true;
+        }
+    }
+}
+
+//moves the back half of the fullest other range into the thief's (empty) range.
+//an index is only ever handed out once, so a stale CAS can't succeed on a reused value
+static bool steal(batch* b, int thief){
+    for(;;){
+        int victim = -1;
+        uint32_t most = 0;
+        for(int i = 0; i < b->worker_count; i++){
+            if(i == thief) continue;
+            uint64_t range = atomic_load(&b->queues[i].range);
+            uint32_t next = (uint32_t)range;
+            uint32_t end = range >> 32;
+            if(next < end && end - next > most){
+                most = end - next;
+                victim = i;
+            }
+        }
+        if(victim < 0) return false;
+
+        work_queue* q = &b->queues[victim];
+        uint64_t range = atomic_load(&q->range);
+        uint32_t next = (uint32_t)range;
+        uint32_t end = range >> 32;
+        if(next >= end) continue;
+        uint32_t stolen = (end - next + 1) / 2;
+        if(atomic_compare_exchange_strong(&q->range, &range, pack_range(next, end - stolen))){
+            atomic_store(&b->queues[thief].range, pack_range(end - stolen, end));
+            return true;
+        }
+    }
+}
+
+void* worker_main(void* arg){
+    worker* w = arg;
+    batch* b = w->b;
+    chip_8* c = malloc(sizeof(chip_8));
+    if(!c){
+        fprintf(stderr, "out of memory\n");
+        return NULL;
+    }
+    work_queue* own = &b->queues[w->id];
+    for(;;){
+        uint32_t index;
+        if(take_own(own, &index)){
+            run_job(b->opt, b->index, c, &b->jobs[index]);
+        }
+        else if(!steal(b, w->id)){
+            break;
+        }
+    }
+    free(c);
+    return NULL;
+}
+
+//ok or differs when the rom ran as long as, and the way, its known-good hash was taken
+static const char* index_check(const job* j){
+    const rom_entry* e = &j->known;
+    if(!(e->flags & ROM_ENTRY_CHECKED) || j->frames == 0 || j->frames != e->frames
+       || j->instructions_per_frame != (int)e->instructions_per_frame || j->quirks != e->quirks){
+        return "-";
+    }
+    return !j->faulted && j->framebuffer_hash == e->framebuffer_hash ? "ok" : "differs";
+}
+
+void print_results(const job* jobs, int count, bool with_index){
+    printf("rom\tframebuffer_hash\tpc\ti\tregisters\tinstructions\tfault%s\n", with_index ? "\tindex" : "");
+    for(int i = 0; i < count; i++){
+        const job* j = &jobs[i];
+        if(!j->loaded){
+            printf("%s\t-\t-\t-\t-\t0\tload_failed%s\n", j->path, with_index ? "\t-" : "");
+            continue;
+        }
+        printf("%s\t%016llx\t%04x\t%04x\t", j->path, (unsigned long long)j->framebuffer_hash,
+               j->program_counter, j->address_register);
+        for(int r = 0; r < 16; r++){
+            printf("%02x", j->registers[r]);
+        }
+        printf("\t%llu\t", (unsigned long long)j->cycles);
+        if(j->faulted){
+            printf("not_implemented:%04x", j->fault_instruction);
+        }
+        else{
+            printf("-");
+        }
+        printf("%s%s\n", with_index ? "\t" : "", with_index ? index_check(j) : "");
+    }
+}
+
+//the entries of --index first, so a rom run again replaces its old entry
+bool write_index(const char* path, const rom_index* index, const job* jobs, int count){
+    int carried = index ? (int)index->header->count : 0;
+    rom_entry* entries = malloc((carried + count + 1) * sizeof(rom_entry));
+    if(!entries){
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    int n = 0;
+    for(uint32_t i = 0; index && i < index->header->capacity; i++){
+        if(index->entries[i].flags & ROM_ENTRY_USED){
+            entries[n++] = index->entries[i];
+        }
+    }
+    for(int i = 0; i < count; i++){
+        const job* j = &jobs[i];
+        if(!j->loaded) continue;
+        rom_entry* e = &entries[n++];
+        memset(e, 0, sizeof(*e));
+        e->rom_hash = j->rom_hash;
+        e->size = j->size;
+        e->quirks = j->quirks;
+        e->instructions_per_frame = j->instructions_per_frame;
+        //a faulted or cut short run only records how the rom is meant to run
+        if(!j->faulted && j->frames != 0 && j->frames <= UINT32_MAX){
+            e->framebuffer_hash = j->framebuffer_hash;
+            e->frames = j->frames;
+            e->flags = ROM_ENTRY_CHECKED;
+        }
+    }
+    bool ok = rom_index_write(path, entries, n);
+    free(entries);
+    return ok;
+}
+
+int main(int argc, char** argv){
+    batch_options opt;
+    if(!parse_args(&opt, argc, argv)){
+        print_usage();
+        return 1;
+    }
+    rom_index index;
+    if(opt.index && !rom_index_open(&index, opt.index)){
+        return 1;
+    }
+    job* jobs;
+    int count = collect_jobs(opt.input, &jobs);
+    if(count < 0){
+        return 1;
+    }
+    int worker_count = opt.threads < count ? opt.threads : count;
+    if(worker_count == 0) worker_count = 1;
+
+    batch b;
+    b.opt = &opt;
+    b.index = opt.index ? &index : NULL;
+    b.jobs = jobs;
+    b.worker_count = worker_count;
+    b.queues = aligned_alloc(64, worker_count * sizeof(work_queue));
+    pthread_t* threads = malloc(worker_count * sizeof(pthread_t));
+    worker* workers = malloc(worker_count * sizeof(worker));
+    if(!b.queues || !threads || !workers){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(int i = 0; i < worker_count; i++){
+        uint32_t begin = (uint64_t)count * i / worker_count;
+        uint32_t end = (uint64_t)count * (i + 1) / worker_count;
+        atomic_init(&b.queues[i].range, pack_range(begin, end));
+        workers[i].b = &b;
+        workers[i].id = i;
+    }
+
+    double start = seconds_now();
+    int started = 0;
+    for(; started < worker_count; started++){
+        if(pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0){
+            break;
+        }
+    }
+    if(started == 0){
+        worker_main(&workers[0]); //the others' ranges get stolen
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = seconds_now() - start;
+
+    print_results(jobs, count, opt.index != NULL);
+    uint64_t total = 0;
+    int faults = 0;
+    for(int i = 0; i < count; i++){
+        total += jobs[i].cycles;
+        faults += jobs[i].faulted;
+    }
+    fprintf(stderr, "%d roms, %d faulted, %d threads, %.3f s, %.0f instructions per second\n",
+            count, faults, worker_count, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+    int res = 0;
+    if(opt.write_index && !write_index(opt.write_index, b.index, jobs, count)){
+        res = 1;
+    }
+    if(opt.index){
+        rom_index_close(&index);
+    }
+
+    for(int i = 0; i < count; i++){
+        free(jobs[i].path);
+    }
+    free(jobs);
+    free(workers);
+    free(threads);
+    free(b.queues);
+    return res;
+}
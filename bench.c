@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "jit.h"
+
+
+//benchmarks every core on synthetic roms that each stress one part of the interpreter, then times
+//single handlers in isolation. Output is tab separated, one result per line, so runs from two
+//commits can be diffed or joined directly
+
+#define BENCH_INSTRUCTIONS_PER_FRAME 1000
+#define BENCH_FRAMES 2000
+#define BENCH_RUNS 5
+#define HANDLER_CALLS 1000000
+
+typedef struct{
+    const char* name;
+    const uint8_t* code;
+    int size;
+}rom;
+
+//V0..V7 churn through every 8xyN form, then jump back
+static const uint8_t alu_rom[] = {
+    0x60, 0x01, //200 V0 = 1
+    0x61, 0x03, //202 V1 = 3
+    0x80, 0x14, //204 V0 += V1
+    0x81, 0x05, //206 V1 -= V0
+    0x82, 0x06, //208 V2 >>= 1
+    0x83, 0x11, //20a V3 |= V1
+    0x84, 0x02, //20c V4 &= V0
+    0x85, 0x03, //20e V5 ^= V0
+    0x77, 0x01, //210 V7 += 1
+    0x82, 0x0e, //212 V2 <<= 1
+    0x86, 0x17, //214 V6 = V1 - V6
+    0x12, 0x04  //216 goto 204
+};
+
+//three nested calls per iteration
+static const uint8_t call_rom[] = {
+    0x22, 0x06, //200 call 206
+    0x70, 0x01, //202 V0 += 1
+    0x12, 0x00, //204 goto 200
+    0x22, 0x0c, //206 call 20c
+    0x71, 0x01, //208 V1 += 1
+    0x00, 0xee, //20a return
+    0x22, 0x12, //20c call 212
+    0x72, 0x01, //20e V2 += 1
+    0x00, 0xee, //210 return
+    0x73, 0x01, //212 V3 += 1
+    0x00, 0xee  //214 return
+};
+
+//every other instruction draws a font glyph at a moving position
+static const uint8_t draw_rom[] = {
+    0xa0, 0x50, //200 I = font 0
+    0xd0, 0x15, //202 draw V0, V1, 5
+    0x70, 0x03, //204 V0 += 3
+    0x71, 0x05, //206 V1 += 5
+    0xf2, 0x29, //208 I = font V2
+    0x72, 0x01, //20a V2 += 1
+    0x12, 0x02  //20c goto 202
+};
+
+//stores, loads and bcd conversions over a 256 byte window
+static const uint8_t memory_rom[] = {
+    0xa3, 0x00, //200 I = 300
+    0xf1, 0x1e, //202 I += V1
+    0xff, 0x55, //204 store V0..VF
+    0xff, 0x65, //206 load V0..VF
+    0xf0, 0x33, //208 bcd V0
+    0x71, 0x10, //20a V1 += 16
+    0x70, 0x01, //20c V0 += 1
+    0x12, 0x00  //20e goto 200
+};
+
+//spins on the delay timer like most games do between frames
+static const uint8_t timer_rom[] = {
+    0x60, 0x05, //200 V0 = 5
+    0xf0, 0x15, //202 delay = V0
+    0xf1, 0x07, //204 V1 = delay
+    0x31, 0x00, //206 skip if V1 == 0
+    0x12, 0x04, //208 goto 204
+    0x12, 0x00  //20a goto 200
+};
+
+static const rom roms[] = {
+    {"alu", alu_rom, sizeof(alu_rom)},
+    {"call", call_rom, sizeof(call_rom)},
+    {"draw", draw_rom, sizeof(draw_rom)},
+    {"memory", memory_rom, sizeof(memory_rom)},
+    {"timer", timer_rom, sizeof(timer_rom)}
+};
+
+static const struct{
+    const char* name;
+    execution_core core;
+}cores[] = {
+    {"cached", CORE_CACHED},
+    {"switch", CORE_SWITCH},
+    {"jit", CORE_JIT}
+};
+
+static uint64_t nanoseconds_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void load_rom(chip_8* c, const rom* r, uint8_t quirks){
+    init_chip_8(c);
+    c->quirks = quirks;
+    memcpy(c->memory + LOAD_ADDRESS, r->code, r->size);
+    memory_written(c, LOAD_ADDRESS, r->size);
+}
+
+//false if the core isn't available on this machine. Rates are over the instructions actually
+//executed, the ones an idle loop fast-forward skipped are reported in their own column
+static bool bench_rom(chip_8* c, const rom* r, const char* core_name, execution_core core, uint8_t quirks, uint64_t* frame_ns){
+    uint64_t instructions = 0;
+    uint64_t skipped = 0;
+    uint64_t total_ns = 0;
+    for(int run = 0; run < BENCH_RUNS; run++){
+        load_rom(c, r, quirks);
+        c->core = core;
+        if(core == CORE_JIT && !jit_init(c)){
+            return false;
+        }
+        for(int f = 0; f < BENCH_FRAMES; f++){
+            uint64_t start = nanoseconds_now();
+            run_frame(c, BENCH_INSTRUCTIONS_PER_FRAME);
+            uint64_t elapsed = nanoseconds_now() - start;
+            frame_ns[run * BENCH_FRAMES + f] = elapsed;
+            total_ns += elapsed;
+        }
+        instructions += c->cycles - c->idle_cycles;
+        skipped += c->idle_cycles;
+        jit_free(c);
+    }
+    const int samples = BENCH_RUNS * BENCH_FRAMES;
+    qsort(frame_ns, samples, sizeof(frame_ns[0]), compare_u64);
+    printf("rom\t%s\t%s\t%llu\t%.3f\t%.1f\t%.0f\t%.0f\t%llu\n", r->name, core_name, (unsigned long long)instructions,
+           (double)total_ns / instructions, instructions * 1e3 / total_ns,
+           (double)frame_ns[samples / 2], (double)frame_ns[samples * 99 / 100], (unsigned long long)skipped);
+    return true;
+}
+
+//best of several batches, the minimum is the least disturbed by the rest of the system
+#define BENCH_HANDLER(name, setup, call) \
+    do{ \
+        uint64_t best = UINT64_MAX; \
+        for(int run = 0; run < BENCH_RUNS; run++){ \
+            setup; \
+            uint64_t start = nanoseconds_now(); \
+            for(int i = 0; i < HANDLER_CALLS; i++){ \
+                call; \
+            } \
+            uint64_t elapsed = nanoseconds_now() - start; \
+            if(elapsed < best) best = elapsed; \
+        } \
+        printf("handler\t%s\t%.3f\n", name, (double)best / HANDLER_CALLS); \
+    }while(0)
+
+static void bench_handlers(chip_8* c){
+    init_chip_8(c);
+    for(int i = 0; i < 16; i++){
+        c->registers[i] = i * 17;
+    }
+    BENCH_HANDLER("draw_sprite", c->address_register = FONTSET_MEMORY_OFFSET,
+                  draw_sprite(c, i & 0xf, (i >> 4) & 0xf, 15));
+    BENCH_HANDLER("set_bcd", c->address_register = 0x300, set_bcd(c, i & 0xf));
+    BENCH_HANDLER("reg_dump", c->address_register = 0x300, reg_dump(c, 0xf));
+    BENCH_HANDLER("reg_load", c->address_register = 0x300, reg_load(c, 0xf));
+}
+
+int main(void){
+    chip_8* c = malloc(sizeof(chip_8));
+    uint64_t* frame_ns = malloc(BENCH_RUNS * BENCH_FRAMES * sizeof(uint64_t));
+    if(!c || !frame_ns){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    printf("#rom\tname\tcore\tinstructions\tns_per_instruction\tmips\tframe_p50_ns\tframe_p99_ns\tskipped\n");
+    printf("#handler\tname\tns_per_call\n");
+    for(size_t i = 0; i < sizeof(roms) / sizeof(roms[0]); i++){
+        for(size_t k = 0; k < sizeof(cores) / sizeof(cores[0]); k++){
+            if(!bench_rom(c, &roms[i], cores[k].name, cores[k].core, QUIRKS_MODERN, frame_ns)){
+                fprintf(stderr, "%s core not available, skipped\n", cores[k].name);
+            }
+        }
+        //each profile has its own copy of the interpreter loops, which should all run as fast as modern
+        for(int q = QUIRKS_MODERN + 1; q < QUIRKS_COUNT; q++){
+            char name[32];
+            snprintf(name, sizeof(name), "cached-%s", quirks_name(q));
+            bench_rom(c, &roms[i], name, CORE_CACHED, q, frame_ns);
+        }
+    }
+    bench_handlers(c);
+    free(frame_ns);
+    free(c);
+    return 0;
+}
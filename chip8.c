@@ -0,0 +1,1676 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "chip8.h"
+#include "jit.h"
+#include "aot.h"
+#include "trace.h"
+
+const unsigned char fontset[FONTSET_SIZE] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0,		// 0
+        0x20, 0x60, 0x20, 0x20, 0x70,		// 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0,		// 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0,		// 3
+        0x90, 0x90, 0xF0, 0x10, 0x10,		// 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0,		// 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0,		// 6
+        0xF0, 0x10, 0x20, 0x40, 0x40,		// 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0,		// 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0,		// 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90,		// A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0,		// B
+        0xF0, 0x80, 0x80, 0x80, 0xF0,		// C
+        0xE0, 0x90, 0x90, 0x90, 0xE0,		// D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0,		// E
+        0xF0, 0x80, 0xF0, 0x80, 0x80		// F
+};
+
+//Fx30 digits, 8x10. SCHIP only had 0-9, the letters are XO-CHIP's
+const unsigned char big_fontset[BIG_FONTSET_SIZE] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,		// 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,		// 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,		// 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,		// 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,		// 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,		// 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,		// 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,		// A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,		// B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,		// C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,		// D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,		// E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0		// F
+};
+
+const uint32_t plane_colors[1 << DISPLAY_PLANES] = {0, SCREEN_COLOR, PLANE2_COLOR, BOTH_PLANES_COLOR};
+
+#define QUIRK_FLAGS_MODERN 0
+#define QUIRK_FLAGS_VIP (QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_CLIP)
+#define QUIRK_FLAGS_CHIP48 (QUIRK_LOAD_STORE_I_X | QUIRK_JUMP_VX | QUIRK_CLIP)
+#define QUIRK_FLAGS_SCHIP (QUIRK_JUMP_VX | QUIRK_CLIP | QUIRK_HIRES)
+#define QUIRK_FLAGS_XOCHIP (QUIRK_SHIFT_VY | QUIRK_LOAD_STORE_I | QUIRK_HIRES | QUIRK_XO)
+
+const uint8_t quirk_flags[QUIRKS_COUNT] = {
+    [QUIRKS_MODERN] = QUIRK_FLAGS_MODERN,
+    [QUIRKS_VIP] = QUIRK_FLAGS_VIP,
+    [QUIRKS_CHIP48] = QUIRK_FLAGS_CHIP48,
+    [QUIRKS_SCHIP] = QUIRK_FLAGS_SCHIP,
+    [QUIRKS_XOCHIP] = QUIRK_FLAGS_XOCHIP
+};
+
+static const char* const quirk_names[QUIRKS_COUNT] = {
+    [QUIRKS_MODERN] = "modern",
+    [QUIRKS_VIP] = "vip",
+    [QUIRKS_CHIP48] = "chip48",
+    [QUIRKS_SCHIP] = "schip",
+    [QUIRKS_XOCHIP] = "xochip"
+};
+
+//I wraps within the memory the profile has
+#define ADDRESS_MASK(quirks) ((quirks) & QUIRK_XO ? EXTENDED_MEMORY_SIZE - 1 : MEMORY_SIZE - 1)
+
+const char* quirks_name(uint8_t profile){
+    return profile < QUIRKS_COUNT ? quirk_names[profile] : "unknown";
+}
+
+bool parse_quirks(const char* name, uint8_t* profile){
+    for(int i = 0; i < QUIRKS_COUNT; i++){
+        if(strcmp(name, quirk_names[i]) == 0){
+            *profile = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+void init_chip_8(chip_8* c){
+    memset(c->memory, 0, EXTENDED_MEMORY_SIZE * sizeof(c->memory[0]));
+    memcpy(c->memory + FONTSET_MEMORY_OFFSET, fontset, FONTSET_SIZE * sizeof(fontset[0]));
+    memcpy(c->memory + BIG_FONTSET_MEMORY_OFFSET, big_fontset, BIG_FONTSET_SIZE * sizeof(big_fontset[0]));
+    memset(c->display, 0, DISPLAY_WORDS * sizeof(c->display[0]));
+    c->hires = false;
+    c->planes = 1;
+    memset(c->stack, 0, STACK_SIZE * sizeof(c->stack[0]));
+    memset(c->registers, 0, 16 * sizeof(c->registers[0]));
+    memset(c->keys, 0, 16 * sizeof(c->keys[0]));
+    c->address_register = 0;
+    c->program_counter = LOAD_ADDRESS;
+    c->stack_pos = 0;
+    
+    c->delay_timer = 0;
+    c->sound_timer = 0;
+    
+    c->waiting_for_key = false;
+    c->key_target_reg = 0;
+    c->pressed_key = NO_KEY;
+    memset(c->flags, 0, FLAG_REGISTERS * sizeof(c->flags[0]));
+    memset(c->audio_pattern, 0, AUDIO_PATTERN_SIZE * sizeof(c->audio_pattern[0]));
+    c->pitch = 64; //4000Hz pattern playback
+
+    c->faulted = false;
+    c->fault_instruction = 0;
+    seed_random(c, 1);
+    c->cycles = 0;
+    c->idle_cycles = 0;
+
+    c->core = CORE_CACHED;
+    c->quirks = QUIRKS_MODERN;
+    c->jit = NULL;
+    c->aot = NULL;
+    c->trace = NULL;
+    c->debug = NULL;
+    memset(c->decoded, 0, MEMORY_SIZE * sizeof(c->decoded[0]));
+}
+
+void seed_random(chip_8* c, uint32_t seed){
+    c->random_state = seed != 0 ? seed : 1; //xorshift never leaves 0
+}
+
+//debugger hooks, the handlers that touch watched state call them only while a debugger is attached
+#ifndef CHIP8_NO_DEBUGGER
+static void debug_watch(chip_8* c, uint16_t address, int length, uint8_t kind){
+    debugger* d = c->debug;
+    const uint16_t mask = ADDRESS_MASK(quirk_flags[c->quirks]);
+    for(int i = 0; i < length && d->event == DEBUG_NONE; i++){
+        uint16_t a = (address + i) & mask;
+        //watchpoints only cover the first MEMORY_SIZE bytes
+        if(a < MEMORY_SIZE && (d->watch_map[a] & kind)){
+            d->event = kind == WATCH_READ ? DEBUG_WATCH_READ : DEBUG_WATCH_WRITE;
+            d->event_address = a;
+        }
+    }
+}
+
+static void debug_address_reg(chip_8* c){
+    debugger* d = c->debug;
+    uint16_t value = c->address_register;
+    if(d->event == DEBUG_NONE && (d->break_address_reg_map[value >> 6] >> (value & 63) & 1)){
+        d->event = DEBUG_BREAK_ADDRESS_REG;
+        d->event_address = value;
+    }
+}
+
+static bool debug_breaks_at(const debugger* d, uint16_t pc, uint16_t instruction){
+    return (d->breakpoints[pc >> 6] >> (pc & 63) & 1) || (d->break_instruction_map[instruction >> 6] >> (instruction & 63) & 1);
+}
+
+//false records the stop, true lets the instruction at a breakpoint run once after a stop there
+static bool debug_resume(chip_8* c, uint16_t pc){
+    debugger* d = c->debug;
+    if(d->resume && pc == d->event_address){
+        d->resume = false;
+        return true;
+    }
+    d->event = (d->breakpoints[pc >> 6] >> (pc & 63) & 1) ? DEBUG_BREAKPOINT : DEBUG_BREAK_INSTRUCTION;
+    d->event_address = pc;
+    return false;
+}
+
+#define DEBUG_ATTACHED(c) ((c)->debug != NULL)
+#define DEBUG_STOPPED(c) ((c)->debug && (c)->debug->event != DEBUG_NONE)
+#define WATCH_MEMORY(c, address, length, kind) do{ if((c)->debug) debug_watch(c, address, length, kind); }while(0)
+#define CHECK_ADDRESS_REG(c) do{ if((c)->debug) debug_address_reg(c); }while(0)
+#else
+#define DEBUG_ATTACHED(c) false
+#define DEBUG_STOPPED(c) false
+#define WATCH_MEMORY(c, address, length, kind) ((void)0)
+#define CHECK_ADDRESS_REG(c) ((void)0)
+#endif
+
+static decoded_instruction decode_at(chip_8* c, uint16_t pc){
+    uint16_t full = (c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+    decoded_instruction d = profile_instruction(decode_instruction(full), quirk_flags[c->quirks]);
+#ifndef CHIP8_NO_DEBUGGER
+    if(c->debug && debug_breaks_at(c->debug, pc, full)){
+        d.op = OP_BREAKPOINT;
+    }
+#endif
+    return d;
+}
+
+void memory_written(chip_8* c, uint16_t address, int length){
+    //the instruction starting one byte before the write overlaps it as well
+    for(int i = -1; i < length; i++){
+        c->decoded[(address + i) & (MEMORY_SIZE - 1)].op = OP_UNDECODED;
+    }
+    if(c->jit){
+        jit_invalidate(c, address, length);
+    }
+    if(c->aot){
+        aot_invalidate(c, address, length);
+    }
+}
+
+bool read_rom_file(const char* filename, uint8_t* data, int max, int* size){
+    FILE* fp = fopen(filename, "rb");
+    if(!fp){
+        chip8_error("could not open file!!!\n");
+        return false;
+    }
+    //one read, a byte past max means the file doesn't fit
+    size_t got = fread(data, 1, max, fp);
+    bool too_large = got == (size_t)max && fgetc(fp) != EOF;
+    bool failed = ferror(fp);
+    fclose(fp);
+    if(failed){
+        chip8_error("could not read file!!!\n");
+        return false;
+    }
+    if(too_large){
+        chip8_error("file too large!!!\n");
+        return false;
+    }
+    *size = got;
+    return true;
+}
+
+bool load_program_data(chip_8* c, const uint8_t* data, int size){
+    if(size > memory_size(c) - LOAD_ADDRESS){
+        chip8_error("file too large!!!\n");
+        return false;
+    }
+    memcpy(c->memory + LOAD_ADDRESS, data, size);
+    memory_written(c, LOAD_ADDRESS, size);
+    return true;
+}
+
+bool load_program(chip_8* c, const char* filename){
+    int size;
+    if(!read_rom_file(filename, c->memory + LOAD_ADDRESS, memory_size(c) - LOAD_ADDRESS, &size)){
+        return false;
+    }
+    memory_written(c, LOAD_ADDRESS, size);
+    return true;
+}
+
+int memory_size(const chip_8* c){
+    return quirk_flags[c->quirks] & QUIRK_XO ? EXTENDED_MEMORY_SIZE : MEMORY_SIZE;
+}
+
+int display_words(const chip_8* c){
+    int words = c->hires ? 2 * HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT;
+    return quirk_flags[c->quirks] & QUIRK_XO ? DISPLAY_PLANES * words : words;
+}
+
+uint16_t get_current_instruction(chip_8* c){
+    uint8_t hi = c->memory[c->program_counter];
+    uint8_t lo = c->memory[c->program_counter+1];
+    uint16_t full = (hi << 8) | lo;
+    return full;
+}
+
+uint16_t get_next_instruction(chip_8* c){
+    uint8_t hi = c->memory[c->program_counter+2];
+    uint8_t lo = c->memory[c->program_counter+3];
+    uint16_t full = (hi << 8) | lo;
+    return full;
+}
+
+void push(chip_8* c, uint16_t value){
+    if(c->stack_pos+1 >= STACK_SIZE-1){
+        chip8_error("stack overflow!!!");
+        return;
+    }
+    
+    c->stack_pos++;
+    c->stack[c->stack_pos] = value;
+}
+
+uint16_t pop(chip_8* c){
+    if(c->stack_pos == 0){
+        chip8_error("stack underflow!!!");
+        return -1;
+    }
+    uint16_t result = c->stack[c->stack_pos];
+    c->stack_pos--;
+    return result;
+}
+
+//the handlers that depend on the quirk profile. The interpreter loops inline them with constant
+//quirks, which folds the quirk tests away, the exported handlers pass c's profile
+#define QUIRK_HANDLER static inline __attribute__((always_inline))
+
+static inline int screen_height(const chip_8* c){
+    return c->hires ? HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT;
+}
+
+static inline int row_words(const chip_8* c){
+    return c->hires ? HIRES_SCREEN_WIDTH / 64 : 1;
+}
+
+//the first row of a plane in the current mode
+static inline uint64_t* plane_rows(chip_8* c, int plane){
+    return c->display + plane * screen_height(c) * row_words(c);
+}
+
+//00E0 only clears the selected planes
+QUIRK_HANDLER void clear_screen_quirks(chip_8* c, const int quirks){
+    if(quirks & QUIRK_HIRES){
+        for(int p = 0; p < DISPLAY_PLANES; p++){
+            if((c->planes >> p) & 1){
+                memset(plane_rows(c, p), 0, screen_height(c) * row_words(c) * sizeof(c->display[0]));
+            }
+        }
+    }
+    else{
+        memset(plane_rows(c, 0), 0, VIRTUAL_SCREEN_HEIGHT * sizeof(c->display[0]));
+    }
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void clear_screen(chip_8* c){
+    clear_screen_quirks(c, quirk_flags[c->quirks]);
+}
+
+void return_from_subroutine(chip_8* c){
+    c->program_counter = pop(c);
+}
+
+void goto_address(chip_8* c, uint16_t address){
+    c->program_counter = address;
+}
+
+void call_subroutine(chip_8* c, uint16_t address){
+    push(c, c->program_counter + INSTRUCTION_SIZE);
+    goto_address(c, address);
+}
+
+//XO-CHIP skips step over both words of F000 nnnn
+QUIRK_HANDLER int skip_length(const chip_8* c, const int quirks){
+    if(quirks & QUIRK_XO){
+        uint16_t next = (c->program_counter + INSTRUCTION_SIZE) & (MEMORY_SIZE - 1);
+        if(c->memory[next] == 0xf0 && c->memory[(next + 1) & (MEMORY_SIZE - 1)] == 0x00){
+            return 3 * INSTRUCTION_SIZE;
+        }
+    }
+    return 2 * INSTRUCTION_SIZE;
+}
+
+QUIRK_HANDLER void skip_equal_quirks(chip_8* c, uint8_t reg, uint8_t val, const int quirks){
+    if(c->registers[reg] == val){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_equal(chip_8* c, uint8_t reg, uint8_t val){
+    skip_equal_quirks(c, reg, val, quirk_flags[c->quirks]);
+}
+
+QUIRK_HANDLER void skip_not_equal_quirks(chip_8* c, uint8_t reg, uint8_t val, const int quirks){
+    if(c->registers[reg] != val){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_not_equal(chip_8* c, uint8_t reg, uint8_t val){
+    skip_not_equal_quirks(c, reg, val, quirk_flags[c->quirks]);
+}
+
+QUIRK_HANDLER void skip_equal_reg_quirks(chip_8* c, uint8_t reg1, uint8_t reg2, const int quirks){
+    if(c->registers[reg1] == c->registers[reg2]){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
+    skip_equal_reg_quirks(c, reg1, reg2, quirk_flags[c->quirks]);
+}
+
+void load_imm(chip_8* c, uint8_t reg, uint8_t val){
+    c->registers[reg] = val;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void add_imm(chip_8* c, uint8_t reg, uint8_t val){
+    c->registers[reg] += val;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void mov(chip_8* c, uint8_t reg1, uint8_t reg2){
+    c->registers[reg1] = c->registers[reg2];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void bit_or(chip_8* c, uint8_t reg1, uint8_t reg2){
+    c->registers[reg1] |= c->registers[reg2];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void bit_and(chip_8* c, uint8_t reg1, uint8_t reg2){
+    c->registers[reg1] &= c->registers[reg2];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void bit_xor(chip_8* c, uint8_t reg1, uint8_t reg2){
+    c->registers[reg1] ^= c->registers[reg2];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void add_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
+    int a = c->registers[reg1];
+    int b = c->registers[reg2];
+    int res = a + b;
+    c->registers[VF] = res > 0xff;
+    c->registers[reg1] = res & 0xff;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void sub_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
+    int a = c->registers[reg1];
+    int b = c->registers[reg2];
+    int res = a - b;
+    c->registers[VF] = res >= 0;
+    c->registers[reg1] = res & 0xff;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+QUIRK_HANDLER void shift_right_quirks(chip_8* c, uint8_t reg1, uint8_t reg2, const int quirks){
+    uint8_t source = quirks & QUIRK_SHIFT_VY ? reg2 : reg1;
+    c->registers[VF] = (c->registers[source]) & 1;
+    c->registers[reg1] = c->registers[source] >> 1;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void shift_right(chip_8* c, uint8_t reg1, uint8_t reg2){
+    shift_right_quirks(c, reg1, reg2, quirk_flags[c->quirks]);
+}
+
+void sub_reg_switch(chip_8* c, uint8_t reg1, uint8_t reg2){
+    int a = c->registers[reg1];
+    int b = c->registers[reg2];
+    int res = b - a;
+    c->registers[VF] = res >= 0;
+    c->registers[reg1] = res & 0xff;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+
+QUIRK_HANDLER void shift_left_quirks(chip_8* c, uint8_t reg1, uint8_t reg2, const int quirks){
+    uint8_t source = quirks & QUIRK_SHIFT_VY ? reg2 : reg1;
+    c->registers[VF] = ((c->registers[source]) >> 7) & 1;
+    c->registers[reg1] = c->registers[source] << 1;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void shift_left(chip_8* c, uint8_t reg1, uint8_t reg2){
+    shift_left_quirks(c, reg1, reg2, quirk_flags[c->quirks]);
+}
+
+
+QUIRK_HANDLER void skip_not_equal_reg_quirks(chip_8* c, uint8_t reg1, uint8_t reg2, const int quirks){
+    if(c->registers[reg1] != c->registers[reg2]){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_not_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
+    skip_not_equal_reg_quirks(c, reg1, reg2, quirk_flags[c->quirks]);
+}
+
+void set_address_reg(chip_8* c, uint16_t val){
+    c->address_register = val;
+    CHECK_ADDRESS_REG(c);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+
+//Bxnn with QUIRK_JUMP_VX, the register is the top nibble of the address
+QUIRK_HANDLER void goto_address_plus_V0_quirks(chip_8* c, uint16_t address, const int quirks){
+    c->program_counter = address + c->registers[quirks & QUIRK_JUMP_VX ? address >> 8 : 0];
+}
+
+void goto_address_plus_V0(chip_8* c, uint16_t address){
+    goto_address_plus_V0_quirks(c, address, quirk_flags[c->quirks]);
+}
+
+void rand_mod(chip_8* c, uint8_t reg, uint8_t m){
+    uint32_t x = c->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->random_state = x;
+    c->registers[reg] = (x >> 24) & m;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+static inline uint64_t rotate_right(uint64_t v, int n){
+    return (v >> n) | (v << ((64 - n) & 63));
+}
+
+//a 128x64 row as one value, the leftmost column in bit 127
+__extension__ typedef unsigned __int128 hires_row;
+
+//draw_sprite() on the extended machines: Dxy0 draws 16x16, 128x64 rows take two words and every
+//selected plane gets its own sprite, each plane's data following the previous one's
+static void draw_sprite_extended(chip_8* c, uint8_t reg1, uint8_t reg2, uint8_t n, const int quirks){
+    const int width = c->hires ? HIRES_SCREEN_WIDTH : VIRTUAL_SCREEN_WIDTH;
+    const int height = screen_height(c);
+    const uint16_t mask = ADDRESS_MASK(quirks);
+    const int row_bytes = n == 0 ? 2 : 1;
+    const int rows = n == 0 ? 16 : n;
+    int x_start = c->registers[reg1] & (width - 1);
+    int y_start = c->registers[reg2] & (height - 1);
+    int visible = rows;
+    if((quirks & QUIRK_CLIP) && visible > height - y_start) visible = height - y_start;
+    uint16_t address = c->address_register;
+    bool collision = false;
+    for(int p = 0; p < DISPLAY_PLANES; p++){
+        if(!((c->planes >> p) & 1)) continue;
+        uint64_t* plane = plane_rows(c, p);
+        for(int y = 0; y < visible; y++){
+            uint16_t a = address + y * row_bytes;
+            uint64_t line = (uint64_t)c->memory[a & mask] << 56;
+            if(row_bytes == 2){
+                line |= (uint64_t)c->memory[(a + 1) & mask] << 48;
+            }
+            int row = (y_start + y) & (height - 1);
+            if(c->hires){
+                uint64_t* words = &plane[2 * row];
+                hires_row wide = (hires_row)line << 64;
+                hires_row sprite = wide >> x_start;
+                if(!(quirks & QUIRK_CLIP) && x_start != 0){
+                    sprite |= wide << (HIRES_SCREEN_WIDTH - x_start);
+                }
+                hires_row current = ((hires_row)words[0] << 64) | words[1];
+                collision |= (current & sprite) != 0;
+                current ^= sprite;
+                words[0] = current >> 64;
+                words[1] = (uint64_t)current;
+            }
+            else{
+                uint64_t sprite = quirks & QUIRK_CLIP ? line >> x_start : rotate_right(line, x_start);
+                collision |= (plane[row] & sprite) != 0;
+                plane[row] ^= sprite;
+            }
+        }
+        address += rows * row_bytes;
+    }
+    c->registers[VF] = collision;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//each sprite row is placed at the top of a word and rotated into position, which also wraps it
+//around the right edge. Clipping shifts instead and drops the rows below the bottom edge, the
+//start position wraps either way. A collision is any bit set in both the row and the sprite.
+//The extended machines only leave this path for 128x64, 16x16 sprites or more than the first plane
+QUIRK_HANDLER void draw_sprite_quirks(chip_8* c, uint8_t reg1, uint8_t reg2, uint8_t n, const int quirks){
+    if((quirks & QUIRK_HIRES) && (c->hires || n == 0 || c->planes != 1)){
+        draw_sprite_extended(c, reg1, reg2, n, quirks);
+        return;
+    }
+    int x_start = c->registers[reg1] % VIRTUAL_SCREEN_WIDTH;
+    int y_start = c->registers[reg2];
+    int rows = n;
+    if(quirks & QUIRK_CLIP){
+        y_start %= VIRTUAL_SCREEN_HEIGHT;
+        if(rows > VIRTUAL_SCREEN_HEIGHT - y_start) rows = VIRTUAL_SCREEN_HEIGHT - y_start;
+    }
+    uint64_t collision = 0;
+    for(int y = 0; y < rows; y++){
+        uint64_t* row = &c->display[(y_start + y) % VIRTUAL_SCREEN_HEIGHT];
+        uint64_t line = (uint64_t)c->memory[(c->address_register + y) & ADDRESS_MASK(quirks)] << 56;
+        uint64_t sprite = quirks & QUIRK_CLIP ? line >> x_start : rotate_right(line, x_start);
+        collision |= *row & sprite;
+        *row ^= sprite;
+    }
+    c->registers[VF] = collision != 0;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void draw_sprite(chip_8* c, uint8_t reg1, uint8_t reg2, uint8_t n){
+    draw_sprite_quirks(c, reg1, reg2, n, quirk_flags[c->quirks]);
+}
+
+QUIRK_HANDLER void skip_if_key_pressed_quirks(chip_8* c, uint8_t reg, const int quirks){
+    if(c->keys[c->registers[reg] & 0xf] == 1){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_if_key_pressed(chip_8* c, uint8_t reg){
+    skip_if_key_pressed_quirks(c, reg, quirk_flags[c->quirks]);
+}
+
+QUIRK_HANDLER void skip_if_key_not_pressed_quirks(chip_8* c, uint8_t reg, const int quirks){
+    if(c->keys[c->registers[reg] & 0xf] == 0){
+        c->program_counter += skip_length(c, quirks);
+    }
+    else{
+        c->program_counter += INSTRUCTION_SIZE;
+    }
+}
+
+void skip_if_key_not_pressed(chip_8* c, uint8_t reg){
+    skip_if_key_not_pressed_quirks(c, reg, quirk_flags[c->quirks]);
+}
+
+void get_delay(chip_8* c, uint8_t reg){
+    c->registers[reg] = c->delay_timer;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void wait_for_key(chip_8* c, uint8_t reg){
+    c->waiting_for_key = true;
+    c->key_target_reg = reg;
+    c->pressed_key = NO_KEY;
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void key_event(chip_8* c, uint8_t key){
+    c->registers[c->key_target_reg] = key;
+    c->waiting_for_key = false;
+    c->pressed_key = NO_KEY;
+}
+
+//like the original interpreter, Fx0A remembers the first key to go down and finishes once it is
+//released again. false while the wait goes on
+static bool key_wait_over(chip_8* c){
+    if(c->pressed_key == NO_KEY){
+        for(int i = 0; i < 16; i++){
+            if(c->keys[i] != 0){
+                c->pressed_key = i;
+                break;
+            }
+        }
+        return false;
+    }
+    if(c->keys[c->pressed_key] != 0){
+        return false;
+    }
+    key_event(c, c->pressed_key);
+    return true;
+}
+
+void set_delay(chip_8* c, uint8_t reg){
+    c->delay_timer = c->registers[reg];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_sound(chip_8* c, uint8_t reg){
+    c->sound_timer = c->registers[reg];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void add_address_reg(chip_8* c, uint8_t reg){
+    c->address_register += c->registers[reg];
+    CHECK_ADDRESS_REG(c);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_font_char(chip_8* c, uint8_t reg){
+    c->address_register = FONTSET_MEMORY_OFFSET + c->registers[reg] * 5;
+    CHECK_ADDRESS_REG(c);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//writes through I. On XO-CHIP they can land above MEMORY_SIZE, where no code runs from
+QUIRK_HANDLER void address_written(chip_8* c, uint16_t address, int length, const int quirks){
+    if((quirks & QUIRK_XO) && address >= MEMORY_SIZE && address + length <= EXTENDED_MEMORY_SIZE){
+        return;
+    }
+    memory_written(c, address, length);
+}
+
+QUIRK_HANDLER void set_bcd_quirks(chip_8* c, uint8_t reg, const int quirks){
+    const uint16_t mask = ADDRESS_MASK(quirks);
+    int num = c->registers[reg];
+    int ones = num % 10;
+    int tens = (num / 10) % 10;
+    int huns = (num / 100) % 10;
+    c->memory[(c->address_register + 0) & mask] = huns & 0xff;
+    c->memory[(c->address_register + 1) & mask] = tens & 0xff;
+    c->memory[(c->address_register + 2) & mask] = ones & 0xff;
+    address_written(c, c->address_register, 3, quirks);
+    WATCH_MEMORY(c, c->address_register, 3, WATCH_WRITE);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_bcd(chip_8* c, uint8_t reg){
+    set_bcd_quirks(c, reg, quirk_flags[c->quirks]);
+}
+
+//Fx55/Fx65 moving I past the registers
+QUIRK_HANDLER void advance_address_reg(chip_8* c, uint8_t reg, const int quirks){
+    if(quirks & (QUIRK_LOAD_STORE_I | QUIRK_LOAD_STORE_I_X)){
+        c->address_register += quirks & QUIRK_LOAD_STORE_I ? reg + 1 : reg;
+        CHECK_ADDRESS_REG(c);
+    }
+}
+
+QUIRK_HANDLER void reg_dump_quirks(chip_8* c, uint8_t reg, const int quirks){
+    const uint16_t mask = ADDRESS_MASK(quirks);
+    for(int i = 0; i <= reg; i++){
+        c->memory[(c->address_register + i) & mask] = c->registers[i];
+    }
+    address_written(c, c->address_register, reg + 1, quirks);
+    WATCH_MEMORY(c, c->address_register, reg + 1, WATCH_WRITE);
+    advance_address_reg(c, reg, quirks);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void reg_dump(chip_8* c, uint8_t reg){
+    reg_dump_quirks(c, reg, quirk_flags[c->quirks]);
+}
+
+QUIRK_HANDLER void reg_load_quirks(chip_8* c, uint8_t reg, const int quirks){
+    const uint16_t mask = ADDRESS_MASK(quirks);
+    for(int i = 0; i <= reg; i++){
+        c->registers[i] = c->memory[(c->address_register + i) & mask];
+    }
+    WATCH_MEMORY(c, c->address_register, reg + 1, WATCH_READ);
+    advance_address_reg(c, reg, quirks);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void reg_load(chip_8* c, uint8_t reg){
+    reg_load_quirks(c, reg, quirk_flags[c->quirks]);
+}
+
+//the scrolls move whole rows of the selected planes, vertically with one memmove per plane
+static void scroll_vertical(chip_8* c, int n, bool down){
+    const int height = screen_height(c);
+    const size_t row_size = row_words(c) * sizeof(c->display[0]);
+    if(n > height) n = height;
+    for(int p = 0; p < DISPLAY_PLANES; p++){
+        if(!((c->planes >> p) & 1)) continue;
+        uint8_t* rows = (uint8_t*)plane_rows(c, p);
+        if(down){
+            memmove(rows + n * row_size, rows, (height - n) * row_size);
+            memset(rows, 0, n * row_size);
+        }
+        else{
+            memmove(rows, rows + n * row_size, (height - n) * row_size);
+            memset(rows + (height - n) * row_size, 0, n * row_size);
+        }
+    }
+}
+
+void scroll_down(chip_8* c, uint8_t n){
+    scroll_vertical(c, n, true);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void scroll_up(chip_8* c, uint8_t n){
+    scroll_vertical(c, n, false);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//00FB/00FC move by 4 pixels, a 128 pixel row carries the bits from one word into the other
+static void scroll_horizontal(chip_8* c, bool right){
+    const int height = screen_height(c);
+    for(int p = 0; p < DISPLAY_PLANES; p++){
+        if(!((c->planes >> p) & 1)) continue;
+        uint64_t* rows = plane_rows(c, p);
+        for(int y = 0; y < height; y++){
+            if(!c->hires){
+                rows[y] = right ? rows[y] >> 4 : rows[y] << 4;
+            }
+            else if(right){
+                rows[2 * y + 1] = (rows[2 * y + 1] >> 4) | (rows[2 * y] << 60);
+                rows[2 * y] >>= 4;
+            }
+            else{
+                rows[2 * y] = (rows[2 * y] << 4) | (rows[2 * y + 1] >> 60);
+                rows[2 * y + 1] <<= 4;
+            }
+        }
+    }
+}
+
+void scroll_right(chip_8* c){
+    scroll_horizontal(c, true);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void scroll_left(chip_8* c){
+    scroll_horizontal(c, false);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//00FD stops the program, the program counter stays on it so it spins there
+void exit_interpreter(chip_8* c){
+    (void)c;
+}
+
+//switching modes clears the screen, the row layout changes with it
+void set_lores(chip_8* c){
+    c->hires = false;
+    memset(c->display, 0, sizeof(c->display));
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_hires(chip_8* c){
+    c->hires = true;
+    memset(c->display, 0, sizeof(c->display));
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_big_font_char(chip_8* c, uint8_t reg){
+    c->address_register = BIG_FONTSET_MEMORY_OFFSET + (c->registers[reg] & 0xf) * 10;
+    CHECK_ADDRESS_REG(c);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void save_flags(chip_8* c, uint8_t reg){
+    memcpy(c->flags, c->registers, reg + 1);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void load_flags(chip_8* c, uint8_t reg){
+    memcpy(c->registers, c->flags, reg + 1);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//5xy2/5xy3 go from Vx to Vy in either direction and leave I alone
+void save_range(chip_8* c, uint8_t reg1, uint8_t reg2){
+    int step = reg1 <= reg2 ? 1 : -1;
+    int count = (reg1 <= reg2 ? reg2 - reg1 : reg1 - reg2) + 1;
+    for(int i = 0; i < count; i++){
+        c->memory[(uint16_t)(c->address_register + i)] = c->registers[reg1 + i * step];
+    }
+    address_written(c, c->address_register, count, QUIRK_XO);
+    WATCH_MEMORY(c, c->address_register, count, WATCH_WRITE);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void load_range(chip_8* c, uint8_t reg1, uint8_t reg2){
+    int step = reg1 <= reg2 ? 1 : -1;
+    int count = (reg1 <= reg2 ? reg2 - reg1 : reg1 - reg2) + 1;
+    for(int i = 0; i < count; i++){
+        c->registers[reg1 + i * step] = c->memory[(uint16_t)(c->address_register + i)];
+    }
+    WATCH_MEMORY(c, c->address_register, count, WATCH_READ);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_address_reg_long(chip_8* c){
+    uint16_t operand = (c->program_counter + INSTRUCTION_SIZE) & (MEMORY_SIZE - 1);
+    c->address_register = (c->memory[operand] << 8) | c->memory[(operand + 1) & (MEMORY_SIZE - 1)];
+    CHECK_ADDRESS_REG(c);
+    c->program_counter += 2 * INSTRUCTION_SIZE;
+}
+
+void select_planes(chip_8* c, uint8_t mask){
+    c->planes = mask & ((1 << DISPLAY_PLANES) - 1);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void load_audio(chip_8* c){
+    for(int i = 0; i < AUDIO_PATTERN_SIZE; i++){
+        c->audio_pattern[i] = c->memory[(uint16_t)(c->address_register + i)];
+    }
+    WATCH_MEMORY(c, c->address_register, AUDIO_PATTERN_SIZE, WATCH_READ);
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+void set_pitch(chip_8* c, uint8_t reg){
+    c->pitch = c->registers[reg];
+    c->program_counter += INSTRUCTION_SIZE;
+}
+
+//the program counter stays on the bad instruction, the caller decides what to report
+void not_implemented(chip_8* c, uint16_t instruction){
+    c->faulted = true;
+    c->fault_instruction = instruction;
+}
+void fprint_instruction(FILE* fp, uint16_t instr){
+    uint16_t full = instr;
+    uint8_t hi = instr >> 8;
+    uint8_t lo = instr & 0xff;
+    switch(hi >> 4){
+        case 0x0:
+            if(full == 0x00E0){
+                fprintf(fp, "clear_screen");
+            }
+            else if(full == 0x00EE){
+                fprintf(fp, "return_from_subroutine");
+            }
+            else if((full & 0xfff0) == 0x00C0){
+                fprintf(fp, "scroll_down 0x%02x", lo & 0xf);
+            }
+            else if((full & 0xfff0) == 0x00D0){
+                fprintf(fp, "scroll_up 0x%02x", lo & 0xf);
+            }
+            else if(full == 0x00FB){
+                fprintf(fp, "scroll_right");
+            }
+            else if(full == 0x00FC){
+                fprintf(fp, "scroll_left");
+            }
+            else if(full == 0x00FD){
+                fprintf(fp, "exit");
+            }
+            else if(full == 0x00FE){
+                fprintf(fp, "lores");
+            }
+            else if(full == 0x00FF){
+                fprintf(fp, "hires");
+            }
+            else{
+                fprintf(fp, "not_implemented");
+            }
+            break;
+        case 0x1:
+            fprintf(fp, "goto_address 0x%04x", full & 0xfff);
+            break;
+        case 0x2:
+            fprintf(fp, "call_subroutine 0x%04x", full & 0xfff);
+            break;
+        case 0x3:
+            fprintf(fp, "skip_equal 0x%02x 0x%02x", hi & 0xf, lo);
+            break;
+        case 0x4:
+            fprintf(fp, "skip_not_equal 0x%02x 0x%02x", hi & 0xf, lo);
+            break;
+        case 0x5:
+            if((lo & 0xf) == 2){
+                fprintf(fp, "save_range 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 3){
+                fprintf(fp, "load_range 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else{
+                fprintf(fp, "skip_equal_reg 0x%02x 0x%02x", hi & 0xf, lo);
+            }
+            break;
+        case 0x6:
+            fprintf(fp, "load_imm 0x%02x 0x%02x", hi & 0xf, lo);
+            break;
+        case 0x7:
+            fprintf(fp, "add_imm 0x%02x 0x%02x", hi & 0xf, lo);
+            break;
+        case 0x8:
+            if((lo & 0xf) == 0){
+                fprintf(fp, "mov 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 1){
+                fprintf(fp, "bit_or 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 2){
+                fprintf(fp, "bit_and 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 3){
+                fprintf(fp, "bit_xor 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 4){
+                fprintf(fp, "add_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 5){
+                fprintf(fp, "sub_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 6){
+                fprintf(fp, "shift_right 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 7){
+                fprintf(fp, "sub_reg_switch 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 0xe){
+                fprintf(fp, "shift_left 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            }
+            else{
+                fprintf(fp, "not_implemented");
+            }
+            break;
+        case 0x9:
+            fprintf(fp, "skip_not_equal_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
+            break;
+        case 0xa:
+            fprintf(fp, "set_address_reg 0x%04x", full & 0xfff);
+            break;
+        case 0xb:
+            fprintf(fp, "goto_address_plus_V0 0x%04x", full & 0xfff);
+            break;
+        case 0xc:
+            fprintf(fp, "rand_mod 0x%02x 0x%02x", hi & 0xf, lo);
+            break;
+        case 0xd:
+            fprintf(fp, "draw_sprite 0x%02x 0x%02x 0x%02x", hi & 0xf, lo >> 4, lo & 0xf);
+            break;
+        case 0xe:
+            if(lo == 0x9e){
+                fprintf(fp, "skip_if_key_pressed 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0xa1){
+                fprintf(fp, "skip_if_key_not_pressed 0x%02x", hi & 0xf);
+            }
+            else{
+                fprintf(fp, "not_implemented");
+            }
+            break;
+        case 0xf:
+            if(full == 0xF000){
+                fprintf(fp, "set_address_reg_long");
+            }
+            else if(lo == 0x01){
+                fprintf(fp, "select_planes 0x%02x", hi & 0xf);
+            }
+            else if(full == 0xF002){
+                fprintf(fp, "load_audio");
+            }
+            else if(lo == 0x07){
+                fprintf(fp, "get_delay 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x0a){
+                fprintf(fp, "wait_for_key 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x15){
+                fprintf(fp, "set_delay 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x18){
+                fprintf(fp, "set_sound 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x1e){
+                fprintf(fp, "add_address_reg 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x29){
+                fprintf(fp, "set_font_char 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x30){
+                fprintf(fp, "set_big_font_char 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x33){
+                fprintf(fp, "set_bcd 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x3a){
+                fprintf(fp, "set_pitch 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x55){
+                fprintf(fp, "reg_dump 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x65){
+                fprintf(fp, "reg_load 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x75){
+                fprintf(fp, "save_flags 0x%02x", hi & 0xf);
+            }
+            else if(lo == 0x85){
+                fprintf(fp, "load_flags 0x%02x", hi & 0xf);
+            }
+            else{
+                fprintf(fp, "not_implemented");
+            }
+            break;
+        default:
+            fprintf(fp, "not_implemented");
+    }
+}
+
+void debug_decode(uint16_t instr){
+    fprint_instruction(stdout, instr);
+}
+
+const char* op_name(uint8_t op){
+    static const char* const names[] = {
+        [OP_UNDECODED] = "undecoded",
+        [OP_CLEAR_SCREEN] = "clear_screen",
+        [OP_RETURN_FROM_SUBROUTINE] = "return_from_subroutine",
+        [OP_GOTO_ADDRESS] = "goto_address",
+        [OP_CALL_SUBROUTINE] = "call_subroutine",
+        [OP_SKIP_EQUAL] = "skip_equal",
+        [OP_SKIP_NOT_EQUAL] = "skip_not_equal",
+        [OP_SKIP_EQUAL_REG] = "skip_equal_reg",
+        [OP_LOAD_IMM] = "load_imm",
+        [OP_ADD_IMM] = "add_imm",
+        [OP_MOV] = "mov",
+        [OP_BIT_OR] = "bit_or",
+        [OP_BIT_AND] = "bit_and",
+        [OP_BIT_XOR] = "bit_xor",
+        [OP_ADD_REG] = "add_reg",
+        [OP_SUB_REG] = "sub_reg",
+        [OP_SHIFT_RIGHT] = "shift_right",
+        [OP_SUB_REG_SWITCH] = "sub_reg_switch",
+        [OP_SHIFT_LEFT] = "shift_left",
+        [OP_SKIP_NOT_EQUAL_REG] = "skip_not_equal_reg",
+        [OP_SET_ADDRESS_REG] = "set_address_reg",
+        [OP_GOTO_ADDRESS_PLUS_V0] = "goto_address_plus_V0",
+        [OP_RAND_MOD] = "rand_mod",
+        [OP_DRAW_SPRITE] = "draw_sprite",
+        [OP_SKIP_IF_KEY_PRESSED] = "skip_if_key_pressed",
+        [OP_SKIP_IF_KEY_NOT_PRESSED] = "skip_if_key_not_pressed",
+        [OP_GET_DELAY] = "get_delay",
+        [OP_WAIT_FOR_KEY] = "wait_for_key",
+        [OP_SET_DELAY] = "set_delay",
+        [OP_SET_SOUND] = "set_sound",
+        [OP_ADD_ADDRESS_REG] = "add_address_reg",
+        [OP_SET_FONT_CHAR] = "set_font_char",
+        [OP_SET_BCD] = "set_bcd",
+        [OP_REG_DUMP] = "reg_dump",
+        [OP_REG_LOAD] = "reg_load",
+        [OP_SCROLL_DOWN] = "scroll_down",
+        [OP_SCROLL_RIGHT] = "scroll_right",
+        [OP_SCROLL_LEFT] = "scroll_left",
+        [OP_EXIT] = "exit",
+        [OP_LORES] = "lores",
+        [OP_HIRES] = "hires",
+        [OP_SET_BIG_FONT_CHAR] = "set_big_font_char",
+        [OP_SAVE_FLAGS] = "save_flags",
+        [OP_LOAD_FLAGS] = "load_flags",
+        [OP_SCROLL_UP] = "scroll_up",
+        [OP_SAVE_RANGE] = "save_range",
+        [OP_LOAD_RANGE] = "load_range",
+        [OP_SET_ADDRESS_REG_LONG] = "set_address_reg_long",
+        [OP_SELECT_PLANES] = "select_planes",
+        [OP_LOAD_AUDIO] = "load_audio",
+        [OP_SET_PITCH] = "set_pitch",
+        [OP_NOT_IMPLEMENTED] = "not_implemented",
+        [OP_BREAKPOINT] = "breakpoint"
+    };
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : "unknown";
+}
+
+decoded_instruction decode_instruction(uint16_t instr){
+    uint8_t hi = instr >> 8;
+    uint8_t lo = instr & 0xff;
+    decoded_instruction d = {OP_NOT_IMPLEMENTED, hi & 0xf, lo >> 4, lo};
+    switch(hi >> 4){
+        case 0x0:
+            if(instr == 0x00E0) d.op = OP_CLEAR_SCREEN;
+            else if(instr == 0x00EE) d.op = OP_RETURN_FROM_SUBROUTINE;
+            else if((instr & 0xfff0) == 0x00C0) d.op = OP_SCROLL_DOWN;
+            else if((instr & 0xfff0) == 0x00D0) d.op = OP_SCROLL_UP;
+            else if(instr == 0x00FB) d.op = OP_SCROLL_RIGHT;
+            else if(instr == 0x00FC) d.op = OP_SCROLL_LEFT;
+            else if(instr == 0x00FD) d.op = OP_EXIT;
+            else if(instr == 0x00FE) d.op = OP_LORES;
+            else if(instr == 0x00FF) d.op = OP_HIRES;
+            break;
+        case 0x1: d.op = OP_GOTO_ADDRESS; break;
+        case 0x2: d.op = OP_CALL_SUBROUTINE; break;
+        case 0x3: d.op = OP_SKIP_EQUAL; break;
+        case 0x4: d.op = OP_SKIP_NOT_EQUAL; break;
+        case 0x5:
+            if((lo & 0xf) == 2) d.op = OP_SAVE_RANGE;
+            else if((lo & 0xf) == 3) d.op = OP_LOAD_RANGE;
+            else d.op = OP_SKIP_EQUAL_REG;
+            break;
+        case 0x6: d.op = OP_LOAD_IMM; break;
+        case 0x7: d.op = OP_ADD_IMM; break;
+        case 0x8:
+            switch(lo & 0xf){
+                case 0x0: d.op = OP_MOV; break;
+                case 0x1: d.op = OP_BIT_OR; break;
+                case 0x2: d.op = OP_BIT_AND; break;
+                case 0x3: d.op = OP_BIT_XOR; break;
+                case 0x4: d.op = OP_ADD_REG; break;
+                case 0x5: d.op = OP_SUB_REG; break;
+                case 0x6: d.op = OP_SHIFT_RIGHT; break;
+                case 0x7: d.op = OP_SUB_REG_SWITCH; break;
+                case 0xe: d.op = OP_SHIFT_LEFT; break;
+            }
+            break;
+        case 0x9: d.op = OP_SKIP_NOT_EQUAL_REG; break;
+        case 0xa: d.op = OP_SET_ADDRESS_REG; break;
+        case 0xb: d.op = OP_GOTO_ADDRESS_PLUS_V0; break;
+        case 0xc: d.op = OP_RAND_MOD; break;
+        case 0xd: d.op = OP_DRAW_SPRITE; break;
+        case 0xe:
+            if(lo == 0x9e) d.op = OP_SKIP_IF_KEY_PRESSED;
+            else if(lo == 0xa1) d.op = OP_SKIP_IF_KEY_NOT_PRESSED;
+            break;
+        case 0xf:
+            switch(lo){
+                case 0x00: if(instr == 0xF000) d.op = OP_SET_ADDRESS_REG_LONG; break;
+                case 0x01: d.op = OP_SELECT_PLANES; break;
+                case 0x02: if(instr == 0xF002) d.op = OP_LOAD_AUDIO; break;
+                case 0x07: d.op = OP_GET_DELAY; break;
+                case 0x0a: d.op = OP_WAIT_FOR_KEY; break;
+                case 0x15: d.op = OP_SET_DELAY; break;
+                case 0x18: d.op = OP_SET_SOUND; break;
+                case 0x1e: d.op = OP_ADD_ADDRESS_REG; break;
+                case 0x29: d.op = OP_SET_FONT_CHAR; break;
+                case 0x30: d.op = OP_SET_BIG_FONT_CHAR; break;
+                case 0x33: d.op = OP_SET_BCD; break;
+                case 0x3a: d.op = OP_SET_PITCH; break;
+                case 0x55: d.op = OP_REG_DUMP; break;
+                case 0x65: d.op = OP_REG_LOAD; break;
+                case 0x75: d.op = OP_SAVE_FLAGS; break;
+                case 0x85: d.op = OP_LOAD_FLAGS; break;
+            }
+            break;
+    }
+    return d;
+}
+
+decoded_instruction profile_instruction(decoded_instruction d, int quirks){
+    if(d.op >= OP_SCROLL_DOWN && d.op <= OP_LOAD_FLAGS && !(quirks & QUIRK_HIRES)){
+        d.op = OP_NOT_IMPLEMENTED;
+    }
+    else if(d.op >= OP_SCROLL_UP && d.op <= OP_SET_PITCH && !(quirks & QUIRK_XO)){
+        //the original machines ignore the low nibble of 5xy0
+        d.op = d.op == OP_SAVE_RANGE || d.op == OP_LOAD_RANGE ? OP_SKIP_EQUAL_REG : OP_NOT_IMPLEMENTED;
+    }
+    return d;
+}
+
+void tick_timers(chip_8* c){
+    if(c->delay_timer > 0) c->delay_timer--;
+    if(c->sound_timer > 0) c->sound_timer--;
+}
+
+bool step_budget(chip_8* c, int res, int* i, int count){
+    //neither a faulting instruction nor one stopped at a breakpoint has run
+    if(res == 3 || c->faulted){
+        return false;
+    }
+    (*i)++;
+    if(res == 1){
+        //keys only change between calls, so after the first poll noted any press every
+        //further step would wait as well
+        *i = count;
+        return false;
+    }
+    return !DEBUG_STOPPED(c);
+}
+
+//one step() at a time, used by the switch core, while waiting for a key and around debugger stops
+static bool run_steps(chip_8* c, int count){
+    bool drew = false;
+    int i = 0;
+    while(i < count){
+        int res = c->core == CORE_SWITCH ? step_switch(c) : step(c);
+        if(res == 2){
+            drew = true;
+        }
+        if(!step_budget(c, res, &i, count)) break;
+    }
+    c->cycles += i;
+    return drew;
+}
+
+//idle loop fast-forward. A backward jump that finds the registers and I exactly as on its previous
+//visit, with a loop body that changes nothing else, spins the same way until a timer tick or a key
+//change. Both only happen between run_instructions() calls, so whole iterations up to the end of
+//the budget can be skipped and the chip ends up in the state spinning would have left it in
+typedef struct{
+    uint16_t pc; //backward jump seen last
+    int executed; //its position in the budget
+    uint16_t address_register;
+    uint8_t registers[16];
+}idle_tracker;
+
+#define IDLE_MAX_BODY 64 //bytes, idle loops are a handful of instructions
+
+//true if every instruction from start up to the jump at end only reads state and stays in the loop.
+//A skip right before the jump leaves the loop past it, into code that was never checked. It is only
+//let through when the period is at most one pass over the body: after such an exit nothing but
+//Bnnn, 00EE, a call (all of which reset the tracker) or pc wrapping around memory gets back in
+static bool idle_loop_body(const chip_8* c, uint16_t start, uint16_t end, int period){
+    if(end - start > IDLE_MAX_BODY){
+        return false;
+    }
+    const bool one_pass = period <= (end - start) / INSTRUCTION_SIZE + 1;
+    for(uint16_t a = start; a < end; a += INSTRUCTION_SIZE){
+        decoded_instruction d = decode_instruction((c->memory[a] << 8) | c->memory[(a + 1) & (MEMORY_SIZE - 1)]);
+        uint16_t nnn = (d.x << 8) | d.kk;
+        switch(d.op){
+            case OP_SKIP_EQUAL: case OP_SKIP_NOT_EQUAL: case OP_SKIP_EQUAL_REG: case OP_SKIP_NOT_EQUAL_REG:
+            case OP_SKIP_IF_KEY_PRESSED: case OP_SKIP_IF_KEY_NOT_PRESSED:
+                if(a == end - INSTRUCTION_SIZE && !one_pass) return false;
+                break;
+            case OP_LOAD_IMM: case OP_ADD_IMM: case OP_MOV: case OP_BIT_OR: case OP_BIT_AND: case OP_BIT_XOR:
+            case OP_ADD_REG: case OP_SUB_REG: case OP_SHIFT_RIGHT: case OP_SUB_REG_SWITCH: case OP_SHIFT_LEFT:
+            case OP_SET_ADDRESS_REG: case OP_GET_DELAY: case OP_ADD_ADDRESS_REG: case OP_SET_FONT_CHAR: case OP_REG_LOAD:
+                break;
+            case OP_GOTO_ADDRESS:
+                if(nnn < start || nnn > end || ((nnn - start) & 1)) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+//called after the backward jump at pc, returns the new position in the budget
+static int idle_loop(chip_8* c, idle_tracker* t, uint16_t pc, int executed, int count){
+    if(t->pc == pc && t->address_register == c->address_register
+       && memcmp(t->registers, c->registers, sizeof(t->registers)) == 0
+       && idle_loop_body(c, c->program_counter, pc, executed - t->executed)){
+        int period = executed - t->executed;
+        int skipped = (count - executed - 1) / period * period;
+        c->idle_cycles += skipped;
+        t->pc = 0xffff; //the remainder runs normally
+        return executed + skipped;
+    }
+    t->pc = pc;
+    t->executed = executed;
+    t->address_register = c->address_register;
+    memcpy(t->registers, c->registers, sizeof(t->registers));
+    return executed;
+}
+
+
+//one copy of the loops per quirk profile
+#define QUIRKS QUIRK_FLAGS_MODERN
+#define PROFILE(name) name##_modern
+#include "chip8_loops.h"
+#define QUIRKS QUIRK_FLAGS_VIP
+#define PROFILE(name) name##_vip
+#include "chip8_loops.h"
+#define QUIRKS QUIRK_FLAGS_CHIP48
+#define PROFILE(name) name##_chip48
+#include "chip8_loops.h"
+#define QUIRKS QUIRK_FLAGS_SCHIP
+#define PROFILE(name) name##_schip
+#include "chip8_loops.h"
+#define QUIRKS QUIRK_FLAGS_XOCHIP
+#define PROFILE(name) name##_xochip
+#include "chip8_loops.h"
+
+int step_switch(chip_8* c){
+    switch(c->quirks){
+        case QUIRKS_VIP: return step_switch_vip(c);
+        case QUIRKS_CHIP48: return step_switch_chip48(c);
+        case QUIRKS_SCHIP: return step_switch_schip(c);
+        case QUIRKS_XOCHIP: return step_switch_xochip(c);
+        default: return step_switch_modern(c);
+    }
+}
+
+int step(chip_8* c){
+    switch(c->quirks){
+        case QUIRKS_VIP: return step_vip(c);
+        case QUIRKS_CHIP48: return step_chip48(c);
+        case QUIRKS_SCHIP: return step_schip(c);
+        case QUIRKS_XOCHIP: return step_xochip(c);
+        default: return step_modern(c);
+    }
+}
+
+static bool run_cached(chip_8* c, int count){
+    switch(c->quirks){
+        case QUIRKS_VIP: return run_cached_vip(c, count);
+        case QUIRKS_CHIP48: return run_cached_chip48(c, count);
+        case QUIRKS_SCHIP: return run_cached_schip(c, count);
+        case QUIRKS_XOCHIP: return run_cached_xochip(c, count);
+        default: return run_cached_modern(c, count);
+    }
+}
+
+bool run_instructions(chip_8* c, int count){
+    if(c->faulted || DEBUG_STOPPED(c)){
+        return false;
+    }
+    //the trace takes precedence over the other cores, it records every instruction on its own
+    if(c->trace){
+        return trace_run_instructions(c, count);
+    }
+    //compiled blocks and translated roms have no debugger hooks, so an attached debugger uses
+    //the decode cache instead
+    if(c->core == CORE_JIT && c->jit && !DEBUG_ATTACHED(c)){
+        return jit_run_instructions(c, count);
+    }
+    if(c->core == CORE_AOT && c->aot && !DEBUG_ATTACHED(c)){
+        return c->aot->program->run_instructions(c, count);
+    }
+    if(c->core != CORE_SWITCH && !c->waiting_for_key){
+        return run_cached(c, count);
+    }
+    return run_steps(c, count);
+}
+
+bool run_frame(chip_8* c, int instructions_per_frame){
+    if(c->faulted || DEBUG_STOPPED(c)){
+        return false;
+    }
+    bool drew = run_instructions(c, instructions_per_frame);
+    tick_timers(c);
+    return drew;
+}
+
+//each pixel group broadcasts its bits to every lane and keeps one bit per lane, a compare turns
+//that into a mask per plane. The masks then pick between the plane_colors: plane 1 alone, plane 2
+//with or without plane 1, or nothing. 8 pixels per step with AVX2, 4 with SSE2
+void expand_display(const uint64_t* display, bool hires, uint32_t* out, int pitch){
+    const int height = hires ? HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT;
+    const int words = hires ? HIRES_SCREEN_WIDTH / 64 : 1;
+    const uint64_t* second = display + height * words;
+#if defined(__AVX2__)
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i color1 = _mm256_set1_epi32((int)plane_colors[1]);
+    const __m256i color2 = _mm256_set1_epi32((int)plane_colors[2]);
+    const __m256i color3 = _mm256_set1_epi32((int)plane_colors[3]);
+    for(int y = 0; y < height; y++){
+        for(int w = 0; w < words; w++){
+            uint64_t row0 = display[y * words + w];
+            uint64_t row1 = second[y * words + w];
+            uint32_t* pixels = out + w * 64;
+            for(int x = 0; x < 64; x += 8){
+                __m256i group0 = _mm256_and_si256(_mm256_set1_epi32((int)(row0 >> (56 - x)) & 0xff), bits);
+                __m256i group1 = _mm256_and_si256(_mm256_set1_epi32((int)(row1 >> (56 - x)) & 0xff), bits);
+                __m256i mask0 = _mm256_cmpeq_epi32(group0, bits);
+                __m256i mask1 = _mm256_cmpeq_epi32(group1, bits);
+                __m256i both = _mm256_blendv_epi8(color2, color3, mask0);
+                __m256i color = _mm256_blendv_epi8(_mm256_and_si256(mask0, color1), both, mask1);
+                _mm256_storeu_si256((__m256i*)(pixels + x), color);
+            }
+        }
+        out += pitch;
+    }
+#elif defined(__SSE2__)
+    const __m128i bits = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+    const __m128i color1 = _mm_set1_epi32((int)plane_colors[1]);
+    const __m128i color2 = _mm_set1_epi32((int)plane_colors[2]);
+    const __m128i color3 = _mm_set1_epi32((int)plane_colors[3]);
+    for(int y = 0; y < height; y++){
+        for(int w = 0; w < words; w++){
+            uint64_t row0 = display[y * words + w];
+            uint64_t row1 = second[y * words + w];
+            uint32_t* pixels = out + w * 64;
+            for(int x = 0; x < 64; x += 4){
+                __m128i group0 = _mm_and_si128(_mm_set1_epi32((int)(row0 >> (60 - x)) & 0xf), bits);
+                __m128i group1 = _mm_and_si128(_mm_set1_epi32((int)(row1 >> (60 - x)) & 0xf), bits);
+                __m128i mask0 = _mm_cmpeq_epi32(group0, bits);
+                __m128i mask1 = _mm_cmpeq_epi32(group1, bits);
+                __m128i both = _mm_or_si128(_mm_andnot_si128(mask0, color2), _mm_and_si128(mask0, color3));
+                __m128i color = _mm_or_si128(_mm_andnot_si128(mask1, _mm_and_si128(mask0, color1)), _mm_and_si128(mask1, both));
+                _mm_storeu_si128((__m128i*)(pixels + x), color);
+            }
+        }
+        out += pitch;
+    }
+#else
+    for(int y = 0; y < height; y++){
+        for(int w = 0; w < words; w++){
+            uint64_t row0 = display[y * words + w];
+            uint64_t row1 = second[y * words + w];
+            for(int x = 0; x < 64; x++){
+                out[w * 64 + x] = plane_colors[((row0 >> (63 - x)) & 1) | (((row1 >> (63 - x)) & 1) << 1)];
+            }
+        }
+        out += pitch;
+    }
+#endif
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size);
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+//FNV-1a over the framebuffer, used to compare runs without dumping the screen
+uint64_t framebuffer_hash(const chip_8* c){
+    return fnv1a(FNV_OFFSET_BASIS, c->display, display_words(c) * sizeof(c->display[0]));
+}
+
+uint64_t data_hash(const void* data, size_t size){
+    return fnv1a(FNV_OFFSET_BASIS, data, size);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size){
+    const uint8_t* p = data;
+    for(size_t i = 0; i < size; i++){
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t state_hash(const chip_8* c){
+    uint64_t hash = framebuffer_hash(c);
+    hash = fnv1a(hash, c->memory, memory_size(c));
+    hash = fnv1a(hash, c->stack, sizeof(c->stack));
+    hash = fnv1a(hash, c->registers, sizeof(c->registers));
+    hash = fnv1a(hash, &c->address_register, sizeof(c->address_register));
+    hash = fnv1a(hash, &c->program_counter, sizeof(c->program_counter));
+    hash = fnv1a(hash, &c->stack_pos, sizeof(c->stack_pos));
+    hash = fnv1a(hash, &c->delay_timer, sizeof(c->delay_timer));
+    hash = fnv1a(hash, &c->sound_timer, sizeof(c->sound_timer));
+    hash = fnv1a(hash, &c->waiting_for_key, sizeof(c->waiting_for_key));
+    hash = fnv1a(hash, &c->key_target_reg, sizeof(c->key_target_reg));
+    hash = fnv1a(hash, &c->pressed_key, sizeof(c->pressed_key));
+    hash = fnv1a(hash, &c->hires, sizeof(c->hires));
+    hash = fnv1a(hash, &c->planes, sizeof(c->planes));
+    hash = fnv1a(hash, c->flags, sizeof(c->flags));
+    hash = fnv1a(hash, c->audio_pattern, sizeof(c->audio_pattern));
+    hash = fnv1a(hash, &c->pitch, sizeof(c->pitch));
+    return hash;
+}
+
+void print_debug(chip_8* c){
+    printf("registers:\n");
+    for(int i = 0; i < 16; i++){
+        if(i % 4 == 0 && i != 0){
+            printf("\n");
+        }
+        printf("reg %02x: 0x%02x  ", i, c->registers[i]);
+    }
+    printf("\n");
+    printf("address register: 0x%04x\n", c->address_register);
+    printf("mem at address register:\n");
+    for(int i = 0; i < 3; i++){
+        printf("0x%02x ", c->memory[(c->address_register + i) & (MEMORY_SIZE - 1)]);
+    }
+    printf("\n");
+    printf("program counter: 0x%04x\n", c->program_counter);
+    printf("next instructions:\n");
+    for(int i = 0; i < 16; i++){
+        uint8_t hi = c->memory[c->program_counter + 2*i];
+        uint8_t lo = c->memory[c->program_counter + 2*i+1];
+        uint16_t full = (hi << 8) | lo;
+        printf("0x%04x ", full);
+    }
+    printf("\n");
+    uint8_t hi = c->memory[c->program_counter];
+    uint8_t lo = c->memory[c->program_counter + 1];
+    uint16_t full = (hi << 8) | lo;
+    debug_decode(full);
+    printf("\nkeys:\n");
+    for(int i = 0; i < 16; i++){
+        printf("key %02d: %d  ", i, c->keys[i]);
+    }
+    printf("\n");
+    printf("stack pos: %d\n", c->stack_pos);
+    printf("waiting for key: %d\n", c->waiting_for_key);
+    printf("\n\n");
+}
+
+void print_debug_event(const debugger* d){
+    static const char* const names[] = {
+        [DEBUG_NONE] = "no stop",
+        [DEBUG_BREAKPOINT] = "breakpoint",
+        [DEBUG_BREAK_INSTRUCTION] = "instruction breakpoint",
+        [DEBUG_BREAK_ADDRESS_REG] = "address register breakpoint",
+        [DEBUG_WATCH_READ] = "read watchpoint",
+        [DEBUG_WATCH_WRITE] = "write watchpoint"
+    };
+    printf("%s at 0x%04x\n", names[d->event], d->event_address);
+    print_debug(d->chip);
+}
+
+void init_debugger(debugger* d, chip_8* c){
+    memset(d, 0, sizeof(*d));
+    d->chip = c;
+    d->current_instruction = get_current_instruction(c);
+    d->next_instruction = get_next_instruction(c);
+    c->debug = d;
+    //cached decodings from before have no breakpoints in them
+    memset(c->decoded, 0, MEMORY_SIZE * sizeof(c->decoded[0]));
+}
+
+void detach_debugger(debugger* d){
+    d->chip->debug = NULL;
+    memset(d->chip->decoded, 0, MEMORY_SIZE * sizeof(d->chip->decoded[0]));
+}
+
+bool add_breakpoint(debugger* d, uint16_t address){
+    if(address >= MEMORY_SIZE){
+        return false;
+    }
+    d->breakpoints[address >> 6] |= 1ULL << (address & 63);
+    d->chip->decoded[address].op = OP_UNDECODED;
+    return true;
+}
+
+void remove_breakpoint(debugger* d, uint16_t address){
+    if(address >= MEMORY_SIZE){
+        return;
+    }
+    d->breakpoints[address >> 6] &= ~(1ULL << (address & 63));
+    d->chip->decoded[address].op = OP_UNDECODED;
+}
+
+bool add_debug_instruction(debugger* d, uint16_t mask, uint16_t value){
+    if(d->no_break_instructions >= DEBUG_MAX_ENTRIES || (value & ~mask) != 0){
+        return false;
+    }
+    d->break_instruction_masks[d->no_break_instructions] = mask;
+    d->break_instruction_values[d->no_break_instructions] = value;
+    d->no_break_instructions++;
+    debugger_changed(d);
+    return true;
+}
+
+bool add_break_address_reg(debugger* d, uint16_t address){
+    if(d->no_break_address_regs >= DEBUG_MAX_ENTRIES){
+        return false;
+    }
+    d->break_address_reg[d->no_break_address_regs] = address;
+    d->no_break_address_regs++;
+    d->break_address_reg_map[address >> 6] |= 1ULL << (address & 63);
+    return true;
+}
+
+bool add_watchpoint(debugger* d, uint16_t address, int length, uint8_t kind){
+    if(d->no_watchpoints >= DEBUG_MAX_ENTRIES || length <= 0 || address + length > MEMORY_SIZE
+       || kind == 0 || (kind & ~(WATCH_READ | WATCH_WRITE)) != 0){
+        return false;
+    }
+    d->watch_start[d->no_watchpoints] = address;
+    d->watch_length[d->no_watchpoints] = length;
+    d->watch_kind[d->no_watchpoints] = kind;
+    d->no_watchpoints++;
+    for(int i = 0; i < length; i++){
+        d->watch_map[address + i] |= kind;
+    }
+    return true;
+}
+
+void debugger_changed(debugger* d){
+    memset(d->break_instruction_map, 0, sizeof(d->break_instruction_map));
+    for(int i = 0; i < d->no_break_instructions; i++){
+        uint16_t mask = d->break_instruction_masks[i];
+        uint16_t value = d->break_instruction_values[i];
+        for(uint32_t instr = 0; instr < 0x10000; instr++){
+            if((instr & mask) == value){
+                d->break_instruction_map[instr >> 6] |= 1ULL << (instr & 63);
+            }
+        }
+    }
+    memset(d->break_address_reg_map, 0, sizeof(d->break_address_reg_map));
+    for(int i = 0; i < d->no_break_address_regs; i++){
+        d->break_address_reg_map[d->break_address_reg[i] >> 6] |= 1ULL << (d->break_address_reg[i] & 63);
+    }
+    memset(d->watch_map, 0, sizeof(d->watch_map));
+    for(int i = 0; i < d->no_watchpoints; i++){
+        for(int a = d->watch_start[i]; a < d->watch_start[i] + d->watch_length[i]; a++){
+            d->watch_map[a] |= d->watch_kind[i];
+        }
+    }
+    memset(d->chip->decoded, 0, MEMORY_SIZE * sizeof(d->chip->decoded[0]));
+}
+
+bool debug_run(debugger* d, int count){
+    chip_8* c = d->chip;
+    //the stop left the program counter on the breakpoint, which must not trap again right away
+    d->resume = (d->event == DEBUG_BREAKPOINT || d->event == DEBUG_BREAK_INSTRUCTION)
+                && (c->program_counter & (MEMORY_SIZE - 1)) == d->event_address;
+    d->event = DEBUG_NONE;
+    bool drew = run_instructions(c, count);
+    d->resume = false;
+    return drew;
+}
+
+int debug_step(debugger* d){
+    uint64_t cycles = d->chip->cycles;
+    debug_run(d, 1);
+    if(d->chip->cycles != cycles){
+        d->previous_instruction = d->current_instruction;
+        d->current_instruction = get_current_instruction(d->chip);
+        d->next_instruction = get_next_instruction(d->chip);
+    }
+    return d->event;
+}
@@ -0,0 +1,355 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define VIRTUAL_SCREEN_WIDTH 64
+#define VIRTUAL_SCREEN_HEIGHT 32
+#define HIRES_SCREEN_WIDTH 128 //SCHIP and XO-CHIP high resolution mode
+#define HIRES_SCREEN_HEIGHT 64
+#define DISPLAY_PLANES 2 //XO-CHIP bit planes
+#define DISPLAY_WORDS (DISPLAY_PLANES * HIRES_SCREEN_HEIGHT * HIRES_SCREEN_WIDTH / 64)
+#define MEMORY_SIZE 0x1000
+#define EXTENDED_MEMORY_SIZE 0x10000 //what I reaches on XO-CHIP, code still runs from the first MEMORY_SIZE bytes
+#define STACK_SIZE 16
+#define SCREEN_COLOR 0xff05c714
+#define PLANE2_COLOR 0xffc75a05 //pixels set only in the second XO-CHIP plane
+#define BOTH_PLANES_COLOR 0xffe8e8e8
+#define FONTSET_SIZE 80
+#define FONTSET_MEMORY_OFFSET 0x50
+#define BIG_FONTSET_SIZE 160
+#define BIG_FONTSET_MEMORY_OFFSET 0xa0
+#define FLAG_REGISTERS 16
+#define AUDIO_PATTERN_SIZE 16
+#define VF 0xF
+#define INSTRUCTION_SIZE 2
+#define LOAD_ADDRESS 0x200
+#define NO_KEY 0xff
+
+//errors go to stderr as well as into the return values. Built with CHIP8_QUIET, as the library is,
+//nothing is ever written to stdout or stderr unless a printing function is called
+#ifdef CHIP8_QUIET
+#define chip8_error(...) ((void)0)
+#else
+#define chip8_error(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+extern const unsigned char fontset[FONTSET_SIZE];
+extern const unsigned char big_fontset[BIG_FONTSET_SIZE];
+//ARGB of a pixel by its plane bits, plane 1 in bit 0
+extern const uint32_t plane_colors[1 << DISPLAY_PLANES];
+
+//one entry per opcode form, named after the handler that executes it. The SCHIP and XO-CHIP
+//extensions are decoded for every profile, see profile_instruction()
+enum{
+    OP_UNDECODED = 0,
+    OP_CLEAR_SCREEN,
+    OP_RETURN_FROM_SUBROUTINE,
+    OP_GOTO_ADDRESS,
+    OP_CALL_SUBROUTINE,
+    OP_SKIP_EQUAL,
+    OP_SKIP_NOT_EQUAL,
+    OP_SKIP_EQUAL_REG,
+    OP_LOAD_IMM,
+    OP_ADD_IMM,
+    OP_MOV,
+    OP_BIT_OR,
+    OP_BIT_AND,
+    OP_BIT_XOR,
+    OP_ADD_REG,
+    OP_SUB_REG,
+    OP_SHIFT_RIGHT,
+    OP_SUB_REG_SWITCH,
+    OP_SHIFT_LEFT,
+    OP_SKIP_NOT_EQUAL_REG,
+    OP_SET_ADDRESS_REG,
+    OP_GOTO_ADDRESS_PLUS_V0,
+    OP_RAND_MOD,
+    OP_DRAW_SPRITE,
+    OP_SKIP_IF_KEY_PRESSED,
+    OP_SKIP_IF_KEY_NOT_PRESSED,
+    OP_GET_DELAY,
+    OP_WAIT_FOR_KEY,
+    OP_SET_DELAY,
+    OP_SET_SOUND,
+    OP_ADD_ADDRESS_REG,
+    OP_SET_FONT_CHAR,
+    OP_SET_BCD,
+    OP_REG_DUMP,
+    OP_REG_LOAD,
+    //SCHIP
+    OP_SCROLL_DOWN,
+    OP_SCROLL_RIGHT,
+    OP_SCROLL_LEFT,
+    OP_EXIT,
+    OP_LORES,
+    OP_HIRES,
+    OP_SET_BIG_FONT_CHAR,
+    OP_SAVE_FLAGS,
+    OP_LOAD_FLAGS,
+    //XO-CHIP
+    OP_SCROLL_UP,
+    OP_SAVE_RANGE,
+    OP_LOAD_RANGE,
+    OP_SET_ADDRESS_REG_LONG, //F000 nnnn, the only instruction that is two words long
+    OP_SELECT_PLANES,
+    OP_LOAD_AUDIO,
+    OP_SET_PITCH,
+    OP_NOT_IMPLEMENTED,
+    OP_BREAKPOINT, //placed in the decode cache by an attached debugger, see debugger below
+    OP_COUNT
+};
+
+//an instruction with its operands already extracted. nnn is (x << 8) | kk, n is kk & 0xf
+typedef struct{
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+}decoded_instruction;
+
+//how the instructions early interpreters disagree on behave. The profile is chosen once per rom,
+//before it runs, and every core uses a copy of its loop specialised for it
+typedef enum{
+    QUIRKS_MODERN = 0, //shifts use Vx, Fx55/Fx65 leave I alone, Bnnn adds V0, sprites wrap
+    QUIRKS_VIP, //the COSMAC VIP interpreter
+    QUIRKS_CHIP48,
+    QUIRKS_SCHIP, //SCHIP 1.1 with its 128x64 mode
+    QUIRKS_XOCHIP, //Octo's XO-CHIP
+    QUIRKS_COUNT
+}quirk_profile;
+
+//behaviour switched on by a profile, see quirk_flags
+#define QUIRK_SHIFT_VY 1 //8xy6/8xyE shift Vy into Vx
+#define QUIRK_LOAD_STORE_I 2 //Fx55/Fx65 leave I past the last register, I += x + 1
+#define QUIRK_LOAD_STORE_I_X 4 //Fx55/Fx65 add x to I, CHIP-48 was off by one
+#define QUIRK_JUMP_VX 8 //Bxnn jumps to xnn + Vx instead of nnn + V0
+#define QUIRK_CLIP 16 //sprites are cut off at the screen edges instead of wrapping around
+#define QUIRK_HIRES 32 //the SCHIP instructions: 128x64 mode, scrolling, 16x16 sprites, Fx30, Fx75/Fx85
+#define QUIRK_XO 64 //the XO-CHIP ones: bit planes, 64 KB through I, 00Dn, 5xy2/5xy3, F000, Fn01, F002, Fx3A
+
+extern const uint8_t quirk_flags[QUIRKS_COUNT];
+const char* quirks_name(uint8_t profile);
+//false for an unknown name
+bool parse_quirks(const char* name, uint8_t* profile);
+
+typedef enum{
+    CORE_CACHED = 0,
+    CORE_SWITCH,
+    CORE_JIT,
+    CORE_AOT
+}execution_core;
+
+struct jit_state;
+struct aot_state;
+struct tracer;
+struct debugger;
+
+typedef struct{
+    uint8_t memory[EXTENDED_MEMORY_SIZE]; //only XO-CHIP uses more than MEMORY_SIZE, see memory_size()
+    //one bit per pixel, bit 63 is the leftmost column. A row is one word in the 64x32 mode and two
+    //in 128x64, the rows of the second plane follow those of the first. The base machine only
+    //ever uses the first VIRTUAL_SCREEN_HEIGHT words
+    uint64_t display[DISPLAY_WORDS];
+    bool hires;
+    uint8_t planes; //selected by Fn01, one bit per plane
+    uint16_t stack[STACK_SIZE];
+    uint8_t registers[16];
+    uint16_t address_register;
+    uint16_t program_counter;
+    uint8_t keys[16];
+    uint8_t stack_pos;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    bool waiting_for_key;
+    uint8_t key_target_reg;
+    uint8_t pressed_key; //key that went down during Fx0A, the wait ends when it is released. NO_KEY before that
+    uint8_t flags[FLAG_REGISTERS]; //Fx75/Fx85, the HP48's RPL flags
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE]; //F002 and Fx3A, kept with the state but not played
+    uint8_t pitch;
+    bool faulted; //hit an unimplemented instruction, the run functions stop until init_chip_8()
+    uint16_t fault_instruction;
+    uint32_t random_state; //per instance so runs are reproducible and instances independent
+    uint64_t cycles; //instructions executed through run_instructions()
+    uint64_t idle_cycles; //part of cycles fast-forwarded through idle loops instead of executed
+    uint8_t core;
+    uint8_t quirks; //quirk_profile, set after init_chip_8() and before the rom runs
+    struct jit_state* jit; //only set while the recompiler is enabled, see jit.h
+    struct aot_state* aot; //only set while a translated rom runs, see aot.h
+    struct tracer* trace; //only set while tracing, see trace.h
+    struct debugger* debug; //set by init_debugger()
+    //decoded form of the instruction starting at every address, filled lazily
+    decoded_instruction decoded[MEMORY_SIZE];
+}chip_8;
+
+#define DEBUG_MAX_ENTRIES 32
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
+//why execution stopped. Breakpoints stop before the instruction runs, the others right after it
+typedef enum{
+    DEBUG_NONE = 0,
+    DEBUG_BREAKPOINT,
+    DEBUG_BREAK_INSTRUCTION,
+    DEBUG_BREAK_ADDRESS_REG,
+    DEBUG_WATCH_READ,
+    DEBUG_WATCH_WRITE
+}debug_event;
+
+//breakpoints cost nothing per instruction: addresses and opcodes that should stop are decoded
+//as OP_BREAKPOINT, so only the trapping instruction pays. Watchpoints and address register
+//breakpoints are checked by the few handlers that touch them. Building with CHIP8_NO_DEBUGGER
+//removes even those checks, the functions below then still work but never stop anything
+typedef struct debugger{
+    chip_8* chip;
+    uint16_t previous_instruction;
+    uint16_t current_instruction;
+    uint16_t next_instruction;
+    uint64_t breakpoints[MEMORY_SIZE / 64]; //one bit per address
+    //opcode breakpoints stop on (instruction & mask) == value
+    uint16_t break_instruction_masks[DEBUG_MAX_ENTRIES];
+    uint16_t break_instruction_values[DEBUG_MAX_ENTRIES];
+    uint16_t no_break_instructions;
+    uint16_t break_address_reg[DEBUG_MAX_ENTRIES];
+    uint16_t no_break_address_regs;
+    uint16_t watch_start[DEBUG_MAX_ENTRIES];
+    uint16_t watch_length[DEBUG_MAX_ENTRIES];
+    uint8_t watch_kind[DEBUG_MAX_ENTRIES]; //WATCH_READ and/or WATCH_WRITE
+    uint16_t no_watchpoints;
+    //lookups built from the lists above, one bit per opcode/register value and flags per address
+    uint64_t break_instruction_map[0x10000 / 64];
+    uint64_t break_address_reg_map[0x10000 / 64];
+    uint8_t watch_map[MEMORY_SIZE];
+    uint8_t event; //debug_event of the last stop, cleared when execution continues
+    uint16_t event_address; //pc for breakpoints, the register value or the watched address otherwise
+    bool resume; //continuing from a breakpoint runs the stopped instruction once
+}debugger;
+
+void init_chip_8(chip_8* c);
+void seed_random(chip_8* c, uint32_t seed);
+bool load_program(chip_8* c, const char* filename);
+//reads a whole rom file into data, false with a message if it can't be read or is larger than max
+bool read_rom_file(const char* filename, uint8_t* data, int max, int* size);
+//copies a rom read earlier to LOAD_ADDRESS, the profile has to be set first
+bool load_program_data(chip_8* c, const uint8_t* data, int size);
+//bytes of c->memory the profile reaches
+int memory_size(const chip_8* c);
+//words of c->display the current mode uses
+int display_words(const chip_8* c);
+uint16_t get_current_instruction(chip_8* c);
+uint16_t get_next_instruction(chip_8* c);
+
+//instruction handlers, each one executes a single instruction and advances the program counter.
+//the ones with quirks follow c->quirks, the interpreter loops use inlined copies for their profile
+void clear_screen(chip_8* c);
+void return_from_subroutine(chip_8* c);
+void goto_address(chip_8* c, uint16_t address);
+void call_subroutine(chip_8* c, uint16_t address);
+void skip_equal(chip_8* c, uint8_t reg, uint8_t val);
+void skip_not_equal(chip_8* c, uint8_t reg, uint8_t val);
+void skip_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2);
+void load_imm(chip_8* c, uint8_t reg, uint8_t val);
+void add_imm(chip_8* c, uint8_t reg, uint8_t val);
+void mov(chip_8* c, uint8_t reg1, uint8_t reg2);
+void bit_or(chip_8* c, uint8_t reg1, uint8_t reg2);
+void bit_and(chip_8* c, uint8_t reg1, uint8_t reg2);
+void bit_xor(chip_8* c, uint8_t reg1, uint8_t reg2);
+void add_reg(chip_8* c, uint8_t reg1, uint8_t reg2);
+void sub_reg(chip_8* c, uint8_t reg1, uint8_t reg2);
+void shift_right(chip_8* c, uint8_t reg1, uint8_t reg2);
+void sub_reg_switch(chip_8* c, uint8_t reg1, uint8_t reg2);
+void shift_left(chip_8* c, uint8_t reg1, uint8_t reg2);
+void skip_not_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2);
+void set_address_reg(chip_8* c, uint16_t val);
+void goto_address_plus_V0(chip_8* c, uint16_t address);
+void rand_mod(chip_8* c, uint8_t reg, uint8_t m);
+void draw_sprite(chip_8* c, uint8_t reg1, uint8_t reg2, uint8_t n);
+void skip_if_key_pressed(chip_8* c, uint8_t reg);
+void skip_if_key_not_pressed(chip_8* c, uint8_t reg);
+void get_delay(chip_8* c, uint8_t reg);
+void wait_for_key(chip_8* c, uint8_t reg);
+void key_event(chip_8* c, uint8_t key);
+void set_delay(chip_8* c, uint8_t reg);
+void set_sound(chip_8* c, uint8_t reg);
+void add_address_reg(chip_8* c, uint8_t reg);
+void set_font_char(chip_8* c, uint8_t reg);
+void set_bcd(chip_8* c, uint8_t reg);
+void reg_dump(chip_8* c, uint8_t reg);
+void reg_load(chip_8* c, uint8_t reg);
+void scroll_down(chip_8* c, uint8_t n);
+void scroll_right(chip_8* c);
+void scroll_left(chip_8* c);
+void exit_interpreter(chip_8* c);
+void set_lores(chip_8* c);
+void set_hires(chip_8* c);
+void set_big_font_char(chip_8* c, uint8_t reg);
+void save_flags(chip_8* c, uint8_t reg);
+void load_flags(chip_8* c, uint8_t reg);
+void scroll_up(chip_8* c, uint8_t n);
+void save_range(chip_8* c, uint8_t reg1, uint8_t reg2);
+void load_range(chip_8* c, uint8_t reg1, uint8_t reg2);
+void set_address_reg_long(chip_8* c);
+void select_planes(chip_8* c, uint8_t mask);
+void load_audio(chip_8* c);
+void set_pitch(chip_8* c, uint8_t reg);
+void not_implemented(chip_8* c, uint16_t instruction);
+
+//must be called for every write into c->memory so cached decodings stay valid
+void memory_written(chip_8* c, uint16_t address, int length);
+decoded_instruction decode_instruction(uint16_t instr);
+//d as a profile with the given quirk_flags runs it: extensions it doesn't have are not implemented,
+//except 5xy2/5xy3 which stay the 5xy0 they always were
+decoded_instruction profile_instruction(decoded_instruction d, int quirks);
+
+//returns 0 after a normal instruction, 1 while waiting for a key, 2 after the screen changed and
+//3 if an attached debugger stopped before the instruction.
+//step() executes from the decoded instruction cache, step_switch() decodes every instruction
+int step(chip_8* c);
+int step_switch(chip_8* c);
+//the budget rules every core applies after a step() that returned res, with *i of count
+//instructions used up: counts the step and returns false once the run is over. A fault or a
+//breakpoint stop isn't counted and a key wait uses up the rest of the budget
+bool step_budget(chip_8* c, int res, int* i, int count);
+void tick_timers(chip_8* c);
+//both return true if the screen changed. run_frame executes one emulated 60Hz frame:
+//instructions_per_frame steps followed by exactly one timer tick.
+//they return early once the chip has faulted or an attached debugger stopped, see debug_run()
+bool run_instructions(chip_8* c, int count);
+bool run_frame(chip_8* c, int instructions_per_frame);
+uint64_t framebuffer_hash(const chip_8* c);
+//the same FNV-1a over any bytes, roms are indexed by it
+uint64_t data_hash(const void* data, size_t size);
+//writes display rows (laid out as chip_8.display) as plane_colors ARGB pixels, 64x32 or 128x64 of
+//them. pitch is the row stride of out in pixels
+void expand_display(const uint64_t* display, bool hires, uint32_t* out, int pitch);
+//hash over everything the program can observe, used to check that two cores agree
+uint64_t state_hash(const chip_8* c);
+
+//disassembly, with the handler names used throughout
+void fprint_instruction(FILE* fp, uint16_t instr);
+void debug_decode(uint16_t instr);
+const char* op_name(uint8_t op);
+void print_debug(chip_8* c);
+
+void print_debug_event(const debugger* d);
+
+//attaches d to c. While attached the jit core falls back to the decode cache
+void init_debugger(debugger* d, chip_8* c);
+void detach_debugger(debugger* d);
+//the add functions return false once DEBUG_MAX_ENTRIES is reached or for a bad range
+bool add_breakpoint(debugger* d, uint16_t address);
+void remove_breakpoint(debugger* d, uint16_t address);
+bool add_debug_instruction(debugger* d, uint16_t mask, uint16_t value);
+bool add_break_address_reg(debugger* d, uint16_t address);
+bool add_watchpoint(debugger* d, uint16_t address, int length, uint8_t kind);
+//rebuilds the lookups after the lists were changed directly, e.g. by load_state()
+void debugger_changed(debugger* d);
+//run_instructions() that continues after the last stop. d->event says why it returned early
+bool debug_run(debugger* d, int count);
+//one instruction through debug_run(), returns d->event
+int debug_step(debugger* d);
+
+#endif
@@ -0,0 +1,485 @@
+//the interpreter loops, instantiated once per quirk profile by chip8.c. Before each include QUIRKS
+//is defined as the profile's quirk flags and PROFILE(name) gives the copy its name. The flags are a
+//constant in every copy, so the inlined handlers keep only the variant of the profile and the loops
+//have no quirk branches left. No include guard on purpose
+
+static int PROFILE(step_switch)(chip_8* c){
+    if(c->waiting_for_key && !key_wait_over(c)){
+        return 1;
+    }
+    uint16_t pc = c->program_counter & (MEMORY_SIZE - 1);
+    uint8_t hi = c->memory[pc];
+    uint8_t lo = c->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+    uint16_t full = (hi << 8) | lo;
+#ifndef CHIP8_NO_DEBUGGER
+    if(c->debug && debug_breaks_at(c->debug, pc, full) && !debug_resume(c, pc)){
+        return 3;
+    }
+#endif
+    switch(hi >> 4){
+        case 0x0:
+            if(full == 0x00E0){
+                clear_screen_quirks(c, QUIRKS);
+                return 2;
+            }
+            else if(full == 0x00EE){
+                return_from_subroutine(c);
+            }
+#if (QUIRKS) & QUIRK_HIRES
+            else if((full & 0xfff0) == 0x00C0){
+                scroll_down(c, lo & 0xf);
+                return 2;
+            }
+            else if(full == 0x00FB){
+                scroll_right(c);
+                return 2;
+            }
+            else if(full == 0x00FC){
+                scroll_left(c);
+                return 2;
+            }
+            else if(full == 0x00FD){
+                exit_interpreter(c);
+            }
+            else if(full == 0x00FE){
+                set_lores(c);
+                return 2;
+            }
+            else if(full == 0x00FF){
+                set_hires(c);
+                return 2;
+            }
+#endif
+#if (QUIRKS) & QUIRK_XO
+            else if((full & 0xfff0) == 0x00D0){
+                scroll_up(c, lo & 0xf);
+                return 2;
+            }
+#endif
+            else{
+                not_implemented(c, full);
+            }
+            break;
+        case 0x1:
+            goto_address(c, full & 0xfff);
+            break;
+        case 0x2:
+            call_subroutine(c, full & 0xfff);
+            break;
+        case 0x3:
+            skip_equal_quirks(c, hi & 0xf, lo, QUIRKS);
+            break;
+        case 0x4:
+            skip_not_equal_quirks(c, hi & 0xf, lo, QUIRKS);
+            break;
+        case 0x5:
+#if (QUIRKS) & QUIRK_XO
+            if((lo & 0xf) == 2){
+                save_range(c, hi & 0xf, lo >> 4);
+                break;
+            }
+            else if((lo & 0xf) == 3){
+                load_range(c, hi & 0xf, lo >> 4);
+                break;
+            }
+#endif
+            skip_equal_reg_quirks(c, hi & 0xf, lo >> 4, QUIRKS);
+            break;
+        case 0x6:
+            load_imm(c, hi & 0xf, lo);
+            break;
+        case 0x7:
+            add_imm(c, hi & 0xf, lo);
+            break;
+        case 0x8:
+            if((lo & 0xf) == 0){
+                mov(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 1){
+                bit_or(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 2){
+                bit_and(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 3){
+                bit_xor(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 4){
+                add_reg(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 5){
+                sub_reg(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 6){
+                shift_right_quirks(c, hi & 0xf, lo >> 4, QUIRKS);
+            }
+            else if((lo & 0xf) == 7){
+                sub_reg_switch(c, hi & 0xf, lo >> 4);
+            }
+            else if((lo & 0xf) == 0xe){
+                shift_left_quirks(c, hi & 0xf, lo >> 4, QUIRKS);
+            }
+            else{
+                not_implemented(c, full);
+            }
+            break;
+        case 0x9:
+            skip_not_equal_reg_quirks(c, hi & 0xf, lo >> 4, QUIRKS);
+            break;
+        case 0xa:
+            set_address_reg(c, full & 0xfff);
+            break;
+        case 0xb:
+            goto_address_plus_V0_quirks(c, full & 0xfff, QUIRKS);
+            break;
+        case 0xc:
+            rand_mod(c, hi & 0xf, lo);
+            break;
+        case 0xd:
+            draw_sprite_quirks(c, hi & 0xf, lo >> 4, lo & 0xf, QUIRKS);
+            return 2;
+            break;
+        case 0xe:
+            if(lo == 0x9e){
+                skip_if_key_pressed_quirks(c, hi & 0xf, QUIRKS);
+            }
+            else if(lo == 0xa1){
+                skip_if_key_not_pressed_quirks(c, hi & 0xf, QUIRKS);
+            }
+            else{
+                not_implemented(c, full);
+            }
+            break;
+        case 0xf:
+#if (QUIRKS) & QUIRK_XO
+            if(full == 0xF000){
+                set_address_reg_long(c);
+                break;
+            }
+            else if(lo == 0x01){
+                select_planes(c, hi & 0xf);
+                break;
+            }
+            else if(full == 0xF002){
+                load_audio(c);
+                break;
+            }
+            else if(lo == 0x3a){
+                set_pitch(c, hi & 0xf);
+                break;
+            }
+#endif
+#if (QUIRKS) & QUIRK_HIRES
+            if(lo == 0x30){
+                set_big_font_char(c, hi & 0xf);
+                break;
+            }
+            else if(lo == 0x75){
+                save_flags(c, hi & 0xf);
+                break;
+            }
+            else if(lo == 0x85){
+                load_flags(c, hi & 0xf);
+                break;
+            }
+#endif
+            if(lo == 0x07){
+                get_delay(c, hi & 0xf);
+            }
+            else if(lo == 0x0a){
+                wait_for_key(c, hi & 0xf);
+            }
+            else if(lo == 0x15){
+                set_delay(c, hi & 0xf);
+            }
+            else if(lo == 0x18){
+                set_sound(c, hi & 0xf);
+            }
+            else if(lo == 0x1e){
+                add_address_reg(c, hi & 0xf);
+            }
+            else if(lo == 0x29){
+                set_font_char(c, hi & 0xf);
+            }
+            else if(lo == 0x33){
+                set_bcd_quirks(c, hi & 0xf, QUIRKS);
+            }
+            else if(lo == 0x55){
+                reg_dump_quirks(c, hi & 0xf, QUIRKS);
+            }
+            else if(lo == 0x65){
+                reg_load_quirks(c, hi & 0xf, QUIRKS);
+            }
+            else{
+                not_implemented(c, full);
+            }
+            break;
+        default:
+            not_implemented(c, full);
+    }
+    return 0;
+}
+
+//same semantics as step_switch(), but the fetch and decode happen once per address
+static int PROFILE(step)(chip_8* c){
+    if(c->waiting_for_key && !key_wait_over(c)){
+        return 1;
+    }
+    uint16_t pc = c->program_counter & (MEMORY_SIZE - 1);
+    decoded_instruction d = c->decoded[pc];
+    if(d.op == OP_UNDECODED){
+        d = decode_at(c, pc);
+        c->decoded[pc] = d;
+    }
+#ifndef CHIP8_NO_DEBUGGER
+    if(d.op == OP_BREAKPOINT){
+        if(!debug_resume(c, pc)) return 3;
+        d = profile_instruction(decode_instruction((c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)]), QUIRKS);
+    }
+#endif
+    uint16_t nnn = (d.x << 8) | d.kk;
+    switch(d.op){
+        case OP_CLEAR_SCREEN: clear_screen_quirks(c, QUIRKS); return 2;
+        case OP_RETURN_FROM_SUBROUTINE: return_from_subroutine(c); break;
+        case OP_GOTO_ADDRESS: goto_address(c, nnn); break;
+        case OP_CALL_SUBROUTINE: call_subroutine(c, nnn); break;
+        case OP_SKIP_EQUAL: skip_equal_quirks(c, d.x, d.kk, QUIRKS); break;
+        case OP_SKIP_NOT_EQUAL: skip_not_equal_quirks(c, d.x, d.kk, QUIRKS); break;
+        case OP_SKIP_EQUAL_REG: skip_equal_reg_quirks(c, d.x, d.y, QUIRKS); break;
+        case OP_LOAD_IMM: load_imm(c, d.x, d.kk); break;
+        case OP_ADD_IMM: add_imm(c, d.x, d.kk); break;
+        case OP_MOV: mov(c, d.x, d.y); break;
+        case OP_BIT_OR: bit_or(c, d.x, d.y); break;
+        case OP_BIT_AND: bit_and(c, d.x, d.y); break;
+        case OP_BIT_XOR: bit_xor(c, d.x, d.y); break;
+        case OP_ADD_REG: add_reg(c, d.x, d.y); break;
+        case OP_SUB_REG: sub_reg(c, d.x, d.y); break;
+        case OP_SHIFT_RIGHT: shift_right_quirks(c, d.x, d.y, QUIRKS); break;
+        case OP_SUB_REG_SWITCH: sub_reg_switch(c, d.x, d.y); break;
+        case OP_SHIFT_LEFT: shift_left_quirks(c, d.x, d.y, QUIRKS); break;
+        case OP_SKIP_NOT_EQUAL_REG: skip_not_equal_reg_quirks(c, d.x, d.y, QUIRKS); break;
+        case OP_SET_ADDRESS_REG: set_address_reg(c, nnn); break;
+        case OP_GOTO_ADDRESS_PLUS_V0: goto_address_plus_V0_quirks(c, nnn, QUIRKS); break;
+        case OP_RAND_MOD: rand_mod(c, d.x, d.kk); break;
+        case OP_DRAW_SPRITE: draw_sprite_quirks(c, d.x, d.y, d.kk & 0xf, QUIRKS); return 2;
+        case OP_SKIP_IF_KEY_PRESSED: skip_if_key_pressed_quirks(c, d.x, QUIRKS); break;
+        case OP_SKIP_IF_KEY_NOT_PRESSED: skip_if_key_not_pressed_quirks(c, d.x, QUIRKS); break;
+        case OP_GET_DELAY: get_delay(c, d.x); break;
+        case OP_WAIT_FOR_KEY: wait_for_key(c, d.x); break;
+        case OP_SET_DELAY: set_delay(c, d.x); break;
+        case OP_SET_SOUND: set_sound(c, d.x); break;
+        case OP_ADD_ADDRESS_REG: add_address_reg(c, d.x); break;
+        case OP_SET_FONT_CHAR: set_font_char(c, d.x); break;
+        case OP_SET_BCD: set_bcd_quirks(c, d.x, QUIRKS); break;
+        case OP_REG_DUMP: reg_dump_quirks(c, d.x, QUIRKS); break;
+        case OP_REG_LOAD: reg_load_quirks(c, d.x, QUIRKS); break;
+#if (QUIRKS) & QUIRK_HIRES
+        case OP_SCROLL_DOWN: scroll_down(c, d.kk & 0xf); return 2;
+        case OP_SCROLL_RIGHT: scroll_right(c); return 2;
+        case OP_SCROLL_LEFT: scroll_left(c); return 2;
+        case OP_EXIT: exit_interpreter(c); break;
+        case OP_LORES: set_lores(c); return 2;
+        case OP_HIRES: set_hires(c); return 2;
+        case OP_SET_BIG_FONT_CHAR: set_big_font_char(c, d.x); break;
+        case OP_SAVE_FLAGS: save_flags(c, d.x); break;
+        case OP_LOAD_FLAGS: load_flags(c, d.x); break;
+#endif
+#if (QUIRKS) & QUIRK_XO
+        case OP_SCROLL_UP: scroll_up(c, d.kk & 0xf); return 2;
+        case OP_SAVE_RANGE: save_range(c, d.x, d.y); break;
+        case OP_LOAD_RANGE: load_range(c, d.x, d.y); break;
+        case OP_SET_ADDRESS_REG_LONG: set_address_reg_long(c); break;
+        case OP_SELECT_PLANES: select_planes(c, d.x); break;
+        case OP_LOAD_AUDIO: load_audio(c); break;
+        case OP_SET_PITCH: set_pitch(c, d.x); break;
+#endif
+        default: not_implemented(c, (c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)]);
+    }
+    return 0;
+}
+
+//threaded dispatch over the decoded instruction cache: every handler jumps straight to the
+//next one, which gives the branch predictor one indirect jump per opcode instead of a single shared one.
+//labels as values are a GNU extension, hence the pragma
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+static bool PROFILE(run_cached)(chip_8* c, int count){
+    static const void* const dispatch_table[] = {
+        [OP_UNDECODED] = &&do_decode,
+        [OP_CLEAR_SCREEN] = &&do_clear_screen,
+        [OP_RETURN_FROM_SUBROUTINE] = &&do_return_from_subroutine,
+        [OP_GOTO_ADDRESS] = &&do_goto_address,
+        [OP_CALL_SUBROUTINE] = &&do_call_subroutine,
+        [OP_SKIP_EQUAL] = &&do_skip_equal,
+        [OP_SKIP_NOT_EQUAL] = &&do_skip_not_equal,
+        [OP_SKIP_EQUAL_REG] = &&do_skip_equal_reg,
+        [OP_LOAD_IMM] = &&do_load_imm,
+        [OP_ADD_IMM] = &&do_add_imm,
+        [OP_MOV] = &&do_mov,
+        [OP_BIT_OR] = &&do_bit_or,
+        [OP_BIT_AND] = &&do_bit_and,
+        [OP_BIT_XOR] = &&do_bit_xor,
+        [OP_ADD_REG] = &&do_add_reg,
+        [OP_SUB_REG] = &&do_sub_reg,
+        [OP_SHIFT_RIGHT] = &&do_shift_right,
+        [OP_SUB_REG_SWITCH] = &&do_sub_reg_switch,
+        [OP_SHIFT_LEFT] = &&do_shift_left,
+        [OP_SKIP_NOT_EQUAL_REG] = &&do_skip_not_equal_reg,
+        [OP_SET_ADDRESS_REG] = &&do_set_address_reg,
+        [OP_GOTO_ADDRESS_PLUS_V0] = &&do_goto_address_plus_V0,
+        [OP_RAND_MOD] = &&do_rand_mod,
+        [OP_DRAW_SPRITE] = &&do_draw_sprite,
+        [OP_SKIP_IF_KEY_PRESSED] = &&do_skip_if_key_pressed,
+        [OP_SKIP_IF_KEY_NOT_PRESSED] = &&do_skip_if_key_not_pressed,
+        [OP_GET_DELAY] = &&do_get_delay,
+        [OP_WAIT_FOR_KEY] = &&do_wait_for_key,
+        [OP_SET_DELAY] = &&do_set_delay,
+        [OP_SET_SOUND] = &&do_set_sound,
+        [OP_ADD_ADDRESS_REG] = &&do_add_address_reg,
+        [OP_SET_FONT_CHAR] = &&do_set_font_char,
+        [OP_SET_BCD] = &&do_set_bcd,
+        [OP_REG_DUMP] = &&do_reg_dump,
+        [OP_REG_LOAD] = &&do_reg_load,
+#if (QUIRKS) & QUIRK_HIRES
+        [OP_SCROLL_DOWN] = &&do_scroll_down,
+        [OP_SCROLL_RIGHT] = &&do_scroll_right,
+        [OP_SCROLL_LEFT] = &&do_scroll_left,
+        [OP_EXIT] = &&do_exit,
+        [OP_LORES] = &&do_lores,
+        [OP_HIRES] = &&do_hires,
+        [OP_SET_BIG_FONT_CHAR] = &&do_set_big_font_char,
+        [OP_SAVE_FLAGS] = &&do_save_flags,
+        [OP_LOAD_FLAGS] = &&do_load_flags,
+#else
+        //decode_at() never leaves these in the cache of a profile without them
+        [OP_SCROLL_DOWN ... OP_LOAD_FLAGS] = &&do_not_implemented,
+#endif
+#if (QUIRKS) & QUIRK_XO
+        [OP_SCROLL_UP] = &&do_scroll_up,
+        [OP_SAVE_RANGE] = &&do_save_range,
+        [OP_LOAD_RANGE] = &&do_load_range,
+        [OP_SET_ADDRESS_REG_LONG] = &&do_set_address_reg_long,
+        [OP_SELECT_PLANES] = &&do_select_planes,
+        [OP_LOAD_AUDIO] = &&do_load_audio,
+        [OP_SET_PITCH] = &&do_set_pitch,
+#else
+        [OP_SCROLL_UP ... OP_SET_PITCH] = &&do_not_implemented,
+#endif
+        [OP_NOT_IMPLEMENTED] = &&do_not_implemented,
+        [OP_BREAKPOINT] = &&do_breakpoint
+    };
+    bool drew = false;
+    int executed = -1;
+    uint16_t pc;
+    decoded_instruction d;
+    idle_tracker idle = {.pc = 0xffff};
+#define DISPATCH() \
+    do{ \
+        if(++executed >= count){ \
+            c->cycles += count; \
+            return drew; \
+        } \
+        pc = c->program_counter & (MEMORY_SIZE - 1); \
+        d = c->decoded[pc]; \
+        goto *dispatch_table[d.op]; \
+    }while(0)
+#define NNN ((d.x << 8) | d.kk)
+//only after the handlers with debugger hooks, compiles to nothing without the debugger
+#define CHECK_STOPPED() \
+    do{ \
+        if(DEBUG_STOPPED(c)){ \
+            c->cycles += executed + 1; \
+            return drew; \
+        } \
+    }while(0)
+
+    DISPATCH();
+do_decode:
+    d = decode_at(c, pc);
+    c->decoded[pc] = d;
+    goto *dispatch_table[d.op];
+do_clear_screen: clear_screen_quirks(c, QUIRKS); drew = true; DISPATCH();
+//returns, calls and Bnnn can leave and re-enter a loop through code idle_loop_body() never saw
+do_return_from_subroutine: return_from_subroutine(c); idle.pc = 0xffff; DISPATCH();
+do_goto_address:
+    goto_address(c, NNN);
+    //breakpoints inside the loop must still be hit
+    if(NNN <= pc && !DEBUG_ATTACHED(c)){
+        executed = idle_loop(c, &idle, pc, executed, count);
+    }
+    DISPATCH();
+do_call_subroutine: call_subroutine(c, NNN); idle.pc = 0xffff; DISPATCH();
+do_skip_equal: skip_equal_quirks(c, d.x, d.kk, QUIRKS); DISPATCH();
+do_skip_not_equal: skip_not_equal_quirks(c, d.x, d.kk, QUIRKS); DISPATCH();
+do_skip_equal_reg: skip_equal_reg_quirks(c, d.x, d.y, QUIRKS); DISPATCH();
+do_load_imm: load_imm(c, d.x, d.kk); DISPATCH();
+do_add_imm: add_imm(c, d.x, d.kk); DISPATCH();
+do_mov: mov(c, d.x, d.y); DISPATCH();
+do_bit_or: bit_or(c, d.x, d.y); DISPATCH();
+do_bit_and: bit_and(c, d.x, d.y); DISPATCH();
+do_bit_xor: bit_xor(c, d.x, d.y); DISPATCH();
+do_add_reg: add_reg(c, d.x, d.y); DISPATCH();
+do_sub_reg: sub_reg(c, d.x, d.y); DISPATCH();
+do_shift_right: shift_right_quirks(c, d.x, d.y, QUIRKS); DISPATCH();
+do_sub_reg_switch: sub_reg_switch(c, d.x, d.y); DISPATCH();
+do_shift_left: shift_left_quirks(c, d.x, d.y, QUIRKS); DISPATCH();
+do_skip_not_equal_reg: skip_not_equal_reg_quirks(c, d.x, d.y, QUIRKS); DISPATCH();
+do_set_address_reg: set_address_reg(c, NNN); CHECK_STOPPED(); DISPATCH();
+do_goto_address_plus_V0: goto_address_plus_V0_quirks(c, NNN, QUIRKS); idle.pc = 0xffff; DISPATCH();
+do_rand_mod: rand_mod(c, d.x, d.kk); DISPATCH();
+do_draw_sprite: draw_sprite_quirks(c, d.x, d.y, d.kk & 0xf, QUIRKS); drew = true; DISPATCH();
+do_skip_if_key_pressed: skip_if_key_pressed_quirks(c, d.x, QUIRKS); DISPATCH();
+do_skip_if_key_not_pressed: skip_if_key_not_pressed_quirks(c, d.x, QUIRKS); DISPATCH();
+do_get_delay: get_delay(c, d.x); DISPATCH();
+do_wait_for_key:
+    //the rest of the budget goes through step(), which polls the keys
+    wait_for_key(c, d.x);
+    c->cycles += executed + 1;
+    return drew | run_steps(c, count - executed - 1);
+do_set_delay: set_delay(c, d.x); DISPATCH();
+do_set_sound: set_sound(c, d.x); DISPATCH();
+do_add_address_reg: add_address_reg(c, d.x); CHECK_STOPPED(); DISPATCH();
+do_set_font_char: set_font_char(c, d.x); CHECK_STOPPED(); DISPATCH();
+do_set_bcd: set_bcd_quirks(c, d.x, QUIRKS); CHECK_STOPPED(); DISPATCH();
+do_reg_dump: reg_dump_quirks(c, d.x, QUIRKS); CHECK_STOPPED(); DISPATCH();
+do_reg_load: reg_load_quirks(c, d.x, QUIRKS); CHECK_STOPPED(); DISPATCH();
+#if (QUIRKS) & QUIRK_HIRES
+do_scroll_down: scroll_down(c, d.kk & 0xf); drew = true; DISPATCH();
+do_scroll_right: scroll_right(c); drew = true; DISPATCH();
+do_scroll_left: scroll_left(c); drew = true; DISPATCH();
+do_exit:
+    //the program has ended, spinning on 00FD would use up the budget anyway
+    exit_interpreter(c);
+    executed = count - 1;
+    DISPATCH();
+do_lores: set_lores(c); drew = true; DISPATCH();
+do_hires: set_hires(c); drew = true; DISPATCH();
+do_set_big_font_char: set_big_font_char(c, d.x); CHECK_STOPPED(); DISPATCH();
+do_save_flags: save_flags(c, d.x); DISPATCH();
+do_load_flags: load_flags(c, d.x); DISPATCH();
+#endif
+#if (QUIRKS) & QUIRK_XO
+do_scroll_up: scroll_up(c, d.kk & 0xf); drew = true; DISPATCH();
+do_save_range: save_range(c, d.x, d.y); CHECK_STOPPED(); DISPATCH();
+do_load_range: load_range(c, d.x, d.y); CHECK_STOPPED(); DISPATCH();
+do_set_address_reg_long: set_address_reg_long(c); CHECK_STOPPED(); DISPATCH();
+do_select_planes: select_planes(c, d.x); DISPATCH();
+do_load_audio: load_audio(c); CHECK_STOPPED(); DISPATCH();
+do_set_pitch: set_pitch(c, d.x); DISPATCH();
+#endif
+do_not_implemented:
+    not_implemented(c, (c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)]);
+    c->cycles += executed;
+    return drew;
+do_breakpoint:
+    //step() either records the stop or, when continuing from it, runs the real instruction
+    c->cycles += executed;
+    return drew | run_steps(c, count - executed);
+#undef CHECK_STOPPED
+#undef NNN
+#undef DISPATCH
+}
+#pragma GCC diagnostic pop
+
+#undef PROFILE
+#undef QUIRKS
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "exchange.h"
+
+
+void frame_exchange_init(frame_exchange* x){
+    memset(x->slots, 0, sizeof(x->slots));
+    x->back = 0;
+    atomic_init(&x->middle, 1);
+    x->front = 2;
+}
+
+published_frame* frame_exchange_back(frame_exchange* x){
+    return &x->slots[x->back];
+}
+
+//the release half of the exchange makes the slot's contents visible before its index
+bool frame_exchange_publish(frame_exchange* x){
+    int old = atomic_exchange_explicit(&x->middle, x->back | FRAME_FRESH, memory_order_acq_rel);
+    x->back = old & ~FRAME_FRESH;
+    return old & FRAME_FRESH;
+}
+
+bool frame_exchange_take(frame_exchange* x){
+    if(!(atomic_load_explicit(&x->middle, memory_order_relaxed) & FRAME_FRESH)){
+        return false;
+    }
+    int old = atomic_exchange_explicit(&x->middle, x->front, memory_order_acq_rel);
+    x->front = old & ~FRAME_FRESH;
+    return true;
+}
+
+const published_frame* frame_exchange_front(const frame_exchange* x){
+    return &x->slots[x->front];
+}
+
+void key_ring_init(key_ring* r){
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+}
+
+bool key_ring_push(key_ring* r, int key, bool pressed){
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if(tail - head == KEY_RING_SIZE){
+        return false;
+    }
+    r->events[tail & (KEY_RING_SIZE - 1)] = (key & 0xf) | (pressed << 4);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool key_ring_pop(key_ring* r, int* key, bool* pressed){
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if(head == tail){
+        return false;
+    }
+    uint8_t event = r->events[head & (KEY_RING_SIZE - 1)];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    *key = event & 0xf;
+    *pressed = event >> 4;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef EXCHANGE_H
+#define EXCHANGE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//lock-free handoff between the emulation thread and the window thread. Both structures have
+//exactly one producer and one consumer
+
+#define FRAME_FRESH 4 //set in frame_exchange.middle while the consumer hasn't taken it yet
+#define KEY_RING_SIZE 64 //power of two
+
+typedef struct{
+    uint64_t display[DISPLAY_WORDS];
+    bool hires;
+    uint64_t frame; //emulated frame it was taken at
+}published_frame;
+
+//triple buffer, the producer always has a slot to write into and the consumer only ever sees
+//the newest complete frame. Frames published in between are dropped
+typedef struct{
+    published_frame slots[3];
+    int back; //producer's slot
+    _Atomic int middle; //slot index | FRAME_FRESH
+    int front; //consumer's slot
+}frame_exchange;
+
+//key changes in the order they happened, key | pressed << 4
+typedef struct{
+    uint8_t events[KEY_RING_SIZE];
+    _Atomic uint32_t head; //next to read, written by the consumer
+    _Atomic uint32_t tail; //next to write, written by the producer
+}key_ring;
+
+void frame_exchange_init(frame_exchange* x);
+//slot to fill before calling frame_exchange_publish()
+published_frame* frame_exchange_back(frame_exchange* x);
+//true if the previous frame was still unread and got dropped
+bool frame_exchange_publish(frame_exchange* x);
+//true if a frame was published since the last call, frame_exchange_front() then returns it
+bool frame_exchange_take(frame_exchange* x);
+//the consumer's current frame, all zero before the first take
+const published_frame* frame_exchange_front(const frame_exchange* x);
+
+void key_ring_init(key_ring* r);
+//false if the ring is full
+bool key_ring_push(key_ring* r, int key, bool pressed);
+bool key_ring_pop(key_ring* r, int* key, bool* pressed);
+
+#endif
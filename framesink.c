@@ -0,0 +1,490 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "framesink.h"
+
+
+#define SINK_BUFFER_SIZE (1 << 20)
+#define Y4M_FRAME_HEADER "FRAME\n"
+#define Y4M_FRAME_HEADER_SIZE 6
+#define STORED_BLOCK_MAX 65535
+
+static uint32_t crc_table[256];
+
+static void init_crc_table(void){
+    for(uint32_t n = 0; n < 256; n++){
+        uint32_t c = n;
+        for(int k = 0; k < 8; k++){
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size){
+    uint32_t c = 0xffffffffu;
+    for(size_t i = 0; i < size; i++){
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size){
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for(size_t i = 0; i < size; i++){
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void put_be32(uint8_t* p, uint32_t v){
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+//every display byte expands to 8 * scale pixels of bytes_per_pixel bytes each
+static bool build_plane(sink_plane* p, int scale, int bytes_per_pixel, const uint8_t* on, const uint8_t* off){
+    p->group_bytes = 8 * scale * bytes_per_pixel;
+    p->groups = malloc(256 * p->group_bytes);
+    if(!p->groups){
+        return false;
+    }
+    for(int v = 0; v < 256; v++){
+        uint8_t* group = p->groups + v * p->group_bytes;
+        for(int x = 0; x < 8 * scale; x++){
+            bool lit = (v >> (7 - x / scale)) & 1;
+            memcpy(group + x * bytes_per_pixel, lit ? on : off, bytes_per_pixel);
+        }
+    }
+    return true;
+}
+
+//one bit per pixel, most significant first, as in a 1-bit png
+static bool build_bit_plane(sink_plane* p, int scale){
+    p->group_bytes = scale;
+    p->groups = calloc(256, p->group_bytes);
+    if(!p->groups){
+        return false;
+    }
+    for(int v = 0; v < 256; v++){
+        uint8_t* group = p->groups + v * p->group_bytes;
+        for(int x = 0; x < 8 * scale; x++){
+            if((v >> (7 - x / scale)) & 1){
+                group[x >> 3] |= 0x80 >> (x & 7);
+            }
+        }
+    }
+    return true;
+}
+
+//every pixel of a nibble pair is pixel_width wide and one of the plane_colors, given as four
+//entries of bytes_per_pixel
+static bool build_color_plane(sink_plane* p, int pixel_width, int bytes_per_pixel, const uint8_t* colors){
+    p->group_bytes = 4 * pixel_width * bytes_per_pixel;
+    p->groups = malloc(256 * p->group_bytes);
+    if(!p->groups){
+        return false;
+    }
+    for(int v = 0; v < 256; v++){
+        uint8_t* group = p->groups + v * p->group_bytes;
+        for(int x = 0; x < 4 * pixel_width; x++){
+            int k = ((v >> (7 - x / pixel_width)) & 1) | (((v >> (3 - x / pixel_width)) & 1) << 1);
+            memcpy(group + x * bytes_per_pixel, colors + k * bytes_per_pixel, bytes_per_pixel);
+        }
+    }
+    return true;
+}
+
+//two bits of palette index per pixel, as in a 2-bit png
+static bool build_index_plane(sink_plane* p, int pixel_width){
+    p->group_bytes = pixel_width;
+    p->groups = calloc(256, p->group_bytes);
+    if(!p->groups){
+        return false;
+    }
+    for(int v = 0; v < 256; v++){
+        uint8_t* group = p->groups + v * p->group_bytes;
+        for(int x = 0; x < 4 * pixel_width; x++){
+            int k = ((v >> (7 - x / pixel_width)) & 1) | (((v >> (3 - x / pixel_width)) & 1) << 1);
+            group[x >> 2] |= k << (6 - 2 * (x & 3));
+        }
+    }
+    return true;
+}
+
+//a scaled row is eight table copies, the other scale - 1 rows copies of the first
+static void scale_plane(const sink_plane* p, const uint64_t* display, int scale, uint8_t* out, size_t stride){
+    const size_t group_bytes = p->group_bytes;
+    for(int y = 0; y < VIRTUAL_SCREEN_HEIGHT; y++){
+        uint64_t row = display[y];
+        uint8_t* line = out + (size_t)y * scale * stride;
+        for(int g = 0; g < 8; g++){
+            memcpy(line + g * group_bytes, p->groups + ((row >> (56 - 8 * g)) & 0xff) * group_bytes, group_bytes);
+        }
+        for(int r = 1; r < scale; r++){
+            memcpy(line + r * stride, line, 8 * group_bytes);
+        }
+    }
+}
+
+//the same with both planes of a 64x32 or 128x64 display, a row takes 16 table copies per word
+static void scale_extended(const sink_plane* p, const uint64_t* display, bool hires, int scale, uint8_t* out, size_t stride){
+    const size_t group_bytes = p->group_bytes;
+    const int height = hires ? HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT;
+    const int words = hires ? HIRES_SCREEN_WIDTH / 64 : 1;
+    const int rows = hires ? scale : 2 * scale;
+    const uint64_t* second = display + height * words;
+    for(int y = 0; y < height; y++){
+        uint8_t* line = out + (size_t)y * rows * stride;
+        for(int w = 0; w < words; w++){
+            uint64_t row0 = display[y * words + w];
+            uint64_t row1 = second[y * words + w];
+            for(int g = 0; g < 16; g++){
+                int v = (((row0 >> (60 - 4 * g)) & 0xf) << 4) | ((row1 >> (60 - 4 * g)) & 0xf);
+                memcpy(line + (w * 16 + g) * group_bytes, p->groups + v * group_bytes, group_bytes);
+            }
+        }
+        for(int r = 1; r < rows; r++){
+            memcpy(line + r * stride, line, 16 * words * group_bytes);
+        }
+    }
+}
+
+static void render_extended(frame_sink* s, const uint64_t* display, bool hires){
+    const size_t pixels = (size_t)s->width * s->height;
+    const sink_plane* planes = hires ? s->hires_planes : s->planes;
+    switch(s->format){
+        case SINK_Y4M:
+            for(int i = 0; i < s->plane_count; i++){
+                scale_extended(&planes[i], display, hires, s->scale, s->frame + Y4M_FRAME_HEADER_SIZE + i * pixels, s->width);
+            }
+            break;
+        case SINK_RAW:
+            scale_extended(&planes[0], display, hires, s->scale, s->frame, (size_t)s->width * 3);
+            break;
+        case SINK_PNG:
+            scale_extended(&planes[0], display, hires, s->scale, s->frame + 1, s->width / 4 + 1);
+            break;
+    }
+}
+
+static void render(frame_sink* s, const uint64_t* display, bool hires){
+    if(s->extended){
+        render_extended(s, display, hires);
+        return;
+    }
+    const size_t pixels = (size_t)s->width * s->height;
+    switch(s->format){
+        case SINK_Y4M:
+            for(int i = 0; i < s->plane_count; i++){
+                scale_plane(&s->planes[i], display, s->scale, s->frame + Y4M_FRAME_HEADER_SIZE + i * pixels, s->width);
+            }
+            break;
+        case SINK_RAW:
+            scale_plane(&s->planes[0], display, s->scale, s->frame, (size_t)s->width * 3);
+            break;
+        case SINK_PNG:
+            //every row starts with filter type 0, left in place from the calloc
+            scale_plane(&s->planes[0], display, s->scale, s->frame + 1, s->width / 8 + 1);
+            break;
+    }
+}
+
+static size_t png_capacity(size_t data_size){
+    size_t blocks = (data_size + STORED_BLOCK_MAX - 1) / STORED_BLOCK_MAX;
+    size_t zlib = 2 + blocks * 5 + data_size + 4;
+    return 8 + (12 + 13) + (12 + 12) + (12 + zlib) + 12;
+}
+
+//length and crc are filled in by end_chunk() once the data is in place
+static uint8_t* begin_chunk(uint8_t* chunk, const char* type){
+    memcpy(chunk + 4, type, 4);
+    return chunk + 8;
+}
+
+static uint8_t* end_chunk(uint8_t* chunk, uint8_t* end){
+    uint32_t length = end - chunk - 8;
+    put_be32(chunk, length);
+    put_be32(end, crc32(chunk + 4, length + 4));
+    return end + 4;
+}
+
+//palette png with bit depth 1, or 2 when extended, the image data in stored (uncompressed) deflate blocks
+static void encode_png(frame_sink* s){
+    uint8_t* p = s->png;
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+
+    uint8_t* chunk = p;
+    p = begin_chunk(chunk, "IHDR");
+    put_be32(p, s->width);
+    put_be32(p + 4, s->height);
+    p[8] = s->extended ? 2 : 1; //bit depth
+    p[9] = 3; //palette
+    p[10] = 0;
+    p[11] = 0;
+    p[12] = 0;
+    p = end_chunk(chunk, p + 13);
+
+    chunk = p;
+    p = begin_chunk(chunk, "PLTE");
+    const int colors = s->extended ? 4 : 2;
+    for(int k = 0; k < colors; k++){
+        p[3 * k] = (plane_colors[k] >> 16) & 0xff;
+        p[3 * k + 1] = (plane_colors[k] >> 8) & 0xff;
+        p[3 * k + 2] = plane_colors[k] & 0xff;
+    }
+    p = end_chunk(chunk, p + 3 * colors);
+
+    chunk = p;
+    p = begin_chunk(chunk, "IDAT");
+    *p++ = 0x78;
+    *p++ = 0x01;
+    for(size_t done = 0; done < s->frame_size;){
+        size_t size = s->frame_size - done < STORED_BLOCK_MAX ? s->frame_size - done : STORED_BLOCK_MAX;
+        *p++ = done + size == s->frame_size; //final block flag, type 0
+        p[0] = size & 0xff;
+        p[1] = size >> 8;
+        p[2] = ~size & 0xff;
+        p[3] = (~size >> 8) & 0xff;
+        memcpy(p + 4, s->frame + done, size);
+        p += 4 + size;
+        done += size;
+    }
+    put_be32(p, adler32(s->frame, s->frame_size));
+    p = end_chunk(chunk, p + 4);
+
+    chunk = p;
+    p = begin_chunk(chunk, "IEND");
+    p = end_chunk(chunk, p);
+    s->png_size = p - s->png;
+}
+
+static bool write_png(frame_sink* s){
+    char* filename = malloc(strlen(s->prefix) + 32);
+    if(!filename){
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    sprintf(filename, "%s_%06llu.png", s->prefix, (unsigned long long)s->frame_number);
+    FILE* fp = fopen(filename, "wb");
+    free(filename);
+    if(!fp){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    encode_png(s);
+    bool ok = fwrite(s->png, 1, s->png_size, fp) == s->png_size;
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+//the stream keeps a duplicate of stdout, stdout itself is pointed at stderr
+static FILE* open_stdout_stream(void){
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if(fd < 0){
+        return NULL;
+    }
+    FILE* fp = fdopen(fd, "wb");
+    if(!fp){
+        close(fd);
+        return NULL;
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    return fp;
+}
+
+//bt.601 limited range, what players assume for y4m
+static void yuv_color(uint32_t color, uint8_t out[3]){
+    const int r = (color >> 16) & 0xff;
+    const int g = (color >> 8) & 0xff;
+    const int b = color & 0xff;
+    out[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    out[1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    out[2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+//the tables for the plane_colors at both pixel widths
+static bool build_extended_planes(frame_sink* s){
+    bool ok = true;
+    switch(s->format){
+        case SINK_Y4M:
+            for(int i = 0; i < 3; i++){
+                uint8_t colors[4];
+                for(int k = 0; k < 4; k++){
+                    uint8_t yuv[3];
+                    yuv_color(plane_colors[k], yuv);
+                    colors[k] = yuv[i];
+                }
+                ok = ok && build_color_plane(&s->planes[i], 2 * s->scale, 1, colors);
+                ok = ok && build_color_plane(&s->hires_planes[i], s->scale, 1, colors);
+            }
+            break;
+        case SINK_RAW:{
+            uint8_t colors[12];
+            for(int k = 0; k < 4; k++){
+                colors[3 * k] = (plane_colors[k] >> 16) & 0xff;
+                colors[3 * k + 1] = (plane_colors[k] >> 8) & 0xff;
+                colors[3 * k + 2] = plane_colors[k] & 0xff;
+            }
+            ok = build_color_plane(&s->planes[0], 2 * s->scale, 3, colors);
+            ok = ok && build_color_plane(&s->hires_planes[0], s->scale, 3, colors);
+            break;
+        }
+        case SINK_PNG:
+            ok = build_index_plane(&s->planes[0], 2 * s->scale);
+            ok = ok && build_index_plane(&s->hires_planes[0], s->scale);
+            break;
+    }
+    return ok;
+}
+
+bool frame_sink_open(frame_sink* s, sink_format format, const char* path, int scale, int every, bool extended){
+    memset(s, 0, sizeof(*s));
+    if(scale < 1 || scale > SINK_MAX_SCALE || every < 1){
+        return false;
+    }
+    s->format = format;
+    s->scale = scale;
+    s->every = every;
+    s->extended = extended;
+    s->width = (extended ? HIRES_SCREEN_WIDTH : VIRTUAL_SCREEN_WIDTH) * scale;
+    s->height = (extended ? HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT) * scale;
+    s->prefix = path;
+
+    const uint8_t r = (SCREEN_COLOR >> 16) & 0xff;
+    const uint8_t g = (SCREEN_COLOR >> 8) & 0xff;
+    const uint8_t b = SCREEN_COLOR & 0xff;
+    const size_t pixels = (size_t)s->width * s->height;
+    bool ok = !extended || build_extended_planes(s);
+    switch(format){
+        case SINK_Y4M:{
+            uint8_t on[3];
+            yuv_color(SCREEN_COLOR, on);
+            const uint8_t off[3] = {16, 128, 128};
+            for(int i = 0; i < 3 && !extended; i++){
+                ok = ok && build_plane(&s->planes[i], scale, 1, &on[i], &off[i]);
+            }
+            s->plane_count = 3;
+            s->frame_size = Y4M_FRAME_HEADER_SIZE + 3 * pixels;
+            break;
+        }
+        case SINK_RAW:{
+            const uint8_t on[3] = {r, g, b};
+            const uint8_t off[3] = {0, 0, 0};
+            if(!extended){
+                ok = build_plane(&s->planes[0], scale, 3, on, off);
+            }
+            s->plane_count = 1;
+            s->frame_size = 3 * pixels;
+            break;
+        }
+        case SINK_PNG:
+            if(!extended){
+                ok = build_bit_plane(&s->planes[0], scale);
+            }
+            s->plane_count = 1;
+            s->frame_size = (size_t)s->height * (s->width / (extended ? 4 : 8) + 1);
+            s->png = malloc(png_capacity(s->frame_size));
+            ok = ok && s->png;
+            init_crc_table();
+            break;
+    }
+    s->frame = calloc(1, s->frame_size);
+    if(!ok || !s->frame){
+        fprintf(stderr, "out of memory\n");
+        frame_sink_close(s);
+        return false;
+    }
+    if(format == SINK_Y4M){
+        memcpy(s->frame, Y4M_FRAME_HEADER, Y4M_FRAME_HEADER_SIZE);
+    }
+
+    if(format == SINK_PNG){
+        char* filename = malloc(strlen(path) + 5);
+        if(filename){
+            sprintf(filename, "%s.txt", path);
+            s->fp = fopen(filename, "w");
+            free(filename);
+        }
+    }
+    else{
+        s->fp = strcmp(path, "-") == 0 ? open_stdout_stream() : fopen(path, "wb");
+    }
+    if(!s->fp){
+        fprintf(stderr, "could not open file!!!\n");
+        frame_sink_close(s);
+        return false;
+    }
+    setvbuf(s->fp, NULL, _IOFBF, SINK_BUFFER_SIZE);
+    if(format == SINK_Y4M){
+        fprintf(s->fp, "YUV4MPEG2 W%d H%d F60:%d Ip A1:1 C444\n", s->width, s->height, every);
+    }
+    return true;
+}
+
+bool frame_sink_frame(frame_sink* s, const chip_8* c){
+    s->frame_number++;
+    if(s->frame_number % s->every != 0){
+        return true;
+    }
+    const size_t display_size = display_words(c) * sizeof(c->display[0]);
+    bool repeat = s->has_last && s->last_hires == c->hires && memcmp(s->last_display, c->display, display_size) == 0;
+    if(repeat){
+        s->repeats++;
+    }
+    else{
+        memcpy(s->last_display, c->display, display_size);
+        s->last_hires = c->hires;
+        s->has_last = true;
+        render(s, c->display, c->hires);
+    }
+    s->written++;
+
+    if(s->format == SINK_PNG){
+        if(!repeat){
+            if(!write_png(s)){
+                fprintf(stderr, "could not write frames!!!\n");
+                return false;
+            }
+            s->last_frame = s->frame_number;
+        }
+        fprintf(s->fp, "%llu %s_%06llu.png\n", (unsigned long long)s->frame_number, s->prefix,
+                (unsigned long long)s->last_frame);
+    }
+    else{
+        fwrite(s->frame, 1, s->frame_size, s->fp);
+    }
+    if(ferror(s->fp)){
+        fprintf(stderr, "could not write frames!!!\n");
+        return false;
+    }
+    return true;
+}
+
+bool frame_sink_close(frame_sink* s){
+    bool ok = true;
+    if(s->fp){
+        ok = !ferror(s->fp);
+        ok = fclose(s->fp) == 0 && ok;
+        if(!ok){
+            fprintf(stderr, "could not write frames!!!\n");
+        }
+    }
+    for(int i = 0; i < SINK_MAX_PLANES; i++){
+        free(s->planes[i].groups);
+        free(s->hires_planes[i].groups);
+    }
+    free(s->frame);
+    free(s->png);
+    memset(s, 0, sizeof(*s));
+    return ok;
+}
@@ -0,0 +1,69 @@
+#ifndef FRAMESINK_H
+#define FRAMESINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+
+//writes emulated frames for machines without a display. Every pixel becomes a scale x scale block.
+//  y4m  YUV4MPEG2 4:4:4 stream at 60/every fps, for piping into an encoder
+//  raw  RGB24 frames back to back, same rate, no header
+//  png  one 1-bit png per frame, prefix_NNNNNN.png, plus prefix.txt listing the frame -> file
+//The extended machines are written at 128x64 in the four plane_colors, a 64x32 frame at twice
+//the scale, and their pngs have 2 bits per pixel
+//A frame identical to the previous one isn't scaled again. Streams need every frame for their
+//frame rate so the buffered copy is written again, png repeats are just an index line pointing
+//at the earlier file
+
+#define SINK_MAX_SCALE 32
+#define SINK_MAX_PLANES 3
+
+typedef enum{
+    SINK_Y4M,
+    SINK_RAW,
+    SINK_PNG
+}sink_format;
+
+typedef struct{
+    uint8_t* groups; //for every byte of a display row, the scaled bytes of those 8 pixels. Extended:
+                     //for a nibble of each plane, plane 1 on top, the scaled bytes of those 4 pixels
+    int group_bytes;
+}sink_plane;
+
+typedef struct{
+    sink_format format;
+    int scale;
+    int every;
+    int width;
+    int height;
+    FILE* fp; //the stream, or the png index
+    const char* prefix;
+    bool extended;
+    sink_plane planes[SINK_MAX_PLANES];
+    sink_plane hires_planes[SINK_MAX_PLANES]; //extended only, planes are for the 64x32 mode then
+    int plane_count;
+    uint8_t* frame; //the last emitted frame, scaled
+    size_t frame_size;
+    uint8_t* png; //encoded png, built in memory and written with one call
+    size_t png_size;
+    uint64_t last_display[DISPLAY_WORDS];
+    bool last_hires;
+    uint64_t last_frame; //png: frame number in the last file's name
+    bool has_last;
+    uint64_t frame_number; //frames passed to frame_sink_frame()
+    uint64_t written;
+    uint64_t repeats;
+}frame_sink;
+
+//path "-" streams to stdout, which then no longer receives the emulator's own output: that goes
+//to stderr instead. For png path is the file name prefix. extended is for the machines with
+//QUIRK_HIRES
+bool frame_sink_open(frame_sink* s, sink_format format, const char* path, int scale, int every, bool extended);
+//call once after every emulated frame
+bool frame_sink_frame(frame_sink* s, const chip_8* c);
+bool frame_sink_close(frame_sink* s);
+
+#endif
@@ -0,0 +1,452 @@
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (1 << 20)
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_MAX_BLOCK_BYTES 2048
+//entry values below this are markers, not code offsets
+#define ENTRY_NOT_COMPILED 0
+#define ENTRY_INTERPRET 1
+#define ENTRY_FIRST_OFFSET 16
+//code overwritten this often is left to the interpreter from then on
+#define JIT_REWRITE_LIMIT 4
+
+//compiled blocks take the chip and the remaining instruction budget and return how many
+//instructions they executed. They stop early once the budget is used up
+typedef int (*jit_block)(chip_8* c, int budget);
+
+struct jit_state{
+    uint8_t* code;
+    size_t used;
+    uint32_t entry[MEMORY_SIZE];
+    uint8_t block_length[MEMORY_SIZE]; //instructions in the block compiled at each entry
+    uint8_t code_map[MEMORY_SIZE]; //number of live blocks covering each byte
+    uint8_t rewrites[MEMORY_SIZE]; //how often translated code at each address was overwritten
+};
+
+typedef struct{
+    uint8_t* buf;
+    size_t pos;
+    uint8_t quirks; //quirk_flags of the chip's profile, blocks are compiled for it
+}emitter;
+
+//x86 register numbers used by the emitter
+enum{ RAX = 0, RCX = 1, RDX = 2 };
+
+#define REG_OFFSET(x) ((int32_t)(offsetof(chip_8, registers) + (x)))
+#define PC_OFFSET ((int32_t)offsetof(chip_8, program_counter))
+#define I_OFFSET ((int32_t)offsetof(chip_8, address_register))
+#define DELAY_OFFSET ((int32_t)offsetof(chip_8, delay_timer))
+#define SOUND_OFFSET ((int32_t)offsetof(chip_8, sound_timer))
+
+static void emit8(emitter* e, uint8_t b){
+    e->buf[e->pos++] = b;
+}
+
+static void emit16(emitter* e, uint16_t v){
+    emit8(e, v & 0xff);
+    emit8(e, v >> 8);
+}
+
+static void emit32(emitter* e, uint32_t v){
+    for(int i = 0; i < 4; i++){
+        emit8(e, (v >> (8 * i)) & 0xff);
+    }
+}
+
+static void emit64(emitter* e, uint64_t v){
+    emit32(e, v & 0xffffffff);
+    emit32(e, v >> 32);
+}
+
+//ModRM for [rbx + disp32] with reg as the register operand / opcode extension
+static void emit_rbx_mem(emitter* e, int reg, int32_t disp){
+    emit8(e, 0x80 | (reg << 3) | 3);
+    emit32(e, disp);
+}
+
+//movzx r32, byte [rbx + disp]
+static void emit_load8(emitter* e, int reg, int32_t disp){
+    emit8(e, 0x0f); emit8(e, 0xb6); emit_rbx_mem(e, reg, disp);
+}
+
+//mov byte [rbx + disp], r8
+static void emit_store8(emitter* e, int reg, int32_t disp){
+    emit8(e, 0x88); emit_rbx_mem(e, reg, disp);
+}
+
+//mov byte [rbx + disp], imm8
+static void emit_store8_imm(emitter* e, int32_t disp, uint8_t imm){
+    emit8(e, 0xc6); emit_rbx_mem(e, 0, disp); emit8(e, imm);
+}
+
+//mov word [rbx + disp], imm16
+static void emit_store16_imm(emitter* e, int32_t disp, uint16_t imm){
+    emit8(e, 0x66); emit8(e, 0xc7); emit_rbx_mem(e, 0, disp); emit16(e, imm);
+}
+
+//mov word [rbx + disp], r16
+static void emit_store16(emitter* e, int reg, int32_t disp){
+    emit8(e, 0x66); emit8(e, 0x89); emit_rbx_mem(e, reg, disp);
+}
+
+//eax = (condition ? if_true : if_false), then program_counter = ax. cmov_opcode is 0x44 (e) or 0x45 (ne)
+static void emit_select_pc(emitter* e, uint8_t cmov_opcode, uint16_t if_true, uint16_t if_false){
+    emit8(e, 0xb8); emit32(e, if_false);          //mov eax, if_false
+    emit8(e, 0xb9); emit32(e, if_true);           //mov ecx, if_true
+    emit8(e, 0x0f); emit8(e, cmov_opcode); emit8(e, 0xc1); //cmovcc eax, ecx
+    emit_store16(e, RAX, PC_OFFSET);
+}
+
+//calls one of the interpreter handlers as handler(c, arg) with the program counter
+//set to the address of the instruction, exactly like the interpreter would
+static void emit_handler_call(emitter* e, uintptr_t handler, uint16_t pc, int has_arg, uint32_t arg){
+    emit_store16_imm(e, PC_OFFSET, pc);
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xdf); //mov rdi, rbx
+    if(has_arg){
+        emit8(e, 0xbe); emit32(e, arg);             //mov esi, arg
+    }
+    emit8(e, 0x48); emit8(e, 0xb8); emit64(e, handler); //mov rax, handler
+    emit8(e, 0xff); emit8(e, 0xd0);                 //call rax
+}
+
+typedef enum{
+    TRANSLATE_NO,        //leave to the interpreter, the block ends before it
+    TRANSLATE_STRAIGHT,  //falls through to the next instruction
+    TRANSLATE_TERMINATOR //sets the program counter itself, the block ends after it
+}translation;
+
+//XO-CHIP skips have to look at the next instruction to know how far they go, they stay with the
+//interpreter like every other extension instruction
+static translation classify(decoded_instruction d, int quirks){
+    switch(d.op){
+        case OP_LOAD_IMM: case OP_ADD_IMM: case OP_MOV: case OP_BIT_OR: case OP_BIT_AND:
+        case OP_BIT_XOR: case OP_ADD_REG: case OP_SUB_REG: case OP_SHIFT_RIGHT:
+        case OP_SUB_REG_SWITCH: case OP_SHIFT_LEFT: case OP_SET_ADDRESS_REG:
+        case OP_GET_DELAY: case OP_SET_DELAY: case OP_SET_SOUND: case OP_ADD_ADDRESS_REG:
+        case OP_SET_FONT_CHAR: case OP_REG_LOAD:
+            return TRANSLATE_STRAIGHT;
+        case OP_GOTO_ADDRESS: case OP_CALL_SUBROUTINE: case OP_RETURN_FROM_SUBROUTINE:
+        case OP_GOTO_ADDRESS_PLUS_V0:
+            return TRANSLATE_TERMINATOR;
+        case OP_SKIP_EQUAL: case OP_SKIP_NOT_EQUAL: case OP_SKIP_EQUAL_REG:
+        case OP_SKIP_NOT_EQUAL_REG: case OP_SKIP_IF_KEY_PRESSED: case OP_SKIP_IF_KEY_NOT_PRESSED:
+            return quirks & QUIRK_XO ? TRANSLATE_NO : TRANSLATE_TERMINATOR;
+        default:
+            return TRANSLATE_NO;
+    }
+}
+
+//emits the semantics of one instruction at address pc. Mirrors the handlers in chip8.c,
+//including the order in which VF and Vx are written when x is F. Quirks are resolved here, the
+//handler calls follow the chip's profile on their own
+static void emit_instruction(emitter* e, decoded_instruction d, uint16_t pc){
+    uint16_t nnn = (d.x << 8) | d.kk;
+    uint8_t source = e->quirks & QUIRK_SHIFT_VY ? d.y : d.x;
+    switch(d.op){
+        case OP_LOAD_IMM:
+            emit_store8_imm(e, REG_OFFSET(d.x), d.kk);
+            break;
+        case OP_ADD_IMM:
+            emit8(e, 0x80); emit_rbx_mem(e, 0, REG_OFFSET(d.x)); emit8(e, d.kk); //add byte [vx], kk
+            break;
+        case OP_MOV:
+            emit_load8(e, RAX, REG_OFFSET(d.y));
+            emit_store8(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_BIT_OR:
+        case OP_BIT_AND:
+        case OP_BIT_XOR:
+            emit_load8(e, RAX, REG_OFFSET(d.y));
+            emit8(e, d.op == OP_BIT_OR ? 0x08 : d.op == OP_BIT_AND ? 0x20 : 0x30); //op byte [vx], al
+            emit_rbx_mem(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_ADD_REG:
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit_load8(e, RCX, REG_OFFSET(d.y));
+            emit8(e, 0x01); emit8(e, 0xc8);             //add eax, ecx
+            emit8(e, 0x3d); emit32(e, 0xff);            //cmp eax, 0xff
+            emit8(e, 0x0f); emit8(e, 0x97); emit8(e, 0xc2); //seta dl
+            emit_store8(e, RDX, REG_OFFSET(VF));
+            emit_store8(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_SUB_REG:
+        case OP_SUB_REG_SWITCH:{
+            int minuend = d.op == OP_SUB_REG ? RAX : RCX;
+            int subtrahend = d.op == OP_SUB_REG ? RCX : RAX;
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit_load8(e, RCX, REG_OFFSET(d.y));
+            emit8(e, 0x39); emit8(e, 0xc0 | (subtrahend << 3) | minuend); //cmp minuend, subtrahend
+            emit8(e, 0x0f); emit8(e, 0x93); emit8(e, 0xc2); //setae dl
+            emit8(e, 0x29); emit8(e, 0xc0 | (subtrahend << 3) | minuend); //sub minuend, subtrahend
+            emit_store8(e, RDX, REG_OFFSET(VF));
+            emit_store8(e, minuend, REG_OFFSET(d.x));
+            break;
+        }
+        case OP_SHIFT_RIGHT:
+            emit_load8(e, RAX, REG_OFFSET(source));
+            emit8(e, 0x83); emit8(e, 0xe0); emit8(e, 0x01); //and eax, 1
+            emit_store8(e, RAX, REG_OFFSET(VF));
+            emit_load8(e, RAX, REG_OFFSET(source));
+            emit8(e, 0xd1); emit8(e, 0xe8);             //shr eax, 1
+            emit_store8(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_SHIFT_LEFT:
+            emit_load8(e, RAX, REG_OFFSET(source));
+            emit8(e, 0xc1); emit8(e, 0xe8); emit8(e, 7); //shr eax, 7
+            emit_store8(e, RAX, REG_OFFSET(VF));
+            emit_load8(e, RAX, REG_OFFSET(source));
+            emit8(e, 0xd1); emit8(e, 0xe0);             //shl eax, 1
+            emit_store8(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_SET_ADDRESS_REG:
+            emit_store16_imm(e, I_OFFSET, nnn);
+            break;
+        case OP_GET_DELAY:
+            emit_load8(e, RAX, DELAY_OFFSET);
+            emit_store8(e, RAX, REG_OFFSET(d.x));
+            break;
+        case OP_SET_DELAY:
+        case OP_SET_SOUND:
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit_store8(e, RAX, d.op == OP_SET_DELAY ? DELAY_OFFSET : SOUND_OFFSET);
+            break;
+        case OP_ADD_ADDRESS_REG:
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit8(e, 0x66); emit8(e, 0x01); emit_rbx_mem(e, RAX, I_OFFSET); //add word [i], ax
+            break;
+        case OP_SET_FONT_CHAR:
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit8(e, 0x8d); emit8(e, 0x44); emit8(e, 0x80); emit8(e, FONTSET_MEMORY_OFFSET); //lea eax, [rax + rax*4 + 0x50]
+            emit_store16(e, RAX, I_OFFSET);
+            break;
+        case OP_REG_LOAD:
+            emit_handler_call(e, (uintptr_t)reg_load, pc, 1, d.x);
+            break;
+        case OP_GOTO_ADDRESS:
+            emit_store16_imm(e, PC_OFFSET, nnn);
+            break;
+        case OP_CALL_SUBROUTINE:
+            emit_handler_call(e, (uintptr_t)call_subroutine, pc, 1, nnn);
+            break;
+        case OP_RETURN_FROM_SUBROUTINE:
+            emit_handler_call(e, (uintptr_t)return_from_subroutine, pc, 0, 0);
+            break;
+        case OP_GOTO_ADDRESS_PLUS_V0:
+            emit_handler_call(e, (uintptr_t)goto_address_plus_V0, pc, 1, nnn);
+            break;
+        case OP_SKIP_IF_KEY_PRESSED:
+            emit_handler_call(e, (uintptr_t)skip_if_key_pressed, pc, 1, d.x);
+            break;
+        case OP_SKIP_IF_KEY_NOT_PRESSED:
+            emit_handler_call(e, (uintptr_t)skip_if_key_not_pressed, pc, 1, d.x);
+            break;
+        case OP_SKIP_EQUAL:
+        case OP_SKIP_NOT_EQUAL:
+            emit8(e, 0x80); emit_rbx_mem(e, 7, REG_OFFSET(d.x)); emit8(e, d.kk); //cmp byte [vx], kk
+            emit_select_pc(e, d.op == OP_SKIP_EQUAL ? 0x44 : 0x45, pc + 2 * INSTRUCTION_SIZE, pc + INSTRUCTION_SIZE);
+            break;
+        case OP_SKIP_EQUAL_REG:
+        case OP_SKIP_NOT_EQUAL_REG:
+            emit_load8(e, RAX, REG_OFFSET(d.x));
+            emit8(e, 0x3a); emit_rbx_mem(e, RAX, REG_OFFSET(d.y)); //cmp al, byte [vy]
+            emit_select_pc(e, d.op == OP_SKIP_EQUAL_REG ? 0x44 : 0x45, pc + 2 * INSTRUCTION_SIZE, pc + INSTRUCTION_SIZE);
+            break;
+    }
+}
+
+static decoded_instruction fetch(const chip_8* c, uint16_t pc){
+    return profile_instruction(decode_instruction((c->memory[pc] << 8) | c->memory[pc + 1]), quirk_flags[c->quirks]);
+}
+
+static void flush(struct jit_state* j){
+    j->used = ENTRY_FIRST_OFFSET;
+    memset(j->entry, 0, sizeof(j->entry));
+    memset(j->code_map, 0, sizeof(j->code_map));
+}
+
+//translates the block starting at start and returns its entry value
+static uint32_t compile_block(chip_8* c, uint16_t start){
+    struct jit_state* j = c->jit;
+    uint16_t addresses[JIT_MAX_BLOCK_INSTRUCTIONS];
+    decoded_instruction instructions[JIT_MAX_BLOCK_INSTRUCTIONS];
+    int count = 0;
+    bool terminated = false;
+    uint16_t pc = start;
+    while(count < JIT_MAX_BLOCK_INSTRUCTIONS && pc + 1 < MEMORY_SIZE){
+        if(j->rewrites[pc] >= JIT_REWRITE_LIMIT || j->rewrites[pc + 1] >= JIT_REWRITE_LIMIT) break;
+        decoded_instruction d = fetch(c, pc);
+        translation t = classify(d, quirk_flags[c->quirks]);
+        if(t == TRANSLATE_NO) break;
+        addresses[count] = pc;
+        instructions[count] = d;
+        count++;
+        pc += INSTRUCTION_SIZE;
+        if(t == TRANSLATE_TERMINATOR){
+            terminated = true;
+            break;
+        }
+    }
+    if(count == 0){
+        return ENTRY_INTERPRET;
+    }
+    if(JIT_CODE_SIZE - j->used < JIT_MAX_BLOCK_BYTES){
+        flush(j);
+    }
+    if(mprotect(j->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0){
+        return ENTRY_INTERPRET;
+    }
+
+    emitter e = {j->code + j->used, 0, quirk_flags[c->quirks]};
+    //prologue: keep the chip in rbx and the budget in ebp, both survive handler calls
+    emit8(&e, 0x53);                               //push rbx
+    emit8(&e, 0x55);                               //push rbp
+    emit8(&e, 0x48); emit8(&e, 0x83); emit8(&e, 0xec); emit8(&e, 0x08); //sub rsp, 8
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xfb); //mov rbx, rdi
+    emit8(&e, 0x89); emit8(&e, 0xf5);              //mov ebp, esi
+
+    size_t exit_jumps[JIT_MAX_BLOCK_INSTRUCTIONS];
+    for(int i = 0; i < count; i++){
+        emit_instruction(&e, instructions[i], addresses[i]);
+        if(i + 1 < count){
+            emit8(&e, 0xff); emit8(&e, 0xcd);       //dec ebp
+            emit8(&e, 0x0f); emit8(&e, 0x84);       //jz exit_i
+            exit_jumps[i] = e.pos;
+            emit32(&e, 0);
+        }
+    }
+    if(!terminated){
+        emit_store16_imm(&e, PC_OFFSET, pc);
+    }
+    emit8(&e, 0xb8); emit32(&e, count);            //mov eax, count
+    size_t epilogue = e.pos;
+    emit8(&e, 0x48); emit8(&e, 0x83); emit8(&e, 0xc4); emit8(&e, 0x08); //add rsp, 8
+    emit8(&e, 0x5d);                               //pop rbp
+    emit8(&e, 0x5b);                               //pop rbx
+    emit8(&e, 0xc3);                               //ret
+
+    //budget ran out after instruction i: resume at instruction i + 1 next time
+    for(int i = 0; i + 1 < count; i++){
+        uint32_t rel = e.pos - (exit_jumps[i] + 4);
+        memcpy(e.buf + exit_jumps[i], &rel, 4);
+        emit_store16_imm(&e, PC_OFFSET, addresses[i + 1]);
+        emit8(&e, 0xb8); emit32(&e, i + 1);        //mov eax, i + 1
+        emit8(&e, 0xe9); emit32(&e, epilogue - (e.pos + 4)); //jmp epilogue
+    }
+
+    mprotect(j->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+    uint32_t offset = j->used;
+    j->used = (j->used + e.pos + 15) & ~(size_t)15;
+    j->block_length[start] = count;
+    for(uint16_t a = start; a < pc; a++){
+        j->code_map[a]++;
+    }
+    return offset;
+}
+
+bool jit_init(chip_8* c){
+    struct jit_state* j = malloc(sizeof(struct jit_state));
+    if(!j) return false;
+    j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(j->code == MAP_FAILED){
+        free(j);
+        return false;
+    }
+    flush(j);
+    memset(j->rewrites, 0, sizeof(j->rewrites));
+    c->jit = j;
+    c->core = CORE_JIT;
+    return true;
+}
+
+void jit_free(chip_8* c){
+    if(!c->jit) return;
+    munmap(c->jit->code, JIT_CODE_SIZE);
+    free(c->jit);
+    c->jit = NULL;
+    if(c->core == CORE_JIT){
+        c->core = CORE_CACHED;
+    }
+}
+
+//drops only the blocks covering the written bytes. Their code stays in the buffer until the next flush
+void jit_invalidate(chip_8* c, uint16_t address, int length){
+    struct jit_state* j = c->jit;
+    for(int i = 0; i < length; i++){
+        int written = (address + i) & (MEMORY_SIZE - 1);
+        if(!j->code_map[written]) continue;
+        if(j->rewrites[written] < JIT_REWRITE_LIMIT){
+            j->rewrites[written]++;
+        }
+        int first = written - INSTRUCTION_SIZE * JIT_MAX_BLOCK_INSTRUCTIONS;
+        for(int start = first < 0 ? 0 : first; start <= written; start++){
+            int end = start + INSTRUCTION_SIZE * j->block_length[start];
+            if(j->entry[start] >= ENTRY_FIRST_OFFSET && end > written){
+                j->entry[start] = ENTRY_NOT_COMPILED;
+                for(int a = start; a < end; a++){
+                    j->code_map[a]--;
+                }
+            }
+        }
+    }
+}
+
+bool jit_run_instructions(chip_8* c, int count){
+    struct jit_state* j = c->jit;
+    bool drew = false;
+    int executed = 0;
+    while(executed < count){
+        uint16_t pc = c->program_counter;
+        if(c->waiting_for_key || pc + 1 >= MEMORY_SIZE){
+            int res = step(c);
+            if(res == 2) drew = true;
+            if(!step_budget(c, res, &executed, count)) break;
+            continue;
+        }
+        uint32_t entry = j->entry[pc];
+        if(entry == ENTRY_NOT_COMPILED){
+            entry = compile_block(c, pc);
+            j->entry[pc] = entry;
+        }
+        if(entry == ENTRY_INTERPRET){
+            int res = step(c);
+            if(res == 2) drew = true;
+            if(!step_budget(c, res, &executed, count)) break;
+            continue;
+        }
+        //ISO C has no cast from data to function pointers
+        jit_block block;
+        void* code = j->code + entry;
+        memcpy(&block, &code, sizeof(block));
+        executed += block(c, count - executed);
+    }
+    c->cycles += executed;
+    return drew;
+}
+
+#else
+
+bool jit_init(chip_8* c){
+    return false;
+}
+
+void jit_free(chip_8* c){
+}
+
+bool jit_run_instructions(chip_8* c, int count){
+    return run_instructions(c, count);
+}
+
+void jit_invalidate(chip_8* c, uint16_t address, int length){
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//basic block recompiler for x86-64. Blocks end at the branch, skip and call instructions and
+//before anything the recompiler leaves to the interpreter (Dxyn, 00E0, Cxkk, Fx0A, Fx33, Fx55, ...).
+//on other architectures jit_init() fails and the interpreter is used
+
+//allocates the code buffer and switches the chip to CORE_JIT
+bool jit_init(chip_8* c);
+void jit_free(chip_8* c);
+
+//same contract as run_instructions()
+bool jit_run_instructions(chip_8* c, int count);
+
+//drops every compiled block if [address, address + length) overlaps compiled code
+void jit_invalidate(chip_8* c, uint16_t address, int length);
+
+#endif
@@ -0,0 +1,597 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include "lockstep.h"
+
+
+//GNU vector extensions: with -march=native these compile to AVX2, elsewhere to SSE or scalar code
+typedef uint8_t u8x32 __attribute__((vector_size(32)));
+typedef uint8_t u8x16 __attribute__((vector_size(16)));
+typedef int8_t s8x16 __attribute__((vector_size(16)));
+typedef uint16_t u16x16 __attribute__((vector_size(32)));
+typedef int16_t s16x16 __attribute__((vector_size(32)));
+
+typedef union{
+    u8x32 v;
+    u8x16 half[2];
+}u8x32_halves;
+
+#define WARP LOCKSTEP_WARP_LANES
+#define RUN_CHUNK 0x8000 //per lane budgets are 16 bit
+
+//byte wide state is one u8x32 per field, 16 bit state two u16x16 (lanes 0-15 and 16-31)
+struct lockstep_warp{
+    u8x32 registers[16];
+    u16x16 address_register[2];
+    u16x16 program_counter[2];
+    u16x16 remaining[2]; //instructions left in the current run
+    u8x32 delay_timer;
+    u8x32 sound_timer;
+    u8x32 stack_pos;
+    u8x32 waiting_for_key;
+    u8x32 key_target_reg;
+    u8x32 faulted;
+    u8x32 enabled; //lanes past ls->lanes in the last warp never run
+    int run_count;
+    uint16_t keys[WARP];
+    uint8_t pressed_key[WARP];
+    uint16_t fault_instruction[WARP];
+    uint32_t random_state[WARP];
+    uint64_t cycles[WARP];
+    uint16_t stack[WARP][STACK_SIZE];
+    uint64_t display[WARP][VIRTUAL_SCREEN_HEIGHT];
+    uint8_t memory[WARP][MEMORY_SIZE];
+    //set for every address some lane wrote since the program was loaded. Only there can lanes
+    //disagree about the code, so instructions touching these addresses run lane by lane
+    uint8_t written[MEMORY_SIZE];
+    decoded_instruction decoded[MEMORY_SIZE]; //only valid where written[] is clear
+};
+
+#define PC(w, l) ((w)->program_counter[(l) >> 4][(l) & 15])
+#define ADDRESS(w, l) ((w)->address_register[(l) >> 4][(l) & 15])
+#define REMAINING(w, l) ((w)->remaining[(l) >> 4][(l) & 15])
+#define V(w, l, r) ((w)->registers[r][l])
+
+static inline u8x32 blend8(u8x32 old, u8x32 value, u8x32 mask){
+    return (value & mask) | (old & ~mask);
+}
+
+static inline u16x16 blend16(u16x16 old, u16x16 value, u16x16 mask){
+    return (value & mask) | (old & ~mask);
+}
+
+//zero extends the bytes of one half to 16 bits
+static inline u16x16 widen(u8x32 v, int half){
+    u8x32_halves h = {v};
+    return __builtin_convertvector(h.half[half], u16x16);
+}
+
+//sign extends, so 0xff mask bytes stay all ones
+static inline u16x16 widen_mask(u8x32 v, int half){
+    u8x32_halves h = {v};
+    return (u16x16)__builtin_convertvector((s8x16)h.half[half], s16x16);
+}
+
+static inline u8x32 narrow_mask(const u16x16 m[2]){
+    u8x32_halves h;
+    h.half[0] = __builtin_convertvector(m[0], u8x16);
+    h.half[1] = __builtin_convertvector(m[1], u8x16);
+    return h.v;
+}
+
+static inline uint32_t mask_bits(u8x32 m){
+#if defined(__AVX2__)
+    return (uint32_t)_mm256_movemask_epi8((__m256i)m);
+#else
+    uint32_t bits = 0;
+    for(int l = 0; l < WARP; l++){
+        bits |= (uint32_t)(m[l] >> 7) << l;
+    }
+    return bits;
+#endif
+}
+
+static inline uint16_t min_lane(const u16x16 v[2]){
+    s16x16 less = (s16x16)(v[0] < v[1]);
+    u16x16 m = blend16(v[1], v[0], (u16x16)less);
+#if defined(__SSE4_1__)
+    u8x32_halves h = {(u8x32)m};
+    __m128i x = _mm_min_epu16((__m128i)h.half[0], (__m128i)h.half[1]);
+    return (uint16_t)_mm_extract_epi16(_mm_minpos_epu16(x), 0);
+#else
+    uint16_t result = m[0];
+    for(int i = 1; i < 16; i++){
+        if(m[i] < result) result = m[i];
+    }
+    return result;
+#endif
+}
+
+static void lane_write(struct lockstep_warp* w, int l, uint16_t address, uint8_t value){
+    address &= MEMORY_SIZE - 1;
+    w->memory[l][address] = value;
+    w->written[address] = 1;
+}
+
+//stack handling matches push()/pop() in chip8.c, minus the messages
+static void lane_push(struct lockstep_warp* w, int l, uint16_t value){
+    if(w->stack_pos[l] + 1 >= STACK_SIZE - 1){
+        return;
+    }
+    w->stack_pos[l]++;
+    w->stack[l][w->stack_pos[l]] = value;
+}
+
+static uint16_t lane_pop(struct lockstep_warp* w, int l){
+    if(w->stack_pos[l] == 0){
+        return -1;
+    }
+    uint16_t result = w->stack[l][w->stack_pos[l]];
+    w->stack_pos[l]--;
+    return result;
+}
+
+//remaining is set to one because the caller takes one off for the instruction that faulted
+static void lane_fault(struct lockstep_warp* w, int l){
+    uint16_t pc = PC(w, l) & (MEMORY_SIZE - 1);
+    w->faulted[l] = 0xff;
+    w->fault_instruction[l] = (w->memory[l][pc] << 8) | w->memory[l][(pc + 1) & (MEMORY_SIZE - 1)];
+    w->cycles[l] += w->run_count - REMAINING(w, l);
+    REMAINING(w, l) = 1;
+}
+
+static void lane_skip(struct lockstep_warp* w, int l, bool condition){
+    PC(w, l) += condition ? 2 * INSTRUCTION_SIZE : INSTRUCTION_SIZE;
+}
+
+//one instruction for one lane, same semantics as the handlers in chip8.c
+static void lane_execute(struct lockstep_warp* w, int l, decoded_instruction d){
+    uint16_t nnn = (d.x << 8) | d.kk;
+    switch(d.op){
+        case OP_CLEAR_SCREEN:
+            memset(w->display[l], 0, sizeof(w->display[l]));
+            break;
+        case OP_RETURN_FROM_SUBROUTINE:
+            PC(w, l) = lane_pop(w, l);
+            return;
+        case OP_GOTO_ADDRESS:
+            PC(w, l) = nnn;
+            return;
+        case OP_CALL_SUBROUTINE:
+            lane_push(w, l, PC(w, l) + INSTRUCTION_SIZE);
+            PC(w, l) = nnn;
+            return;
+        case OP_SKIP_EQUAL: lane_skip(w, l, V(w, l, d.x) == d.kk); return;
+        case OP_SKIP_NOT_EQUAL: lane_skip(w, l, V(w, l, d.x) != d.kk); return;
+        case OP_SKIP_EQUAL_REG: lane_skip(w, l, V(w, l, d.x) == V(w, l, d.y)); return;
+        case OP_SKIP_NOT_EQUAL_REG: lane_skip(w, l, V(w, l, d.x) != V(w, l, d.y)); return;
+        case OP_LOAD_IMM: V(w, l, d.x) = d.kk; break;
+        case OP_ADD_IMM: V(w, l, d.x) += d.kk; break;
+        case OP_MOV: V(w, l, d.x) = V(w, l, d.y); break;
+        case OP_BIT_OR: V(w, l, d.x) |= V(w, l, d.y); break;
+        case OP_BIT_AND: V(w, l, d.x) &= V(w, l, d.y); break;
+        case OP_BIT_XOR: V(w, l, d.x) ^= V(w, l, d.y); break;
+        case OP_ADD_REG:{
+            int res = V(w, l, d.x) + V(w, l, d.y);
+            V(w, l, VF) = res > 0xff;
+            V(w, l, d.x) = res & 0xff;
+            break;
+        }
+        case OP_SUB_REG:{
+            int res = V(w, l, d.x) - V(w, l, d.y);
+            V(w, l, VF) = res >= 0;
+            V(w, l, d.x) = res & 0xff;
+            break;
+        }
+        case OP_SHIFT_RIGHT:
+            V(w, l, VF) = V(w, l, d.x) & 1;
+            V(w, l, d.x) >>= 1;
+            break;
+        case OP_SUB_REG_SWITCH:{
+            int res = V(w, l, d.y) - V(w, l, d.x);
+            V(w, l, VF) = res >= 0;
+            V(w, l, d.x) = res & 0xff;
+            break;
+        }
+        case OP_SHIFT_LEFT:
+            V(w, l, VF) = (V(w, l, d.x) >> 7) & 1;
+            V(w, l, d.x) <<= 1;
+            break;
+        case OP_SET_ADDRESS_REG: ADDRESS(w, l) = nnn; break;
+        case OP_GOTO_ADDRESS_PLUS_V0:
+            PC(w, l) = nnn + V(w, l, 0);
+            return;
+        case OP_RAND_MOD:{
+            uint32_t x = w->random_state[l];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            w->random_state[l] = x;
+            V(w, l, d.x) = (x >> 24) & d.kk;
+            break;
+        }
+        case OP_DRAW_SPRITE:{
+            int x_start = V(w, l, d.x) % VIRTUAL_SCREEN_WIDTH;
+            int y_start = V(w, l, d.y);
+            uint64_t collision = 0;
+            for(int y = 0; y < (d.kk & 0xf); y++){
+                uint64_t* row = &w->display[l][(y_start + y) % VIRTUAL_SCREEN_HEIGHT];
+                uint64_t line = (uint64_t)w->memory[l][(ADDRESS(w, l) + y) & (MEMORY_SIZE - 1)] << 56;
+                uint64_t sprite = (line >> x_start) | (line << ((64 - x_start) & 63));
+                collision |= *row & sprite;
+                *row ^= sprite;
+            }
+            V(w, l, VF) = collision != 0;
+            break;
+        }
+        case OP_SKIP_IF_KEY_PRESSED: lane_skip(w, l, (w->keys[l] >> (V(w, l, d.x) & 0xf)) & 1); return;
+        case OP_SKIP_IF_KEY_NOT_PRESSED: lane_skip(w, l, !((w->keys[l] >> (V(w, l, d.x) & 0xf)) & 1)); return;
+        case OP_GET_DELAY: V(w, l, d.x) = w->delay_timer[l]; break;
+        case OP_WAIT_FOR_KEY:
+            w->waiting_for_key[l] = 1;
+            w->key_target_reg[l] = d.x;
+            w->pressed_key[l] = NO_KEY;
+            break;
+        case OP_SET_DELAY: w->delay_timer[l] = V(w, l, d.x); break;
+        case OP_SET_SOUND: w->sound_timer[l] = V(w, l, d.x); break;
+        case OP_ADD_ADDRESS_REG: ADDRESS(w, l) += V(w, l, d.x); break;
+        case OP_SET_FONT_CHAR: ADDRESS(w, l) = FONTSET_MEMORY_OFFSET + V(w, l, d.x) * 5; break;
+        case OP_SET_BCD:{
+            int num = V(w, l, d.x);
+            lane_write(w, l, ADDRESS(w, l) + 0, (num / 100) % 10);
+            lane_write(w, l, ADDRESS(w, l) + 1, (num / 10) % 10);
+            lane_write(w, l, ADDRESS(w, l) + 2, num % 10);
+            break;
+        }
+        case OP_REG_DUMP:
+            for(int i = 0; i <= d.x; i++){
+                lane_write(w, l, ADDRESS(w, l) + i, V(w, l, i));
+            }
+            break;
+        case OP_REG_LOAD:
+            for(int i = 0; i <= d.x; i++){
+                V(w, l, i) = w->memory[l][(ADDRESS(w, l) + i) & (MEMORY_SIZE - 1)];
+            }
+            break;
+        default:
+            lane_fault(w, l);
+            return;
+    }
+    PC(w, l) += INSTRUCTION_SIZE;
+}
+
+static decoded_instruction shared_decode(struct lockstep_warp* w, uint16_t pc){
+    decoded_instruction d = w->decoded[pc];
+    if(d.op == OP_UNDECODED){
+        d = profile_instruction(decode_instruction((w->memory[0][pc] << 8) | w->memory[0][(pc + 1) & (MEMORY_SIZE - 1)]), quirk_flags[QUIRKS_MODERN]);
+        w->decoded[pc] = d;
+    }
+    return d;
+}
+
+//same as step() for a single lane
+static void lane_step(struct lockstep_warp* w, int l){
+    if(w->waiting_for_key[l]){
+        //press, then release of the same key
+        if(w->pressed_key[l] == NO_KEY){
+            if(w->keys[l] != 0) w->pressed_key[l] = __builtin_ctz(w->keys[l]);
+            return;
+        }
+        if((w->keys[l] >> w->pressed_key[l]) & 1) return;
+        V(w, l, w->key_target_reg[l]) = w->pressed_key[l];
+        w->waiting_for_key[l] = 0;
+        w->pressed_key[l] = NO_KEY;
+    }
+    uint16_t pc = PC(w, l) & (MEMORY_SIZE - 1);
+    uint16_t next = (pc + 1) & (MEMORY_SIZE - 1);
+    decoded_instruction d;
+    if(w->written[pc] || w->written[next]){
+        d = profile_instruction(decode_instruction((w->memory[l][pc] << 8) | w->memory[l][next]), quirk_flags[QUIRKS_MODERN]);
+    }
+    else{
+        d = shared_decode(w, pc);
+    }
+    lane_execute(w, l, d);
+}
+
+static void skip_lanes(struct lockstep_warp* w, u8x32 condition, const u16x16 m[2]){
+    for(int h = 0; h < 2; h++){
+        u16x16 taken = widen_mask(condition, h) & m[h];
+        w->program_counter[h] += (m[h] & INSTRUCTION_SIZE) + (taken & INSTRUCTION_SIZE);
+    }
+}
+
+//executes d for every lane in the mask at once. returns false for instructions without
+//a vector form, those go through lane_execute()
+static bool vector_execute(struct lockstep_warp* w, decoded_instruction d, u8x32 m, const u16x16 m16[2]){
+    u8x32* vx = &w->registers[d.x];
+    u8x32* vy = &w->registers[d.y];
+    u8x32* vf = &w->registers[VF];
+    uint16_t nnn = (d.x << 8) | d.kk;
+    switch(d.op){
+        case OP_GOTO_ADDRESS:
+            for(int h = 0; h < 2; h++){
+                w->program_counter[h] = blend16(w->program_counter[h], (u16x16){0} + nnn, m16[h]);
+            }
+            return true;
+        case OP_SKIP_EQUAL: skip_lanes(w, (u8x32)(*vx == d.kk), m16); return true;
+        case OP_SKIP_NOT_EQUAL: skip_lanes(w, (u8x32)(*vx != d.kk), m16); return true;
+        case OP_SKIP_EQUAL_REG: skip_lanes(w, (u8x32)(*vx == *vy), m16); return true;
+        case OP_SKIP_NOT_EQUAL_REG: skip_lanes(w, (u8x32)(*vx != *vy), m16); return true;
+        case OP_LOAD_IMM: *vx = blend8(*vx, (u8x32){0} + d.kk, m); break;
+        case OP_ADD_IMM: *vx = blend8(*vx, *vx + d.kk, m); break;
+        case OP_MOV: *vx = blend8(*vx, *vy, m); break;
+        case OP_BIT_OR: *vx = blend8(*vx, *vx | *vy, m); break;
+        case OP_BIT_AND: *vx = blend8(*vx, *vx & *vy, m); break;
+        case OP_BIT_XOR: *vx = blend8(*vx, *vx ^ *vy, m); break;
+        //the flag is written first, so with x == F the result wins like in the handlers
+        case OP_ADD_REG:{
+            u8x32 a = *vx, b = *vy;
+            u8x32 sum = a + b;
+            *vf = blend8(*vf, (u8x32)(sum < a) & 1, m);
+            *vx = blend8(*vx, sum, m);
+            break;
+        }
+        case OP_SUB_REG:{
+            u8x32 a = *vx, b = *vy;
+            *vf = blend8(*vf, (u8x32)(a >= b) & 1, m);
+            *vx = blend8(*vx, a - b, m);
+            break;
+        }
+        case OP_SUB_REG_SWITCH:{
+            u8x32 a = *vx, b = *vy;
+            *vf = blend8(*vf, (u8x32)(b >= a) & 1, m);
+            *vx = blend8(*vx, b - a, m);
+            break;
+        }
+        //the shifts read Vx again after the flag write, which matters for x == F
+        case OP_SHIFT_RIGHT:
+            *vf = blend8(*vf, *vx & 1, m);
+            *vx = blend8(*vx, *vx >> 1, m);
+            break;
+        case OP_SHIFT_LEFT:
+            *vf = blend8(*vf, *vx >> 7, m);
+            *vx = blend8(*vx, *vx << 1, m);
+            break;
+        case OP_SET_ADDRESS_REG:
+            for(int h = 0; h < 2; h++){
+                w->address_register[h] = blend16(w->address_register[h], (u16x16){0} + nnn, m16[h]);
+            }
+            break;
+        case OP_GET_DELAY: *vx = blend8(*vx, w->delay_timer, m); break;
+        case OP_SET_DELAY: w->delay_timer = blend8(w->delay_timer, *vx, m); break;
+        case OP_SET_SOUND: w->sound_timer = blend8(w->sound_timer, *vx, m); break;
+        case OP_ADD_ADDRESS_REG:
+            for(int h = 0; h < 2; h++){
+                u16x16 sum = w->address_register[h] + widen(*vx, h);
+                w->address_register[h] = blend16(w->address_register[h], sum, m16[h]);
+            }
+            break;
+        case OP_SET_FONT_CHAR:
+            for(int h = 0; h < 2; h++){
+                u16x16 address = FONTSET_MEMORY_OFFSET + widen(*vx, h) * 5;
+                w->address_register[h] = blend16(w->address_register[h], address, m16[h]);
+            }
+            break;
+        default:
+            return false;
+    }
+    for(int h = 0; h < 2; h++){
+        w->program_counter[h] += m16[h] & INSTRUCTION_SIZE;
+    }
+    return true;
+}
+
+//every lane executes count instructions. Lanes never interact, so the order in which groups
+//run doesn't matter; taking the lowest PC first lets lanes that split at a skip join up again
+static void run_warp(struct lockstep_warp* w, int count){
+    u8x32 live = w->enabled & ~w->faulted;
+    for(int h = 0; h < 2; h++){
+        w->remaining[h] = widen_mask(live, h) & (uint16_t)count;
+    }
+    w->run_count = count;
+    for(;;){
+        u16x16 key[2];
+        for(int h = 0; h < 2; h++){
+            u16x16 idle = (u16x16)(w->remaining[h] == 0);
+            key[h] = (w->program_counter[h] & (MEMORY_SIZE - 1)) | idle;
+        }
+        uint16_t pc = min_lane(key);
+        if(pc == 0xffff) break;
+
+        u16x16 m16[2];
+        for(int h = 0; h < 2; h++){
+            m16[h] = (u16x16)(key[h] == pc);
+        }
+        u8x32 m = narrow_mask(m16);
+        uint32_t lanes = mask_bits(m);
+        uint16_t next = (pc + 1) & (MEMORY_SIZE - 1);
+        bool waiting = mask_bits((u8x32)((m & w->waiting_for_key) != 0));
+        if(w->written[pc] || w->written[next] || waiting){
+            for(uint32_t bits = lanes; bits; bits &= bits - 1){
+                lane_step(w, __builtin_ctz(bits));
+            }
+        }
+        else{
+            decoded_instruction d = shared_decode(w, pc);
+            if(!vector_execute(w, d, m, m16)){
+                for(uint32_t bits = lanes; bits; bits &= bits - 1){
+                    lane_execute(w, __builtin_ctz(bits), d);
+                }
+            }
+        }
+        for(int h = 0; h < 2; h++){
+            w->remaining[h] -= m16[h] & 1;
+        }
+    }
+    uint32_t finished = mask_bits(live & ~w->faulted);
+    for(; finished; finished &= finished - 1){
+        w->cycles[__builtin_ctz(finished)] += count;
+    }
+}
+
+static struct lockstep_warp* lane_warp(const lockstep* ls, int lane){
+    return &ls->warps[lane / WARP];
+}
+
+void lockstep_set_lane(lockstep* ls, int lane, const chip_8* c){
+    struct lockstep_warp* w = lane_warp(ls, lane);
+    int l = lane % WARP;
+    for(int r = 0; r < 16; r++){
+        V(w, l, r) = c->registers[r];
+    }
+    ADDRESS(w, l) = c->address_register;
+    PC(w, l) = c->program_counter;
+    w->delay_timer[l] = c->delay_timer;
+    w->sound_timer[l] = c->sound_timer;
+    w->stack_pos[l] = c->stack_pos;
+    w->waiting_for_key[l] = c->waiting_for_key;
+    w->key_target_reg[l] = c->key_target_reg;
+    w->pressed_key[l] = c->pressed_key;
+    w->faulted[l] = c->faulted ? 0xff : 0;
+    w->fault_instruction[l] = c->fault_instruction;
+    w->random_state[l] = c->random_state;
+    w->cycles[l] = c->cycles;
+    w->keys[l] = 0;
+    for(int k = 0; k < 16; k++){
+        w->keys[l] |= (c->keys[k] != 0) << k;
+    }
+    memcpy(w->stack[l], c->stack, sizeof(w->stack[l]));
+    memcpy(w->display[l], c->display, sizeof(w->display[l]));
+    //the other lanes still agree with this lane's old memory wherever nothing was written
+    for(int i = 0; i < MEMORY_SIZE; i++){
+        if(w->memory[l][i] != c->memory[i]){
+            w->memory[l][i] = c->memory[i];
+            w->written[i] = 1;
+        }
+    }
+}
+
+void lockstep_get_lane(const lockstep* ls, int lane, chip_8* c){
+    const struct lockstep_warp* w = lane_warp(ls, lane);
+    int l = lane % WARP;
+    init_chip_8(c);
+    for(int r = 0; r < 16; r++){
+        c->registers[r] = V(w, l, r);
+    }
+    c->address_register = ADDRESS(w, l);
+    c->program_counter = PC(w, l);
+    c->delay_timer = w->delay_timer[l];
+    c->sound_timer = w->sound_timer[l];
+    c->stack_pos = w->stack_pos[l];
+    c->waiting_for_key = w->waiting_for_key[l];
+    c->key_target_reg = w->key_target_reg[l];
+    c->pressed_key = w->pressed_key[l];
+    c->faulted = w->faulted[l] != 0;
+    c->fault_instruction = w->fault_instruction[l];
+    c->random_state = w->random_state[l];
+    c->cycles = w->cycles[l];
+    for(int k = 0; k < 16; k++){
+        c->keys[k] = (w->keys[l] >> k) & 1;
+    }
+    memcpy(c->stack, w->stack[l], sizeof(c->stack));
+    //lanes only have the modern machine's part of the chip
+    memcpy(c->display, w->display[l], sizeof(w->display[l]));
+    memcpy(c->memory, w->memory[l], sizeof(w->memory[l]));
+}
+
+//puts c into every lane and forgets which addresses were written
+static void set_all_lanes(lockstep* ls, const chip_8* c){
+    for(int i = 0; i < ls->warp_count; i++){
+        struct lockstep_warp* w = &ls->warps[i];
+        for(int l = 0; l < WARP; l++){
+            memcpy(w->memory[l], c->memory, sizeof(w->memory[l]));
+        }
+        memset(w->written, 0, sizeof(w->written));
+        memset(w->decoded, 0, sizeof(w->decoded));
+        for(int l = 0; l < WARP; l++){
+            lockstep_set_lane(ls, i * WARP + l, c);
+            w->enabled[l] = i * WARP + l < ls->lanes ? 0xff : 0;
+        }
+    }
+}
+
+bool lockstep_init(lockstep* ls, int lanes){
+    ls->lanes = lanes;
+    ls->warp_count = (lanes + WARP - 1) / WARP;
+    ls->warps = aligned_alloc(sizeof(u8x32), ls->warp_count * sizeof(struct lockstep_warp));
+    if(!ls->warps){
+        return false;
+    }
+    chip_8* c = malloc(sizeof(chip_8));
+    if(!c){
+        lockstep_free(ls);
+        return false;
+    }
+    init_chip_8(c);
+    set_all_lanes(ls, c);
+    free(c);
+    return true;
+}
+
+void lockstep_free(lockstep* ls){
+    free(ls->warps);
+    ls->warps = NULL;
+}
+
+bool lockstep_load_program(lockstep* ls, const char* filename){
+    chip_8* c = malloc(sizeof(chip_8));
+    if(!c){
+        return false;
+    }
+    init_chip_8(c);
+    bool loaded = load_program(c, filename);
+    if(loaded){
+        set_all_lanes(ls, c);
+    }
+    free(c);
+    return loaded;
+}
+
+void lockstep_seed(lockstep* ls, int lane, uint32_t seed){
+    lane_warp(ls, lane)->random_state[lane % WARP] = seed != 0 ? seed : 1;
+}
+
+void lockstep_set_keys(lockstep* ls, int lane, uint16_t keys){
+    lane_warp(ls, lane)->keys[lane % WARP] = keys;
+}
+
+void lockstep_run_instructions(lockstep* ls, int count){
+    for(int i = 0; i < ls->warp_count; i++){
+        for(int left = count; left > 0; left -= RUN_CHUNK){
+            run_warp(&ls->warps[i], left < RUN_CHUNK ? left : RUN_CHUNK);
+        }
+    }
+}
+
+//like run_frame(), lanes that had faulted before the frame don't tick their timers
+void lockstep_run_frame(lockstep* ls, int instructions_per_frame){
+    for(int i = 0; i < ls->warp_count; i++){
+        struct lockstep_warp* w = &ls->warps[i];
+        u8x32 ticking = w->enabled & ~w->faulted;
+        for(int left = instructions_per_frame; left > 0; left -= RUN_CHUNK){
+            run_warp(w, left < RUN_CHUNK ? left : RUN_CHUNK);
+        }
+        w->delay_timer -= (u8x32)(w->delay_timer != 0) & ticking & 1;
+        w->sound_timer -= (u8x32)(w->sound_timer != 0) & ticking & 1;
+    }
+}
+
+uint64_t lockstep_cycles(const lockstep* ls){
+    uint64_t cycles = 0;
+    for(int lane = 0; lane < ls->lanes; lane++){
+        cycles += lane_warp(ls, lane)->cycles[lane % WARP];
+    }
+    return cycles;
+}
+
+int lockstep_faulted_lanes(const lockstep* ls){
+    int faulted = 0;
+    for(int i = 0; i < ls->warp_count; i++){
+        faulted += __builtin_popcount(mask_bits(ls->warps[i].enabled & ls->warps[i].faulted));
+    }
+    return faulted;
+}
@@ -0,0 +1,45 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//runs many instances of one rom side by side. Lanes are grouped into warps of LOCKSTEP_WARP_LANES
+//whose registers, I, PC and timers are stored as vectors. Every step picks the lowest PC among the
+//lanes of a warp and executes that instruction for all lanes sitting on it with vector operations.
+//Instructions without a vector form, and code some lane has overwritten, run lane by lane.
+//every lane behaves exactly like a chip_8 driven by run_instructions()/run_frame()
+
+#define LOCKSTEP_WARP_LANES 32
+
+struct lockstep_warp;
+
+typedef struct{
+    int lanes;
+    int warp_count;
+    struct lockstep_warp* warps;
+}lockstep;
+
+//every lane starts in the state init_chip_8() leaves a chip in
+bool lockstep_init(lockstep* ls, int lanes);
+void lockstep_free(lockstep* ls);
+//loads the rom into every lane, resetting all of them
+bool lockstep_load_program(lockstep* ls, const char* filename);
+void lockstep_seed(lockstep* ls, int lane, uint32_t seed);
+//bit k set means key k is held down
+void lockstep_set_keys(lockstep* ls, int lane, uint16_t keys);
+
+void lockstep_run_instructions(lockstep* ls, int count);
+void lockstep_run_frame(lockstep* ls, int instructions_per_frame);
+//instructions executed by all lanes together, and the lanes that stopped at a fault
+uint64_t lockstep_cycles(const lockstep* ls);
+int lockstep_faulted_lanes(const lockstep* ls);
+
+//copy a single lane out of / into a regular chip_8
+void lockstep_get_lane(const lockstep* ls, int lane, chip_8* c);
+void lockstep_set_lane(lockstep* ls, int lane, const chip_8* c);
+
+#endif
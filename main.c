@@ -1,759 +1,1011 @@
+#define _POSIX_C_SOURCE 200809L
+
+#ifndef CHIP8_HEADLESS
 #include <SDL2/SDL.h>
+#endif
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "aot.h"
+#include "trace.h"
+#include "romindex.h"
+#include "lockstep.h"
+#include "savestate.h"
+#include "movie.h"
+#include "profile.h"
+#include "exchange.h"
+#include "framesink.h"
 
 
-#define VIRTUAL_SCREEN_WIDTH 64
-#define VIRTUAL_SCREEN_HEIGHT 32
-#define MEMORY_SIZE 0x1000
-#define STACK_SIZE 16
 #define WINDOW_WIDTH 640
 #define WINDOW_HEIGHT 320
-#define SCREEN_COLOR 0xff05c714
-#define FONTSET_SIZE 80
-#define FONTSET_MEMORY_OFFSET 0x50
-#define VF 0xF
-#define INSTRUCTION_SIZE 2
-#define LOAD_ADDRESS 0x200
-
-const unsigned char fontset[FONTSET_SIZE] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0,		// 0
-        0x20, 0x60, 0x20, 0x20, 0x70,		// 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0,		// 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0,		// 3
-        0x90, 0x90, 0xF0, 0x10, 0x10,		// 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0,		// 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0,		// 6
-        0xF0, 0x10, 0x20, 0x40, 0x40,		// 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0,		// 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0,		// 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90,		// A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0,		// B
-        0xF0, 0x80, 0x80, 0x80, 0xF0,		// C
-        0xE0, 0x90, 0x90, 0x90, 0xE0,		// D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0,		// E
-        0xF0, 0x80, 0xF0, 0x80, 0x80		// F
-};
+#define DEFAULT_INSTRUCTIONS_PER_FRAME 10
+#define DEFAULT_HEADLESS_FRAMES 600
+#define DEFAULT_DUMP_SCALE 4
 
 typedef struct{
-    uint8_t memory[MEMORY_SIZE];
-    uint32_t pixels[VIRTUAL_SCREEN_HEIGHT][VIRTUAL_SCREEN_WIDTH];
-    uint16_t stack[STACK_SIZE];
-    uint8_t registers[16];
-    uint16_t address_register;
-    uint16_t program_counter;
-    uint8_t keys[16];
-    uint8_t stack_pos;
-    uint8_t delay_timer;
-    uint8_t sound_timer;
-    bool waiting_for_key;
-    uint8_t key_target_reg;
-}chip_8;
-
-
-void init_chip_8(chip_8* c){
-    memset(c->memory, 0, MEMORY_SIZE * sizeof(c->memory[0]));
-    memcpy(c->memory + FONTSET_MEMORY_OFFSET, fontset, FONTSET_SIZE * sizeof(fontset[0]));
-    memset(c->pixels, 0, VIRTUAL_SCREEN_HEIGHT * VIRTUAL_SCREEN_WIDTH * sizeof(c->pixels[0][0]));
-    memset(c->stack, 0, STACK_SIZE * sizeof(c->stack[0]));
-    memset(c->registers, 0, 16 * sizeof(c->registers[0]));
-    memset(c->keys, 0, 16 * sizeof(c->keys[0]));
-    c->address_register = 0;
-    c->program_counter = LOAD_ADDRESS;
-    c->stack_pos = 0;
-    
-    c->delay_timer = 0;
-    c->sound_timer = 0;
-    
-    c->waiting_for_key = false;
-    c->key_target_reg = 0;
-}
-
-bool load_program(chip_8* c, const char* filename){
-    FILE* fp = fopen(filename, "rb");
-    if(!fp){
-        fprintf(stderr, "could not open file!!!\n");
-        return false;
+    const char* filename;
+    bool headless;
+    uint64_t max_cycles;
+    uint64_t max_frames;
+    int instructions_per_frame;
+    bool turbo;
+    execution_core core;
+    uint8_t quirks;
+    bool verify_jit;
+    int lanes;
+    const char* save_state;
+    const char* load_state;
+    bool has_seed;
+    uint32_t seed;
+    const char* record;
+    const char* replay;
+    bool has_seek;
+    uint64_t seek;
+    uint16_t breakpoints[DEBUG_MAX_ENTRIES];
+    int breakpoint_count;
+    uint16_t watch_start[DEBUG_MAX_ENTRIES];
+    uint16_t watch_length[DEBUG_MAX_ENTRIES];
+    int watch_count;
+    const char* profile;
+    const char* dump;
+    sink_format dump_format;
+    int dump_scale;
+    int dump_every;
+    const char* trace;
+    uint64_t trace_records;
+    bool has_core;
+    bool has_quirks;
+    bool has_ipf;
+    const char* index;
+    rom_entry known; //flags are 0 without --index or if the rom isn't in it
+    uint8_t rom[EXTENDED_MEMORY_SIZE - LOAD_ADDRESS]; //the file, read once at startup
+    int rom_size;
+}options;
+
+void print_usage(void){
+    fprintf(stderr, "./program [options] romfile\n");
+    fprintf(stderr, "  --headless          run without a window as fast as possible\n");
+    fprintf(stderr, "  --cycles N          headless: stop after N instructions\n");
+    fprintf(stderr, "  --frames N          headless: stop after N emulated frames\n");
+    fprintf(stderr, "  --ipf N             instructions per 60Hz frame (default %d)\n", DEFAULT_INSTRUCTIONS_PER_FRAME);
+    fprintf(stderr, "  --hz N              cpu clock in Hz, sets --ipf to N/60\n");
+    fprintf(stderr, "  --turbo             run emulated frames as fast as the host allows\n");
+    fprintf(stderr, "  --core NAME         interpreter core: cached (default), switch, jit or aot\n");
+    fprintf(stderr, "                      (aot needs the rom translated in, see make AOT_ROMS=)\n");
+    fprintf(stderr, "  --quirks NAME       behaviour of the ambiguous instructions: modern (default), vip, chip48,\n");
+    fprintf(stderr, "                      schip or xochip\n");
+    fprintf(stderr, "  --verify-jit        headless: check the jit against the interpreter frame by frame\n");
+    fprintf(stderr, "  --load-state FILE   resume from a save state made with the same rom\n");
+    fprintf(stderr, "  --save-state FILE   write a save state when the run ends\n");
+    fprintf(stderr, "  --seed N            seed for the random number generator (default 1)\n");
+    fprintf(stderr, "  --record FILE       record the input into a movie\n");
+    fprintf(stderr, "  --replay FILE       headless: play a movie back as fast as possible\n");
+    fprintf(stderr, "  --seek N            with --replay: stop at the start of frame N and show the state\n");
+    fprintf(stderr, "  --lanes N           headless: run N instances in lockstep, instance i seeded with i + 1\n");
+#ifndef CHIP8_NO_DEBUGGER
+    fprintf(stderr, "  --break ADDR        show the state whenever pc reaches ADDR, may be repeated\n");
+    fprintf(stderr, "  --watch ADDR[:LEN]  show the state whenever Fx33/Fx55/Fx65 touch the range, may be repeated\n");
+#endif
+    fprintf(stderr, "  --profile PREFIX    count every instruction, write PREFIX.folded and PREFIX.txt at exit\n");
+    fprintf(stderr, "  --dump PATH         headless: write every emulated frame to PATH, - for stdout\n");
+    fprintf(stderr, "  --dump-format FMT   y4m (default), raw rgb24 or png (PATH is then a file name prefix)\n");
+    fprintf(stderr, "  --dump-scale N      pixels per chip-8 pixel in each direction (default %d)\n", DEFAULT_DUMP_SCALE);
+    fprintf(stderr, "  --dump-every N      only write every Nth frame (default 1)\n");
+    fprintf(stderr, "  --trace FILE        record every instruction into a ring file, read it with tracedump.out\n");
+    fprintf(stderr, "  --trace-records N   size of the ring in instructions (default %d)\n", TRACE_DEFAULT_RECORDS);
+    fprintf(stderr, "  --index FILE        take the profile and speed of the rom from an index written by batch.out,\n");
+    fprintf(stderr, "                      headless: run as many frames as its known-good hash and check it\n");
+}
+
+bool parse_args(options* opt, int argc, char** argv){
+    opt->filename = NULL;
+#ifdef CHIP8_HEADLESS
+    opt->headless = true;
+#else
+    opt->headless = false;
+#endif
+    opt->max_cycles = 0;
+    opt->max_frames = 0;
+    opt->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    opt->turbo = false;
+    opt->core = CORE_CACHED;
+    opt->quirks = QUIRKS_MODERN;
+    opt->verify_jit = false;
+    opt->lanes = 0;
+    opt->save_state = NULL;
+    opt->load_state = NULL;
+    opt->has_seed = false;
+    opt->seed = 1;
+    opt->record = NULL;
+    opt->replay = NULL;
+    opt->has_seek = false;
+    opt->seek = 0;
+    opt->breakpoint_count = 0;
+    opt->watch_count = 0;
+    opt->profile = NULL;
+    opt->dump = NULL;
+    opt->dump_format = SINK_Y4M;
+    opt->dump_scale = DEFAULT_DUMP_SCALE;
+    opt->dump_every = 1;
+    opt->trace = NULL;
+    opt->trace_records = TRACE_DEFAULT_RECORDS;
+    opt->has_core = false;
+    opt->has_quirks = false;
+    opt->has_ipf = false;
+    opt->index = NULL;
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(strcmp(arg, "--headless") == 0){
+            opt->headless = true;
+        }
+        else if(strcmp(arg, "--cycles") == 0 && has_value){
+            opt->max_cycles = strtoull(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--frames") == 0 && has_value){
+            opt->max_frames = strtoull(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--ipf") == 0 && has_value){
+            opt->instructions_per_frame = atoi(argv[++i]);
+            opt->has_ipf = true;
+        }
+        else if(strcmp(arg, "--hz") == 0 && has_value){
+            opt->instructions_per_frame = (atoi(argv[++i]) + 30) / 60;
+            opt->has_ipf = true;
+        }
+        else if(strcmp(arg, "--turbo") == 0){
+            opt->turbo = true;
+        }
+        else if(strcmp(arg, "--core") == 0 && has_value){
+            const char* name = argv[++i];
+            if(strcmp(name, "cached") == 0) opt->core = CORE_CACHED;
+            else if(strcmp(name, "switch") == 0) opt->core = CORE_SWITCH;
+            else if(strcmp(name, "jit") == 0) opt->core = CORE_JIT;
+            else if(strcmp(name, "aot") == 0) opt->core = CORE_AOT;
+            else return false;
+            opt->has_core = true;
+        }
+        else if(strcmp(arg, "--quirks") == 0 && has_value){
+            if(!parse_quirks(argv[++i], &opt->quirks)) return false;
+            opt->has_quirks = true;
+        }
+        else if(strcmp(arg, "--index") == 0 && has_value){
+            opt->index = argv[++i];
+        }
+        else if(strcmp(arg, "--verify-jit") == 0){
+            opt->verify_jit = true;
+            opt->headless = true;
+        }
+        else if(strcmp(arg, "--save-state") == 0 && has_value){
+            opt->save_state = argv[++i];
+        }
+        else if(strcmp(arg, "--load-state") == 0 && has_value){
+            opt->load_state = argv[++i];
+        }
+        else if(strcmp(arg, "--seed") == 0 && has_value){
+            opt->has_seed = true;
+            opt->seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--record") == 0 && has_value){
+            opt->record = argv[++i];
+        }
+        else if(strcmp(arg, "--replay") == 0 && has_value){
+            opt->replay = argv[++i];
+            opt->headless = true;
+        }
+        else if(strcmp(arg, "--seek") == 0 && has_value){
+            opt->has_seek = true;
+            opt->seek = strtoull(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--lanes") == 0 && has_value){
+            opt->lanes = atoi(argv[++i]);
+            opt->headless = true;
+            if(opt->lanes <= 0) return false;
+        }
+#ifndef CHIP8_NO_DEBUGGER
+        //without the debugger nothing would check them, so they are unknown options there
+        else if(strcmp(arg, "--break") == 0 && has_value){
+            if(opt->breakpoint_count == DEBUG_MAX_ENTRIES) return false;
+            opt->breakpoints[opt->breakpoint_count++] = strtoul(argv[++i], NULL, 0);
+        }
+        else if(strcmp(arg, "--watch") == 0 && has_value){
+            if(opt->watch_count == DEBUG_MAX_ENTRIES) return false;
+            char* end;
+            opt->watch_start[opt->watch_count] = strtoul(argv[++i], &end, 0);
+            opt->watch_length[opt->watch_count] = *end == ':' ? strtoul(end + 1, NULL, 0) : 1;
+            opt->watch_count++;
+        }
+#endif
+        else if(strcmp(arg, "--profile") == 0 && has_value){
+            opt->profile = argv[++i];
+        }
+        else if(strcmp(arg, "--dump") == 0 && has_value){
+            opt->dump = argv[++i];
+        }
+        else if(strcmp(arg, "--dump-format") == 0 && has_value){
+            const char* name = argv[++i];
+            if(strcmp(name, "y4m") == 0) opt->dump_format = SINK_Y4M;
+            else if(strcmp(name, "raw") == 0) opt->dump_format = SINK_RAW;
+            else if(strcmp(name, "png") == 0) opt->dump_format = SINK_PNG;
+            else return false;
+        }
+        else if(strcmp(arg, "--dump-scale") == 0 && has_value){
+            opt->dump_scale = atoi(argv[++i]);
+            if(opt->dump_scale < 1 || opt->dump_scale > SINK_MAX_SCALE) return false;
+        }
+        else if(strcmp(arg, "--dump-every") == 0 && has_value){
+            opt->dump_every = atoi(argv[++i]);
+            if(opt->dump_every < 1) return false;
+        }
+        else if(strcmp(arg, "--trace") == 0 && has_value){
+            opt->trace = argv[++i];
+        }
+        else if(strcmp(arg, "--trace-records") == 0 && has_value){
+            opt->trace_records = strtoull(argv[++i], NULL, 0);
+            if(opt->trace_records == 0) return false;
+        }
+        else if(arg[0] == '-' || opt->filename != NULL){
+            return false;
+        }
+        else{
+            opt->filename = arg;
+        }
     }
-    fseek(fp, 0L, SEEK_END);
-    int size = ftell(fp);
-    rewind(fp);
-    if(size > MEMORY_SIZE - LOAD_ADDRESS){
-        fprintf(stderr, "file too large!!!\n");
+    if(opt->instructions_per_frame <= 0) return false;
+    //the profiler runs its own loop, which doesn't report debugger stops
+    if(opt->profile && (opt->breakpoint_count > 0 || opt->watch_count > 0)) return false;
+    //and only the plain run and the window attach a debugger at all
+    if((opt->breakpoint_count > 0 || opt->watch_count > 0) && (opt->replay || opt->lanes > 0 || opt->verify_jit)) return false;
+    //frames are dumped by the plain headless run and by a full replay
+    if(opt->dump && (!opt->headless || opt->lanes > 0 || opt->verify_jit || opt->has_seek)) return false;
+    //one trace per chip, and the profiler bypasses run_instructions()
+    if(opt->trace && (opt->lanes > 0 || opt->verify_jit || opt->profile)) return false;
+    //only the plain run and the window record, a replay has its movie already
+    if(opt->record && (opt->replay || opt->lanes > 0 || opt->verify_jit)) return false;
+    //the replay, the jit check and the lanes run their own loops without the profiler
+    if(opt->profile && (opt->replay || opt->lanes > 0 || opt->verify_jit)) return false;
+    //save states belong to the single chip of the plain run and the window, a replay starts from its keyframes
+    if((opt->save_state || opt->load_state) && (opt->replay || opt->lanes > 0 || opt->verify_jit)) return false;
+    //the lockstep lanes are their own core and seed lane i with i + 1
+    if(opt->lanes > 0 && (opt->has_core || opt->has_seed || opt->index)) return false;
+    //and only implement the modern behaviour
+    if(opt->lanes > 0 && opt->quirks != QUIRKS_MODERN){
+        fprintf(stderr, "--lanes only supports the modern profile\n");
         return false;
     }
-    fread(c->memory + LOAD_ADDRESS, 1, size, fp);
-    fclose(fp);
-    return true;
-}
-
-uint16_t get_current_instruction(chip_8* c){
-    uint8_t hi = c->memory[c->program_counter];
-    uint8_t lo = c->memory[c->program_counter+1];
-    uint16_t full = (hi << 8) | lo;
-    return full;
+    return opt->filename != NULL;
 }
 
-uint16_t get_next_instruction(chip_8* c){
-    uint8_t hi = c->memory[c->program_counter+2];
-    uint8_t lo = c->memory[c->program_counter+3];
-    uint16_t full = (hi << 8) | lo;
-    return full;
+double seconds_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-void push(chip_8* c, uint16_t value){
-    if(c->stack_pos+1 >= STACK_SIZE-1){
-        fprintf(stderr, "stack overflow!!!");
-        return;
+void print_state(const chip_8* c){
+    if(c->faulted){
+        printf("fault: instruction 0x%04x not implemented at 0x%04x\n", c->fault_instruction, c->program_counter);
+    }
+    printf("framebuffer hash: 0x%016llx\n", (unsigned long long)framebuffer_hash(c));
+    printf("pc: 0x%04x  I: 0x%04x  sp: %d  delay: %d  sound: %d\n",
+           c->program_counter, c->address_register, c->stack_pos, c->delay_timer, c->sound_timer);
+    for(int i = 0; i < 16; i++){
+        printf("V%X=0x%02x%s", i, c->registers[i], i % 8 == 7 ? "\n" : " ");
     }
-    
-    c->stack_pos++;
-    c->stack[c->stack_pos] = value;
 }
 
-uint16_t pop(chip_8* c){
-    if(c->stack_pos == 0){
-        fprintf(stderr, "stack underflow!!!");
-        return -1;
+void select_core(chip_8* c, execution_core core){
+    c->core = core;
+    if(core == CORE_JIT && !jit_init(c)){
+        fprintf(stderr, "jit not available, using the interpreter\n");
+        c->core = CORE_CACHED;
+    }
+    if(core == CORE_AOT && !aot_init(c, aot_programs, aot_program_count)){
+        fprintf(stderr, "no translation of this rom for the %s quirks linked in, using the interpreter\n", quirks_name(c->quirks));
+        c->core = CORE_CACHED;
     }
-    uint16_t result = c->stack[c->stack_pos];
-    c->stack_pos--;
-    return result;
 }
 
-void clear_screen(chip_8* c){
-    memset(c->pixels, 0, VIRTUAL_SCREEN_HEIGHT * VIRTUAL_SCREEN_WIDTH * sizeof(c->pixels[0][0]));
-    c->program_counter += INSTRUCTION_SIZE;
+//opens --trace once the core is chosen
+bool start_trace(chip_8* c, const options* opt){
+    return opt->trace == NULL || trace_open(c, opt->trace, opt->trace_records);
 }
 
-void return_from_subroutine(chip_8* c){
-    c->program_counter = pop(c);
+void release_core(chip_8* c){
+    trace_close(c);
+    jit_free(c);
+    aot_free(c);
 }
 
-void goto_address(chip_8* c, uint16_t address){
-    c->program_counter = address;
+//reads the rom for the whole run. With --index the profile and speed recorded for it apply unless
+//given on the command line, and a headless run without a budget runs as long as its known-good hash
+bool read_rom(options* opt){
+    memset(&opt->known, 0, sizeof(opt->known));
+    if(!read_rom_file(opt->filename, opt->rom, sizeof(opt->rom), &opt->rom_size)){
+        return false;
+    }
+    if(!opt->index){
+        return true;
+    }
+    rom_index index;
+    if(!rom_index_open(&index, opt->index)){
+        return false;
+    }
+    const rom_entry* e = rom_index_find(&index, data_hash(opt->rom, opt->rom_size), opt->rom_size);
+    if(e){
+        opt->known = *e;
+    }
+    rom_index_close(&index);
+    if(!e){
+        fprintf(stderr, "rom not in the index\n");
+        return true;
+    }
+    const rom_entry* known = &opt->known;
+    if(known->quirks >= QUIRKS_COUNT || known->instructions_per_frame == 0 || known->instructions_per_frame > INT32_MAX){
+        fprintf(stderr, "bad index entry\n");
+        return false;
+    }
+    if(!opt->has_quirks){
+        opt->quirks = known->quirks;
+    }
+    if(!opt->has_ipf){
+        opt->instructions_per_frame = known->instructions_per_frame;
+    }
+    if((known->flags & ROM_ENTRY_CHECKED) && opt->max_cycles == 0 && opt->max_frames == 0){
+        opt->max_frames = known->frames;
+    }
+    return true;
 }
 
-void call_subroutine(chip_8* c, uint16_t address){
-    push(c, c->program_counter + INSTRUCTION_SIZE);
-    goto_address(c, address);
+//the profile is fixed for the whole run, the cores are set up for it after loading
+bool load_rom(chip_8* c, const options* opt){
+    c->quirks = opt->quirks;
+    return load_program_data(c, opt->rom, opt->rom_size);
 }
 
-void skip_equal(chip_8* c, uint8_t reg, uint8_t val){
-    if(c->registers[reg] == val){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
+//loads the rom, keeps the freshly loaded memory as the save state baseline and resumes
+//from --load-state if given
+bool start_program(chip_8* c, debugger* d, uint8_t* baseline, const options* opt){
+    if(!load_rom(c, opt)){
+        return false;
     }
-    else{
-        c->program_counter += INSTRUCTION_SIZE;
+    memcpy(baseline, c->memory, memory_size(c));
+    if(opt->has_seed){
+        seed_random(c, opt->seed);
     }
+    select_core(c, opt->core);
+    if(!start_trace(c, opt)){
+        return false;
+    }
+    return opt->load_state == NULL || load_state_file(c, d, baseline, opt->load_state);
 }
 
-void skip_not_equal(chip_8* c, uint8_t reg, uint8_t val){
-    if(c->registers[reg] != val){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
-    }
-    else{
-        c->program_counter += INSTRUCTION_SIZE;
-    }
+bool wants_debugger(const options* opt){
+    return opt->breakpoint_count > 0 || opt->watch_count > 0;
 }
 
-void skip_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
-    if(c->registers[reg1] == c->registers[reg2]){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
+bool setup_debugger(debugger* d, chip_8* c, const options* opt){
+    init_debugger(d, c);
+    for(int i = 0; i < opt->breakpoint_count; i++){
+        if(!add_breakpoint(d, opt->breakpoints[i])){
+            fprintf(stderr, "bad breakpoint 0x%04x\n", opt->breakpoints[i]);
+            return false;
+        }
     }
-    else{
-        c->program_counter += INSTRUCTION_SIZE;
+    for(int i = 0; i < opt->watch_count; i++){
+        if(!add_watchpoint(d, opt->watch_start[i], opt->watch_length[i], WATCH_READ | WATCH_WRITE)){
+            fprintf(stderr, "bad watchpoint 0x%04x:%d\n", opt->watch_start[i], opt->watch_length[i]);
+            return false;
+        }
     }
+    return true;
 }
 
-void load_imm(chip_8* c, uint8_t reg, uint8_t val){
-    c->registers[reg] = val;
-    c->program_counter += INSTRUCTION_SIZE;
-}
-
-void add_imm(chip_8* c, uint8_t reg, uint8_t val){
-    c->registers[reg] += val;
-    c->program_counter += INSTRUCTION_SIZE;
+//runs count instructions, showing the state at every debugger stop on the way
+bool debug_instructions(debugger* d, uint64_t count){
+    chip_8* c = d->chip;
+    const uint64_t end = c->cycles + count;
+    bool drew = false;
+    while(c->cycles < end && !c->faulted){
+        drew |= debug_run(d, end - c->cycles);
+        if(d->event == DEBUG_NONE) break;
+        print_debug_event(d);
+    }
+    return drew;
 }
 
-void mov(chip_8* c, uint8_t reg1, uint8_t reg2){
-    c->registers[reg1] = c->registers[reg2];
-    c->program_counter += INSTRUCTION_SIZE;
+//run_frame() through the debugger
+bool debug_frame(debugger* d, int instructions_per_frame){
+    if(d->chip->faulted){
+        return false;
+    }
+    bool drew = debug_instructions(d, instructions_per_frame);
+    tick_timers(d->chip);
+    return drew;
 }
 
-void bit_or(chip_8* c, uint8_t reg1, uint8_t reg2){
-    c->registers[reg1] |= c->registers[reg2];
-    c->program_counter += INSTRUCTION_SIZE;
+//run_instructions() through the profiler or the debugger when one is in use
+bool emulate_instructions(chip_8* c, profiler* prof, uint64_t count){
+    if(prof){
+        return profile_run_instructions(prof, c, count);
+    }
+    if(c->debug){
+        return debug_instructions(c->debug, count);
+    }
+    return run_instructions(c, count);
 }
 
-void bit_and(chip_8* c, uint8_t reg1, uint8_t reg2){
-    c->registers[reg1] &= c->registers[reg2];
-    c->program_counter += INSTRUCTION_SIZE;
+//run_frame() likewise
+bool emulate_frame(chip_8* c, profiler* prof, int instructions_per_frame){
+    if(prof){
+        return profile_run_frame(prof, c, instructions_per_frame);
+    }
+    if(c->debug){
+        return debug_frame(c->debug, instructions_per_frame);
+    }
+    return run_frame(c, instructions_per_frame);
 }
 
-void bit_xor(chip_8* c, uint8_t reg1, uint8_t reg2){
-    c->registers[reg1] ^= c->registers[reg2];
-    c->program_counter += INSTRUCTION_SIZE;
+profiler* start_profile(const options* opt){
+    if(!opt->profile){
+        return NULL;
+    }
+    profiler* prof = malloc(sizeof(profiler));
+    if(!prof || !profile_init(prof)){
+        fprintf(stderr, "out of memory\n");
+        free(prof);
+        return NULL;
+    }
+    return prof;
 }
 
-void add_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
-    int a = c->registers[reg1];
-    int b = c->registers[reg2];
-    int res = a + b;
-    c->registers[VF] = res > 0xff;
-    c->registers[reg1] = res & 0xff;
-    c->program_counter += INSTRUCTION_SIZE;
+bool finish_profile(profiler* prof, const chip_8* c, const options* opt){
+    if(!prof){
+        return true;
+    }
+    bool ok = profile_write(prof, c, opt->profile);
+    profile_free(prof);
+    free(prof);
+    return ok;
 }
 
-void sub_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
-    int a = c->registers[reg1];
-    int b = c->registers[reg2];
-    int res = a - b;
-    c->registers[VF] = res >= 0;
-    c->registers[reg1] = res & 0xff;
-    c->program_counter += INSTRUCTION_SIZE;
+//NULL without --dump or when the output can't be opened. quirks is the profile the run uses
+frame_sink* start_dump(frame_sink* sink, const options* opt, uint8_t quirks){
+    if(!opt->dump){
+        return NULL;
+    }
+    bool extended = quirk_flags[quirks] & QUIRK_HIRES;
+    return frame_sink_open(sink, opt->dump_format, opt->dump, opt->dump_scale, opt->dump_every, extended) ? sink : NULL;
 }
 
-void shift_right(chip_8* c, uint8_t reg){
-    c->registers[VF] = (c->registers[reg]) & 1;
-    (c->registers[reg]) >>= 1;
-    c->program_counter += INSTRUCTION_SIZE;
+bool finish_dump(frame_sink* sink){
+    if(!sink){
+        return true;
+    }
+    printf("frames dumped: %llu, %llu repeating the previous one\n", (unsigned long long)sink->written,
+           (unsigned long long)sink->repeats);
+    return frame_sink_close(sink);
 }
 
-void sub_reg_switch(chip_8* c, uint8_t reg1, uint8_t reg2){
-    int a = c->registers[reg1];
-    int b = c->registers[reg2];
-    int res = b - a;
-    c->registers[VF] = res >= 0;
-    c->registers[reg1] = res & 0xff;
-    c->program_counter += INSTRUCTION_SIZE;
+uint64_t headless_frames(const options* opt){
+    return opt->max_frames != 0 ? opt->max_frames : DEFAULT_HEADLESS_FRAMES;
 }
 
+//runs the rom once on the interpreter and once on the jit, both from the same random seed,
+//and reports the first frame after which their states differ
+int verify_jit(const options* opt){
+    const uint64_t frames = headless_frames(opt);
+    const int ipf = opt->instructions_per_frame;
+    uint64_t* expected = malloc(frames * sizeof(uint64_t));
+    chip_8* chips = malloc(2 * sizeof(chip_8));
+    int result = 1;
+    if(!expected || !chips){
+        fprintf(stderr, "out of memory\n");
+        goto cleanup_memory;
+    }
+    chip_8* interpreter = &chips[0];
+    chip_8* jit = &chips[1];
+    init_chip_8(interpreter);
+    init_chip_8(jit);
+    if(!load_rom(interpreter, opt) || !load_rom(jit, opt)){
+        goto cleanup_jit;
+    }
+    if(!jit_init(jit)){
+        fprintf(stderr, "jit not available\n");
+        goto cleanup_jit;
+    }
 
-void shift_left(chip_8* c, uint8_t reg){
-    c->registers[VF] = ((c->registers[reg]) >> 7) & 1;
-    (c->registers[reg]) <<= 1;
-    c->program_counter += INSTRUCTION_SIZE;
-}
-
+    for(uint64_t f = 0; f < frames; f++){
+        run_frame(interpreter, ipf);
+        expected[f] = state_hash(interpreter);
+    }
+    uint64_t f = 0;
+    for(; f < frames; f++){
+        run_frame(jit, ipf);
+        if(state_hash(jit) != expected[f]) break;
+    }
 
-void skip_not_equal_reg(chip_8* c, uint8_t reg1, uint8_t reg2){
-    if(c->registers[reg1] != c->registers[reg2]){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
+    result = 0;
+    if(f == frames){
+        printf("jit matches the interpreter for %llu frames\n", (unsigned long long)frames);
     }
     else{
-        c->program_counter += INSTRUCTION_SIZE;
+        //replay the interpreter up to the bad frame so both states can be shown
+        init_chip_8(interpreter);
+        load_rom(interpreter, opt);
+        for(uint64_t i = 0; i <= f; i++){
+            run_frame(interpreter, ipf);
+        }
+        printf("jit diverges from the interpreter after frame %llu\n", (unsigned long long)f);
+        printf("interpreter:\n");
+        print_state(interpreter);
+        printf("jit:\n");
+        print_state(jit);
+        result = 1;
     }
+    cleanup_jit:
+    jit_free(jit);
+    cleanup_memory:
+    free(chips);
+    free(expected);
+    return result;
 }
 
-void set_address_reg(chip_8* c, uint16_t val){
-    c->address_register = val;
-    c->program_counter += INSTRUCTION_SIZE;
+uint64_t headless_cycles(const options* opt){
+    uint64_t max_cycles = opt->max_cycles;
+    if(opt->max_frames != 0){
+        uint64_t frame_cycles = opt->max_frames * opt->instructions_per_frame;
+        if(max_cycles == 0 || frame_cycles < max_cycles) max_cycles = frame_cycles;
+    }
+    if(max_cycles == 0){
+        max_cycles = (uint64_t)DEFAULT_HEADLESS_FRAMES * opt->instructions_per_frame;
+    }
+    return max_cycles;
 }
 
+//same budget as run_headless() for every lane, prints lane 0 and the combined speed
+int run_lockstep(const options* opt){
+    lockstep ls;
+    if(!lockstep_init(&ls, opt->lanes)){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if(!lockstep_load_program(&ls, opt->filename)){
+        lockstep_free(&ls);
+        return 1;
+    }
+    for(int i = 0; i < opt->lanes; i++){
+        lockstep_seed(&ls, i, i + 1);
+    }
+    const uint64_t max_cycles = headless_cycles(opt);
+    const int ipf = opt->instructions_per_frame;
+    double start = seconds_now();
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    //like the single chip, stops once there is nothing left to run
+    while(max_cycles - cycles >= (uint64_t)ipf && lockstep_faulted_lanes(&ls) < opt->lanes){
+        lockstep_run_frame(&ls, ipf);
+        cycles += ipf;
+        frames++;
+    }
+    lockstep_run_instructions(&ls, max_cycles - cycles);
+    double elapsed = seconds_now() - start;
 
-void goto_address_plus_V0(chip_8* c, uint16_t address){
-    c->program_counter = address + c->registers[0];
+    chip_8 chip;
+    lockstep_get_lane(&ls, 0, &chip);
+    printf("lanes: %d\n", opt->lanes);
+    printf("cycles: %llu\n", (unsigned long long)chip.cycles);
+    printf("frames: %llu\n", (unsigned long long)frames);
+    print_state(&chip);
+    int faulted = lockstep_faulted_lanes(&ls);
+    if(faulted > 0){
+        printf("faulted lanes: %d\n", faulted);
+    }
+    //what the lanes executed, faulted lanes stop adding to it
+    printf("instructions per second (all lanes): %.0f\n", elapsed > 0 ? lockstep_cycles(&ls) / elapsed : 0.0);
+    lockstep_free(&ls);
+    return 0;
 }
 
-void rand_mod(chip_8* c, uint8_t reg, uint8_t m){
-    c->registers[reg] = rand() & m;
-    c->program_counter += INSTRUCTION_SIZE;
-}
+//plays the whole movie, or seeks to --seek, and prints the final state
+int run_replay(const options* opt){
+    movie_player player;
+    if(!movie_open(&player, opt->replay)){
+        return 1;
+    }
+    //the movie's keyframes only load into the profile it was recorded with
+    if(opt->has_quirks && opt->quirks != player.quirks){
+        fprintf(stderr, "movie was recorded with the %s quirks, not %s\n", quirks_name(player.quirks), quirks_name(opt->quirks));
+        movie_close(&player);
+        return 1;
+    }
+    chip_8 chip;
+    uint8_t baseline[EXTENDED_MEMORY_SIZE];
+    init_chip_8(&chip);
+    chip.quirks = player.quirks;
+    if(!load_program_data(&chip, opt->rom, opt->rom_size)){
+        movie_close(&player);
+        return 1;
+    }
+    memcpy(baseline, chip.memory, memory_size(&chip));
+    select_core(&chip, opt->core);
+    if(!start_trace(&chip, opt)){
+        release_core(&chip);
+        movie_close(&player);
+        return 1;
+    }
+    frame_sink dump;
+    frame_sink* sink = start_dump(&dump, opt, chip.quirks);
+    if(opt->dump && !sink){
+        release_core(&chip);
+        movie_close(&player);
+        return 1;
+    }
 
-void draw_sprite(chip_8* c, uint8_t reg1, uint8_t reg2, uint8_t n){
-    int x_start = c->registers[reg1];
-    int y_start = c->registers[reg2];
-    c->registers[VF] = 0;
-    for(int y = 0; y < n; y++){
-        for(int x = 0; x < 8; x++){
-            int y_pos = (y_start + y) % VIRTUAL_SCREEN_HEIGHT;
-            int x_pos = (x_start + x) % VIRTUAL_SCREEN_WIDTH;
-            uint32_t old_color = c->pixels[y_pos][x_pos];
-            uint8_t bit_value = ((c->memory[c->address_register + y]) >> (7-x)) & 1;
-            uint32_t draw_color = bit_value ? SCREEN_COLOR : 0;
-            uint32_t new_color = old_color ^ draw_color;
-            if(old_color != 0 && draw_color != 0){
-                c->registers[VF] = 1; //collision
+    double start = seconds_now();
+    bool ok = movie_seek(&player, &chip, baseline, opt->has_seek ? opt->seek : 0);
+    uint64_t start_cycles = chip.cycles;
+    if(ok && !opt->has_seek){
+        while(movie_play_frame(&player, &chip)){
+            if(sink && !frame_sink_frame(sink, &chip)){
+                ok = false;
+                break;
             }
-            c->pixels[y_pos][x_pos] = new_color;
         }
     }
-    c->program_counter += INSTRUCTION_SIZE;
-}
+    double elapsed = seconds_now() - start;
 
-void skip_if_key_pressed(chip_8* c, uint8_t reg){
-    if(c->keys[c->registers[reg]] == 1){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
-    }
-    else{
-        c->program_counter += INSTRUCTION_SIZE;
+    if(ok){
+        printf("frame: %llu of %llu\n", (unsigned long long)player.frame, (unsigned long long)player.frame_count);
+        printf("cycles: %llu\n", (unsigned long long)chip.cycles);
+        print_state(&chip);
+        if(opt->has_seek){
+            printf("seek time: %.6f s\n", elapsed);
+        }
+        else{
+            printf("instructions per second: %.0f\n", elapsed > 0 ? (chip.cycles - start_cycles) / elapsed : 0.0);
+        }
     }
+    ok = finish_dump(sink) && ok;
+    release_core(&chip);
+    movie_close(&player);
+    return ok ? 0 : 1;
 }
 
-void skip_if_key_not_pressed(chip_8* c, uint8_t reg){
-    if(c->keys[c->registers[reg]] == 0){
-        c->program_counter += 2 * INSTRUCTION_SIZE;
+//compares against the known-good hash when the run went the same way as the indexed one
+void print_index_check(const chip_8* c, const options* opt, uint64_t frames){
+    const rom_entry* known = &opt->known;
+    //the indexed run started fresh with the default seed
+    bool same_run = (known->flags & ROM_ENTRY_CHECKED) && opt->quirks == known->quirks
+                    && opt->instructions_per_frame == (int)known->instructions_per_frame
+                    && opt->load_state == NULL && (!opt->has_seed || opt->seed == 1);
+    if(!same_run){
+        return;
+    }
+    if(c->faulted && frames < known->frames){
+        printf("index: faulted, the indexed run didn't\n");
+    }
+    else if(c->faulted || frames != known->frames || c->cycles != frames * opt->instructions_per_frame){
+        return;
+    }
+    else if(framebuffer_hash(c) == known->framebuffer_hash){
+        printf("index: framebuffer hash matches\n");
     }
     else{
-        c->program_counter += INSTRUCTION_SIZE;
+        printf("index: framebuffer hash differs from 0x%016llx\n", (unsigned long long)known->framebuffer_hash);
     }
 }
 
-void get_delay(chip_8* c, uint8_t reg){
-    c->registers[reg] = c->delay_timer;
-    c->program_counter += INSTRUCTION_SIZE;
+//one emulated frame, logged to the movie first when recording
+bool play_frame(chip_8* c, const options* opt, movie_recorder* recorder, profiler* prof){
+    if(recorder){
+        movie_record_frame(recorder, c);
+    }
+    return emulate_frame(c, prof, opt->instructions_per_frame);
 }
 
-void wait_for_key(chip_8* c, uint8_t reg){
-    c->waiting_for_key = true;
-    c->key_target_reg = reg;
-    c->program_counter += INSTRUCTION_SIZE;
-}
+//runs flat out, timers are ticked once every instructions_per_frame cycles
+int run_headless(const options* opt){
+    if(opt->replay){
+        return run_replay(opt);
+    }
+    if(opt->verify_jit){
+        return verify_jit(opt);
+    }
+    if(opt->lanes > 0){
+        return run_lockstep(opt);
+    }
+    chip_8 chip;
+    uint8_t baseline[EXTENDED_MEMORY_SIZE];
+    init_chip_8(&chip);
+    debugger debug;
+    debugger* d = NULL;
+    if(wants_debugger(opt)){
+        if(!setup_debugger(&debug, &chip, opt)){
+            return 1;
+        }
+        d = &debug;
+    }
+    if(!start_program(&chip, d, baseline, opt)){
+        release_core(&chip);
+        return 1;
+    }
+    profiler* prof = start_profile(opt);
+    if(opt->profile && !prof){
+        release_core(&chip);
+        return 1;
+    }
+    frame_sink dump;
+    frame_sink* sink = start_dump(&dump, opt, chip.quirks);
+    if(opt->dump && !sink){
+        finish_profile(prof, &chip, opt);
+        release_core(&chip);
+        return 1;
+    }
+    movie_recorder movie;
+    movie_recorder* recorder = NULL;
+    if(opt->record){
+        if(!movie_record_start(&movie, opt->record, baseline, opt->instructions_per_frame, chip.quirks)){
+            finish_dump(sink);
+            finish_profile(prof, &chip, opt);
+            release_core(&chip);
+            return 1;
+        }
+        recorder = &movie;
+    }
+    //the budget counts from here, a loaded state already has cycles on it
+    const uint64_t end_cycles = chip.cycles + headless_cycles(opt);
 
-void key_event(chip_8* c, uint8_t key){
-    c->registers[c->key_target_reg] = key;
-    c->waiting_for_key = false;
-}
+    const int ipf = opt->instructions_per_frame;
+    const uint64_t start_cycles = chip.cycles;
+    double start = seconds_now();
+    uint64_t frames = 0;
+    bool dumped = true;
+    while(end_cycles - chip.cycles >= (uint64_t)ipf && !chip.faulted && dumped){
+        play_frame(&chip, opt, recorder, prof);
+        frames++;
+        dumped = sink == NULL || frame_sink_frame(sink, &chip);
+    }
+    emulate_instructions(&chip, prof, end_cycles - chip.cycles);
+    double elapsed = seconds_now() - start;
 
-void set_delay(chip_8* c, uint8_t reg){
-    c->delay_timer = c->registers[reg];
-    c->program_counter += INSTRUCTION_SIZE;
+    printf("cycles: %llu\n", (unsigned long long)(chip.cycles - start_cycles));
+    printf("frames: %llu\n", (unsigned long long)frames);
+    print_state(&chip);
+    printf("instructions per second: %.0f\n", elapsed > 0 ? (chip.cycles - start_cycles) / elapsed : 0.0);
+    printf("idle loop instructions skipped: %llu\n", (unsigned long long)chip.idle_cycles);
+    print_index_check(&chip, opt, frames);
+    bool saved = opt->save_state == NULL || save_state_file(&chip, d, baseline, opt->save_state);
+    //movies hold whole frames, the instructions left over after the last one aren't in it
+    saved = (recorder == NULL || movie_record_finish(recorder)) && saved;
+    saved = finish_profile(prof, &chip, opt) && saved;
+    dumped = finish_dump(sink) && dumped;
+    release_core(&chip);
+    return chip.faulted || !saved || !dumped ? 1 : 0;
 }
 
-void set_sound(chip_8* c, uint8_t reg){
-    c->sound_timer = c->registers[reg];
-    c->program_counter += INSTRUCTION_SIZE;
-}
+#ifndef CHIP8_HEADLESS
 
-void add_address_reg(chip_8* c, uint8_t reg){
-    c->address_register += c->registers[reg];
-    c->program_counter += INSTRUCTION_SIZE;
-}
+//host keys for every chip-8 key, a chip-8 key is down while any of its host keys is
+static const struct{
+    int scancode;
+    uint8_t key;
+}keymap[] = {
+    {SDL_SCANCODE_X, 0x0}, {SDL_SCANCODE_1, 0x1}, {SDL_SCANCODE_2, 0x2}, {SDL_SCANCODE_UP, 0x2},
+    {SDL_SCANCODE_3, 0x3}, {SDL_SCANCODE_4, 0xc}, {SDL_SCANCODE_Q, 0x4}, {SDL_SCANCODE_LEFT, 0x4},
+    {SDL_SCANCODE_W, 0x5}, {SDL_SCANCODE_E, 0x6}, {SDL_SCANCODE_RIGHT, 0x6}, {SDL_SCANCODE_R, 0xd},
+    {SDL_SCANCODE_A, 0x7}, {SDL_SCANCODE_S, 0x8}, {SDL_SCANCODE_DOWN, 0x8}, {SDL_SCANCODE_D, 0x9},
+    {SDL_SCANCODE_F, 0xe}, {SDL_SCANCODE_Z, 0xa}, {SDL_SCANCODE_C, 0xb}, {SDL_SCANCODE_V, 0xf}
+};
+#define KEYMAP_SIZE (int)(sizeof(keymap) / sizeof(keymap[0]))
 
-void set_font_char(chip_8* c, uint8_t reg){
-    c->address_register = FONTSET_MEMORY_OFFSET + c->registers[reg] * 5;
-    c->program_counter += INSTRUCTION_SIZE;
-}
+#define AUDIO_RATE 48000
+#define AUDIO_BUFFER_SAMPLES 256 //about 5ms at AUDIO_RATE
+#define BEEP_HZ 440
+#define BEEP_AMPLITUDE 4000
 
-void set_bcd(chip_8* c, uint8_t reg){
-    int num = c->registers[reg];
-    int ones = num % 10;
-    int tens = (num / 10) % 10;
-    int huns = (num / 100) % 10;
-    c->memory[c->address_register + 0] = huns & 0xff;
-    c->memory[c->address_register + 1] = tens & 0xff;
-    c->memory[c->address_register + 2] = ones & 0xff;
-    c->program_counter += INSTRUCTION_SIZE;
-}
+//square wave made in the audio callback itself, the emulation thread only flips on. Nothing is
+//queued between the two, so a beep starts and stops one device buffer after the sound timer does
+typedef struct{
+    atomic_bool on;
+    uint16_t phase; //a full period is 65536
+    uint16_t step;
+}beeper;
 
-void reg_dump(chip_8* c, uint8_t reg){
-    for(int i = 0; i <= reg; i++){
-        c->memory[c->address_register + i] = c->registers[i];
+static void beeper_callback(void* data, Uint8* stream, int length){
+    beeper* b = data;
+    int16_t* out = (int16_t*)stream;
+    const int count = length / (int)sizeof(int16_t);
+    if(!atomic_load_explicit(&b->on, memory_order_relaxed)){
+        memset(stream, 0, length);
+        return;
     }
-    c->program_counter += INSTRUCTION_SIZE;
-}
-
-void reg_load(chip_8* c, uint8_t reg){
-    for(int i = 0; i <= reg; i++){
-        c->registers[i] = c->memory[c->address_register + i];
+    for(int i = 0; i < count; i++){
+        out[i] = b->phase & 0x8000 ? BEEP_AMPLITUDE : -BEEP_AMPLITUDE;
+        b->phase += b->step;
     }
-    c->program_counter += INSTRUCTION_SIZE;
 }
 
-void not_implemented(chip_8* c, uint16_t instruction){
-    fprintf(stderr, "INSTRUCTION, NOT IMPLEMENTED!!! 0x%04x\n", instruction);
-    exit(1);
-}
-void debug_decode(uint16_t instr){
-    uint16_t full = instr;
-    uint8_t hi = instr >> 8;
-    uint8_t lo = instr & 0xff;
-    switch(hi >> 4){
-        case 0x0:
-            if(full == 0x00E0){
-                printf("clear_screen");
-            }
-            else if(full == 0x00EE){
-                printf("return_from_subroutine");
-            }
-            else{
-                printf("not_implemented");
-            }
-            break;
-        case 0x1:
-            printf("goto_address 0x%04x", full & 0xfff);
-            break;
-        case 0x2:
-            printf("call_subroutine 0x%04x", full & 0xfff);
-            break;
-        case 0x3:
-            printf("skip_equal 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0x4:
-            printf("skip_not_equal 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0x5:
-            printf("skip_equal_reg 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0x6:
-            printf("load_imm 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0x7:
-            printf("add_imm 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0x8:
-            if((lo & 0xf) == 0){
-                printf("mov 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 1){
-                printf("bit_or 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 2){
-                printf("bit_and 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 3){
-                printf("bit_xor 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 4){
-                printf("add_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 5){
-                printf("sub_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 6){
-                printf("shift_right 0x%02x", hi & 0xf);
-            }
-            else if((lo & 0xf) == 7){
-                printf("sub_reg_switch 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 0xe){
-                printf("shift_left 0x%02x", hi & 0xf);
-            }
-            else{
-                printf("not_implemented");
-            }
-            break;
-        case 0x9:
-            printf("skip_not_equal_reg 0x%02x 0x%02x", hi & 0xf, lo >> 4);
-            break;
-        case 0xa:
-            printf("set_address_reg 0x%04x", full & 0xfff);
-            break;
-        case 0xb:
-            printf("goto_address_plus_V0 0x%04x", full & 0xfff);
-            break;
-        case 0xc:
-            printf("rand_mod 0x%02x 0x%02x", hi & 0xf, lo);
-            break;
-        case 0xd:
-            printf("draw_sprite 0x%02x 0x%02x 0x%02x", hi & 0xf, lo >> 4, lo & 0xf);
-            break;
-        case 0xe:
-            if(lo == 0x9e){
-                printf("skip_if_key_pressed 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0xa1){
-                printf("skip_if_key_not_pressed 0x%02x", hi & 0xf);
-            }
-            else{
-                printf("not_implemented");
-            }
-            break;
-        case 0xf:
-            if(lo == 0x07){
-                printf("get_delay 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x0a){
-                printf("wait_for_key 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x15){
-                printf("set_delay 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x18){
-                printf("set_sound 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x1e){
-                printf("add_address_reg 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x29){
-                printf("set_font_char 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x33){
-                printf("set_bcd 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x55){
-                printf("reg_dump 0x%02x", hi & 0xf);
-            }
-            else if(lo == 0x65){
-                printf("reg_load 0x%02x", hi & 0xf);
-            }
-            else{
-                printf("not_implemented");
-            }
-            break;
-        default:
-            printf("not_implemented");
+//0 if there is no audio device, the emulator runs silently then
+static SDL_AudioDeviceID open_beeper(beeper* b){
+    atomic_init(&b->on, false);
+    b->phase = 0;
+    b->step = 0;
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+    memset(&want, 0, sizeof(want));
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER_SAMPLES;
+    want.callback = beeper_callback;
+    want.userdata = b;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if(device == 0){
+        fprintf(stderr, "no audio: %s\n", SDL_GetError());
+        return 0;
     }
+    b->step = (uint16_t)(BEEP_HZ * 65536 / have.freq);
+    SDL_PauseAudioDevice(device, 0);
+    return device;
 }
 
+//the chip is only touched by the emulation thread until it has been joined. The window thread
+//sends key changes through keys and shows whatever frames shows as newest
+typedef struct{
+    chip_8* chip;
+    const options* opt;
+    movie_recorder* recorder;
+    profiler* prof;
+    frame_exchange frames;
+    key_ring keys;
+    SDL_sem* wake; //posted after key events and on quit, wakes a chip parked in Fx0A
+    Uint32 frame_event; //pushed to the window when a frame is waiting and none was before
+    beeper beep;
+    atomic_bool quit;
+    //emulation thread's costs, read after the join
+    uint64_t emulated_frames;
+    uint64_t emulate_ticks;
+    uint64_t published_frames;
+    uint64_t dropped_frames;
+}emulation;
 
-int step(chip_8* c){
-    bool continue_exec = false;
-    if(c->waiting_for_key){
-        for(int i = 0; i < 16; i++){
-            if(c->keys[i] != 0){
-                key_event(c, i);
-                continue_exec = true;
-                break;
-            }
-        }
-    }
-    else{
-        continue_exec = true;
-    }
-    if(!continue_exec) return 1;
-    uint8_t hi = c->memory[c->program_counter];
-    uint8_t lo = c->memory[c->program_counter+1];
-    uint16_t full = (hi << 8) | lo;
-    switch(hi >> 4){
-        case 0x0:
-            if(full == 0x00E0){
-                clear_screen(c);
-            }
-            else if(full == 0x00EE){
-                return_from_subroutine(c);
-            }
-            else{
-                not_implemented(c, full);
-            }
-            break;
-        case 0x1:
-            goto_address(c, full & 0xfff);
-            break;
-        case 0x2:
-            call_subroutine(c, full & 0xfff);
-            break;
-        case 0x3:
-            skip_equal(c, hi & 0xf, lo);
-            break;
-        case 0x4:
-            skip_not_equal(c, hi & 0xf, lo);
-            break;
-        case 0x5:
-            skip_equal_reg(c, hi & 0xf, lo >> 4);
-            break;
-        case 0x6:
-            load_imm(c, hi & 0xf, lo);
-            break;
-        case 0x7:
-            add_imm(c, hi & 0xf, lo);
-            break;
-        case 0x8:
-            if((lo & 0xf) == 0){
-                mov(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 1){
-                bit_or(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 2){
-                bit_and(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 3){
-                bit_xor(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 4){
-                add_reg(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 5){
-                sub_reg(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 6){
-                shift_right(c, hi & 0xf);
-            }
-            else if((lo & 0xf) == 7){
-                sub_reg_switch(c, hi & 0xf, lo >> 4);
-            }
-            else if((lo & 0xf) == 0xe){
-                shift_left(c, hi & 0xf);
-            }
-            else{
-                not_implemented(c, full);
-            }
-            break;
-        case 0x9:
-            skip_not_equal_reg(c, hi & 0xf, lo >> 4);
-            break;
-        case 0xa:
-            set_address_reg(c, full & 0xfff);
-            break;
-        case 0xb:
-            goto_address_plus_V0(c, full & 0xfff);
-            break;
-        case 0xc:
-            rand_mod(c, hi & 0xf, lo);
-            break;
-        case 0xd:
-            draw_sprite(c, hi & 0xf, lo >> 4, lo & 0xf);
-            return 2;
-            break;
-        case 0xe:
-            if(lo == 0x9e){
-                skip_if_key_pressed(c, hi & 0xf);
-            }
-            else if(lo == 0xa1){
-                skip_if_key_not_pressed(c, hi & 0xf);
-            }
-            else{
-                not_implemented(c, full);
-            }
-            break;
-        case 0xf:
-            if(lo == 0x07){
-                get_delay(c, hi & 0xf);
-            }
-            else if(lo == 0x0a){
-                wait_for_key(c, hi & 0xf);
-            }
-            else if(lo == 0x15){
-                set_delay(c, hi & 0xf);
-            }
-            else if(lo == 0x18){
-                set_sound(c, hi & 0xf);
-            }
-            else if(lo == 0x1e){
-                add_address_reg(c, hi & 0xf);
-            }
-            else if(lo == 0x29){
-                set_font_char(c, hi & 0xf);
-            }
-            else if(lo == 0x33){
-                set_bcd(c, hi & 0xf);
-            }
-            else if(lo == 0x55){
-                reg_dump(c, hi & 0xf);
-            }
-            else if(lo == 0x65){
-                reg_load(c, hi & 0xf);
-            }
-            else{
-                not_implemented(c, full);
-            }
-            break;
-        default:
-            not_implemented(c, full);
+static void publish_frame(emulation* e){
+    published_frame* f = frame_exchange_back(&e->frames);
+    memcpy(f->display, e->chip->display, sizeof(f->display));
+    f->hires = e->chip->hires;
+    f->frame = e->emulated_frames;
+    e->published_frames++;
+    if(frame_exchange_publish(&e->frames)){
+        e->dropped_frames++; //the window hasn't taken the previous one, its event is still queued
+        return;
     }
-    return 0;
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = e->frame_event;
+    SDL_PushEvent(&event);
 }
 
-void print_debug(chip_8* c){
-    printf("registers:\n");
-    for(int i = 0; i < 16; i++){
-        if(i % 4 == 0 && i != 0){
-            printf("\n");
-        }
-        printf("reg %02x: 0x%02x  ", i, c->registers[i]);
-    }
-    printf("\n");
-    printf("address register: 0x%04x\n", c->address_register);
-    printf("mem at address register:\n");
-    for(int i = 0; i < 3; i++){
-        printf("0x%02x ", c->memory[c->address_register + i]);
+//applies queued key changes up to the first one that would undo a change made in this batch,
+//so a press and release that arrive within one frame are still seen by the program
+static void apply_keys(emulation* e, int* held_key, bool* held_pressed){
+    bool changed[16] = {false};
+    int key;
+    bool pressed;
+    if(*held_key >= 0){
+        e->chip->keys[*held_key] = *held_pressed;
+        changed[*held_key] = true;
+        *held_key = -1;
     }
-    printf("\n");
-    printf("program counter: 0x%04x\n", c->program_counter);
-    printf("next instructions:\n");
-    for(int i = 0; i < 16; i++){
-        uint8_t hi = c->memory[c->program_counter + 2*i];
-        uint8_t lo = c->memory[c->program_counter + 2*i+1];
-        uint16_t full = (hi << 8) | lo;
-        printf("0x%04x ", full);
-    }
-    printf("\n");
-    uint8_t hi = c->memory[c->program_counter];
-    uint8_t lo = c->memory[c->program_counter + 1];
-    uint16_t full = (hi << 8) | lo;
-    debug_decode(full);
-    printf("\nkeys:\n");
-    for(int i = 0; i < 16; i++){
-        printf("key %02d: %d  ", i, c->keys[i]);
+    while(key_ring_pop(&e->keys, &key, &pressed)){
+        if(changed[key]){
+            *held_key = key;
+            *held_pressed = pressed;
+            return;
+        }
+        e->chip->keys[key] = pressed;
+        changed[key] = true;
     }
-    printf("\n");
-    printf("stack pos: %d\n", c->stack_pos);
-    printf("waiting for key: %d\n", c->waiting_for_key);
-    printf("\n\n");
 }
 
-typedef struct{
-    chip_8* chip;
-    uint16_t previous_instruction;
-    uint16_t current_instruction;
-    uint16_t next_instruction;
-    uint16_t breakpoints[10];
-    uint16_t no_breakpoints;
-    uint16_t break_instructions[10];
-    uint16_t no_break_instructions;
-    uint16_t break_address_reg[10];
-    uint16_t no_break_addres_regs;
-}debugger;
+//runs the chip at 60 frames per second on its own clock, independent of how long presenting takes
+int emulation_main(void* data){
+    emulation* e = data;
+    chip_8* c = e->chip;
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t frame_ticks = frequency / 60;
+    uint64_t published_hash = framebuffer_hash(c);
+    publish_frame(e);
 
-void init_debugger(debugger* d, chip_8* c){
-    d->chip = c;
-    d->previous_instruction = 0;
-    d->current_instruction = get_current_instruction(c);
-    d->next_instruction = get_next_instruction(c);
-    memset(d->breakpoints, 0, 10 * sizeof(uint16_t));
-    d->no_breakpoints = 0;
-    memset(d->break_instructions, 0, 10 * sizeof(uint16_t));
-    d->no_break_instructions = 0;
-    memset(d->break_address_reg, 0, 10 * sizeof(uint16_t));
-    d->no_break_addres_regs = 0;
-}
+    int held_key = -1;
+    bool held_pressed = false;
+    //host frame n is due at epoch + n * frequency / 60, computed from the count rather than by
+    //adding up a rounded frame length, so sixty frames always take exactly one second
+    uint64_t epoch = SDL_GetPerformanceCounter();
+    uint64_t host_frame = 1;
+    uint64_t next_frame = epoch + frequency / 60;
+    while(!atomic_load(&e->quit)){
+        apply_keys(e, &held_key, &held_pressed);
 
-void add_debug_instruction(debugger* d, uint16_t instruction){
-    d->break_instructions[d->no_break_instructions] = instruction;
-    d->no_break_instructions++;
-}
+        //one emulated frame per host frame, in turbo mode as many as fit into it
+        uint64_t start = SDL_GetPerformanceCounter();
+        bool drew = false;
+        do{
+            drew |= play_frame(c, e->opt, e->recorder, e->prof);
+            e->emulated_frames++;
+        }while(e->opt->turbo && !c->faulted && SDL_GetPerformanceCounter() < next_frame);
+        e->emulate_ticks += SDL_GetPerformanceCounter() - start;
+        atomic_store_explicit(&e->beep.on, c->sound_timer > 0, memory_order_relaxed);
 
-void add_break_address_reg(debugger* d, uint16_t address){
-    d->break_address_reg[d->no_break_addres_regs] = address;
-    d->no_break_addres_regs++;
-}
+        if(drew){
+            uint64_t hash = framebuffer_hash(c);
+            if(hash != published_hash){
+                publish_frame(e);
+                published_hash = hash;
+            }
+        }
 
-int debug_step(debugger* d){
-    for(int i = 0; i < d->no_breakpoints; i++){
-        if(d->chip->program_counter == d->breakpoints[i]){
-            print_debug(d->chip);
+        if(c->faulted){
+            fprintf(stderr, "INSTRUCTION, NOT IMPLEMENTED!!! 0x%04x\n", c->fault_instruction);
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            event.type = SDL_QUIT;
+            SDL_PushEvent(&event);
+            break;
         }
-    }
-    for(int i = 0; i < d->no_break_instructions; i++){
-        if((get_current_instruction(d->chip) & d->break_instructions[i]) == d->break_instructions[i]){
-            print_debug(d->chip);
+
+        uint64_t now = SDL_GetPerformanceCounter();
+        if(c->waiting_for_key && c->delay_timer == 0 && c->sound_timer == 0 && held_key < 0){
+            //parked in Fx0A with no timer left to tick, no frame changes anything until a key
+            //event arrives, so sleep until one does and restart the frame clock from there
+            SDL_SemWait(e->wake);
+            while(SDL_SemTryWait(e->wake) == 0){
+            }
+            epoch = SDL_GetPerformanceCounter();
+            host_frame = 0;
         }
-    }
-    for(int i = 0; i < d->no_break_addres_regs; i++){
-        if(d->chip->address_register == d->break_address_reg[i]){
-            print_debug(d->chip);
+        else if(now < next_frame){
+            SDL_Delay((next_frame - now) * 1000 / frequency);
+        }
+        else if(now - next_frame > 4 * frame_ticks){
+            epoch = now; //fell far behind, don't try to catch up
+            host_frame = 0;
         }
+        host_frame++;
+        next_frame = epoch + host_frame * frequency / 60;
     }
-    int res = step(d->chip);
-    d->previous_instruction = d->current_instruction;
-    d->current_instruction = d->next_instruction;
-    d->next_instruction = get_current_instruction(d->chip);
-    return res;
+    atomic_store_explicit(&e->beep.on, false, memory_order_relaxed);
+    return 0;
 }
 
-int main(int argc, char** argv) {
-    if(argc != 2){
-        fprintf(stderr, "./program romfile\n");
-        return 1;
+//pushes every chip-8 key whose state differs from what the emulation thread was last sent.
+//A key that doesn't fit into a full ring stays unsent and is retried after the next event
+static void send_keys(emulation* e, const bool* host_held, bool* sent){
+    bool wanted[16] = {false};
+    for(int i = 0; i < KEYMAP_SIZE; i++){
+        wanted[keymap[i].key] |= host_held[i];
+    }
+    bool pushed = false;
+    for(int key = 0; key < 16; key++){
+        if(wanted[key] != sent[key] && key_ring_push(&e->keys, key, wanted[key])){
+            sent[key] = wanted[key];
+            pushed = true;
+        }
+    }
+    if(pushed){
+        SDL_SemPost(e->wake);
     }
-    
-    const float target_frametime = 1.0f/60.0f;
-    
+}
+
+int run_windowed(const options* opt){
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
         goto cleanup_end;
@@ -770,94 +1022,153 @@ int main(int argc, char** argv) {
 		fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
 		goto cleanup_window;
 	}
-    
-    SDL_Texture* virtual_screen = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, VIRTUAL_SCREEN_WIDTH, VIRTUAL_SCREEN_HEIGHT);
+
+    SDL_Texture* virtual_screen = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, HIRES_SCREEN_WIDTH, HIRES_SCREEN_HEIGHT);
 	if (virtual_screen == NULL) {
 		fprintf(stderr, "SDL_CreateTexture Error: %s\n", SDL_GetError());
 		goto cleanup_renderer;
 	}
-    
+
     chip_8 chip;
     init_chip_8(&chip);
+    emulation emu;
+    emu.wake = NULL;
     debugger debug;
-    init_debugger(&debug, &chip);
-    
-    //add_debug_instruction(&debug, 0xf065);
-    add_break_address_reg(&debug, 0x0202);
-    const char* filename = argv[1];
-    if(!load_program(&chip, filename)){
-        goto cleanup_texture;
-    }
-    
+    if(wants_debugger(opt) && !setup_debugger(&debug, &chip, opt)){
+        goto cleanup_chip;
+    }
+    uint8_t baseline[EXTENDED_MEMORY_SIZE];
+    if(!start_program(&chip, chip.debug, baseline, opt)){
+        goto cleanup_chip;
+    }
+    emu.frame_event = SDL_RegisterEvents(1);
+    emu.wake = SDL_CreateSemaphore(0);
+    if(emu.frame_event == (Uint32)-1 || !emu.wake){
+        fprintf(stderr, "SDL Error: %s\n", SDL_GetError());
+        goto cleanup_chip;
+    }
+    profiler* prof = start_profile(opt);
+    if(opt->profile && !prof){
+        goto cleanup_chip;
+    }
+    movie_recorder movie;
+    movie_recorder* recorder = NULL;
+    if(opt->record){
+        if(!movie_record_start(&movie, opt->record, baseline, opt->instructions_per_frame, chip.quirks)){
+            goto cleanup_chip;
+        }
+        recorder = &movie;
+    }
+
+    emu.chip = &chip;
+    emu.opt = opt;
+    emu.recorder = recorder;
+    emu.prof = prof;
+    frame_exchange_init(&emu.frames);
+    key_ring_init(&emu.keys);
+    atomic_init(&emu.quit, false);
+    emu.emulated_frames = 0;
+    emu.emulate_ticks = 0;
+    emu.published_frames = 0;
+    emu.dropped_frames = 0;
+    SDL_AudioDeviceID audio = open_beeper(&emu.beep);
+    SDL_Thread* emulator = SDL_CreateThread(emulation_main, "emulation", &emu);
+    if(!emulator){
+        fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    }
+
     SDL_Rect target_rect = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT}; //used to scale the texture
-	
-    uint64_t last_time = SDL_GetPerformanceCounter();
-    float dt = 0.0f;
-    bool running = true;
+    bool host_held[KEYMAP_SIZE] = {false};
+    bool sent[16] = {false};
+    uint64_t shown_frames = 0;
+    uint64_t present_ticks = 0;
+    bool running = emulator != NULL;
+    //sleeps until the emulation thread has a frame or the user did something
 	while(running) {
+        bool needs_present = false;
         SDL_Event e;
-        while(SDL_PollEvent(&e) != 0) {
+        if(!SDL_WaitEvent(&e)){
+            break;
+        }
+        do{
             switch(e.type) {
                 case SDL_QUIT:
                     running = false;
                     break;
+                case SDL_WINDOWEVENT:
+                    if(e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED){
+                        needs_present = true;
+                    }
+                    break;
+                case SDL_KEYDOWN:
+                case SDL_KEYUP:
+                    for(int i = 0; i < KEYMAP_SIZE; i++){
+                        if(keymap[i].scancode == (int)e.key.keysym.scancode){
+                            host_held[i] = e.type == SDL_KEYDOWN;
+                        }
+                    }
+                    //sent per event so that changes keep their order
+                    send_keys(&emu, host_held, sent);
+                    break;
                 default:
                     break;
             }
-        }
-        
-        uint64_t new_time = SDL_GetPerformanceCounter();
-        float diff = new_time - last_time;
-        diff = diff / (float)(SDL_GetPerformanceFrequency());
-        float diff_ms = diff * 1000.0f;
-        dt += diff_ms;
-        if(dt > 16.666f){
-            dt -= 16.666f;
-            if(chip.delay_timer > 0) chip.delay_timer--;
-            if(chip.sound_timer > 0) chip.sound_timer--;
-        }
-        last_time = new_time;
-        
-        const uint8_t *key_state = SDL_GetKeyboardState(NULL);
-        chip.keys[0x0] = (bool)key_state[SDL_SCANCODE_X];
-        chip.keys[0x1] = (bool)key_state[SDL_SCANCODE_1];
-        chip.keys[0x2] = (bool)key_state[SDL_SCANCODE_2] || (bool)key_state[SDL_SCANCODE_UP];
-        chip.keys[0x3] = (bool)key_state[SDL_SCANCODE_3];
-        chip.keys[0xc] = (bool)key_state[SDL_SCANCODE_4];
-        chip.keys[0x4] = (bool)key_state[SDL_SCANCODE_Q] || (bool)key_state[SDL_SCANCODE_LEFT];
-        chip.keys[0x5] = (bool)key_state[SDL_SCANCODE_W];
-        chip.keys[0x6] = (bool)key_state[SDL_SCANCODE_E] || (bool)key_state[SDL_SCANCODE_RIGHT];
-        chip.keys[0xd] = (bool)key_state[SDL_SCANCODE_R];
-        chip.keys[0x7] = (bool)key_state[SDL_SCANCODE_A];
-        chip.keys[0x8] = (bool)key_state[SDL_SCANCODE_S] || (bool)key_state[SDL_SCANCODE_DOWN];
-        chip.keys[0x9] = (bool)key_state[SDL_SCANCODE_D];
-        chip.keys[0xe] = (bool)key_state[SDL_SCANCODE_F];
-        chip.keys[0xa] = (bool)key_state[SDL_SCANCODE_Z];
-        chip.keys[0x0] = (bool)key_state[SDL_SCANCODE_X];
-        chip.keys[0xb] = (bool)key_state[SDL_SCANCODE_C];
-        chip.keys[0xf] = (bool)key_state[SDL_SCANCODE_V];
-        
-        int res = step(&chip);
-        //int res = debug_step(&debug);
-        if(res == 2){
+        }while(SDL_PollEvent(&e) != 0);
+        send_keys(&emu, host_held, sent);
+
+        //only the newest frame is uploaded, anything published in between was already dropped
+        if(frame_exchange_take(&emu.frames) || needs_present){
+            uint64_t start = SDL_GetPerformanceCounter();
+            void* pixels;
+            int pitch;
+            //the texture fits the 128x64 mode, a 64x32 frame only fills its top left corner
+            const published_frame* frame = frame_exchange_front(&emu.frames);
+            SDL_Rect source = {0, 0, VIRTUAL_SCREEN_WIDTH, VIRTUAL_SCREEN_HEIGHT};
+            if(frame->hires){
+                source.w = HIRES_SCREEN_WIDTH;
+                source.h = HIRES_SCREEN_HEIGHT;
+            }
+            if(SDL_LockTexture(virtual_screen, NULL, &pixels, &pitch) == 0){
+                expand_display(frame->display, frame->hires, pixels, pitch / (int)sizeof(Uint32));
+                SDL_UnlockTexture(virtual_screen);
+            }
             SDL_SetRenderDrawColor(ren, 0, 0, 0, 0);
             SDL_RenderClear(ren);
-            SDL_UpdateTexture(virtual_screen, NULL, chip.pixels, VIRTUAL_SCREEN_WIDTH * sizeof(Uint32));
-            SDL_RenderCopy(ren, virtual_screen, NULL, &target_rect);
+            SDL_RenderCopy(ren, virtual_screen, &source, &target_rect);
             SDL_RenderPresent(ren);
-        }
-        
-        //print_debug(&chip);
-        
-        	
-        
-        if(diff_ms < target_frametime){
-            
-            SDL_Delay(target_frametime - diff_ms);
+            present_ticks += SDL_GetPerformanceCounter() - start;
+            shown_frames++;
         }
 	}
-    
-    cleanup_texture:
+    if(emulator){
+        atomic_store(&emu.quit, true);
+        SDL_SemPost(emu.wake);
+        SDL_WaitThread(emulator, NULL);
+    }
+    if(audio){
+        SDL_CloseAudioDevice(audio);
+    }
+
+    const double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+    printf("emulated frames: %llu, %.3f ms each\n", (unsigned long long)emu.emulated_frames,
+           emu.emulated_frames ? emu.emulate_ticks * ms_per_tick / emu.emulated_frames : 0.0);
+    printf("frames published: %llu, dropped before display: %llu\n",
+           (unsigned long long)emu.published_frames, (unsigned long long)emu.dropped_frames);
+    printf("frames presented: %llu, %.3f ms each\n", (unsigned long long)shown_frames,
+           shown_frames ? present_ticks * ms_per_tick / shown_frames : 0.0);
+
+    if(recorder){
+        movie_record_finish(recorder);
+    }
+    if(opt->save_state){
+        save_state_file(&chip, chip.debug, baseline, opt->save_state);
+    }
+    finish_profile(prof, &chip, opt);
+    cleanup_chip:
+    if(emu.wake){
+        SDL_DestroySemaphore(emu.wake);
+    }
+    release_core(&chip);
     SDL_DestroyTexture(virtual_screen);
     cleanup_renderer:
 	SDL_DestroyRenderer(ren);
@@ -865,6 +1176,24 @@ int main(int argc, char** argv) {
 	SDL_DestroyWindow(win);
     cleanup_end:
 	SDL_Quit();
-    
-    
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    options opt;
+    if(!parse_args(&opt, argc, argv)){
+        print_usage();
+        return 1;
+    }
+    if(!read_rom(&opt)){
+        return 1;
+    }
+
+#ifndef CHIP8_HEADLESS
+    if(!opt.headless){
+        return run_windowed(&opt);
+    }
+#endif
+    return run_headless(&opt);
 }
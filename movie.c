@@ -0,0 +1,275 @@
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "movie.h"
+#include "savestate.h"
+
+
+#define MOVIE_HEADER_SIZE 13
+
+enum{
+    CHUNK_EVENT = 1,
+    CHUNK_KEYFRAME = 2,
+    CHUNK_END = 3
+};
+
+typedef struct{
+    uint8_t tag;
+    uint64_t value; //cycle delta, keyframe frame or frame count
+    uint16_t keys;
+    const uint8_t* state;
+    size_t state_size;
+    size_t next; //offset of the following chunk
+}chunk;
+
+static void put_varint(FILE* fp, uint64_t v){
+    while(v >= 0x80){
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc(v, fp);
+}
+
+static void put_u16(FILE* fp, uint16_t v){
+    fputc(v & 0xff, fp);
+    fputc(v >> 8, fp);
+}
+
+static void put_u32(FILE* fp, uint32_t v){
+    put_u16(fp, v & 0xffff);
+    put_u16(fp, v >> 16);
+}
+
+static bool get_varint(const movie_player* p, size_t* pos, uint64_t* v){
+    *v = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(*pos >= p->size) return false;
+        uint8_t b = p->data[(*pos)++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+//false at the end of the data or on a damaged chunk
+static bool read_chunk(const movie_player* p, size_t pos, chunk* ch){
+    if(pos >= p->size) return false;
+    ch->tag = p->data[pos++];
+    if(!get_varint(p, &pos, &ch->value)) return false;
+    switch(ch->tag){
+        case CHUNK_EVENT:
+            if(pos + 2 > p->size) return false;
+            ch->keys = p->data[pos] | (p->data[pos + 1] << 8);
+            pos += 2;
+            break;
+        case CHUNK_KEYFRAME:{
+            uint64_t size;
+            if(!get_varint(p, &pos, &size) || size > p->size - pos) return false;
+            ch->state = p->data + pos;
+            ch->state_size = size;
+            pos += size;
+            break;
+        }
+        case CHUNK_END:
+            break;
+        default:
+            return false;
+    }
+    ch->next = pos;
+    return true;
+}
+
+bool movie_record_start(movie_recorder* m, const char* filename, const uint8_t* baseline, int instructions_per_frame, uint8_t quirks){
+    m->fp = fopen(filename, "wb");
+    if(!m->fp){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    m->baseline = baseline;
+    m->keyframe_interval = MOVIE_KEYFRAME_INTERVAL;
+    m->frame = 0;
+    m->last_cycle = 0;
+    m->keys = 0;
+    fwrite("C8MV", 1, 4, m->fp);
+    put_u16(m->fp, MOVIE_VERSION);
+    put_u32(m->fp, instructions_per_frame);
+    put_u16(m->fp, m->keyframe_interval);
+    fputc(quirks, m->fp);
+    return true;
+}
+
+void movie_record_frame(movie_recorder* m, const chip_8* c){
+    uint16_t keys = 0;
+    for(int i = 0; i < 16; i++){
+        keys |= (c->keys[i] != 0) << i;
+    }
+    if(keys != m->keys){
+        fputc(CHUNK_EVENT, m->fp);
+        put_varint(m->fp, c->cycles - m->last_cycle);
+        put_u16(m->fp, keys);
+        m->last_cycle = c->cycles;
+        m->keys = keys;
+    }
+    if(m->frame % m->keyframe_interval == 0){
+        uint8_t state[STATE_MAX_SIZE];
+        size_t size = save_state(c, NULL, m->baseline, state, sizeof(state));
+        fputc(CHUNK_KEYFRAME, m->fp);
+        put_varint(m->fp, m->frame);
+        put_varint(m->fp, size);
+        fwrite(state, 1, size, m->fp);
+        m->last_cycle = c->cycles;
+    }
+    m->frame++;
+}
+
+bool movie_record_finish(movie_recorder* m){
+    fputc(CHUNK_END, m->fp);
+    put_varint(m->fp, m->frame);
+    bool ok = !ferror(m->fp);
+    ok = fclose(m->fp) == 0 && ok;
+    m->fp = NULL;
+    if(!ok){
+        fprintf(stderr, "could not write movie!!!\n");
+    }
+    return ok;
+}
+
+bool movie_open(movie_player* p, const char* filename){
+    memset(p, 0, sizeof(*p));
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < MOVIE_HEADER_SIZE){
+        fprintf(stderr, "not a movie!!!\n");
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "could not map file!!!\n");
+        return false;
+    }
+    p->data = data;
+    p->size = st.st_size;
+    if(memcmp(p->data, "C8MV", 4) != 0 || (p->data[4] | (p->data[5] << 8)) != MOVIE_VERSION){
+        fprintf(stderr, "not a movie or wrong version!!!\n");
+        movie_close(p);
+        return false;
+    }
+    uint32_t instructions_per_frame = p->data[6] | (p->data[7] << 8) | (p->data[8] << 16) | ((uint32_t)p->data[9] << 24);
+    p->instructions_per_frame = instructions_per_frame > INT_MAX ? 0 : instructions_per_frame;
+    p->quirks = p->data[12];
+    if(p->quirks >= QUIRKS_COUNT){
+        fprintf(stderr, "movie was made with unknown quirks!!!\n");
+        movie_close(p);
+        return false;
+    }
+
+    //index the keyframes and find the length. A movie cut short (e.g. by a crash) ends at its last keyframe
+    int capacity = 0;
+    chunk ch;
+    bool ended = false;
+    for(size_t pos = MOVIE_HEADER_SIZE; !ended && read_chunk(p, pos, &ch); pos = ch.next){
+        if(ch.tag == CHUNK_KEYFRAME){
+            if(p->keyframe_count == capacity){
+                capacity = capacity ? capacity * 2 : 64;
+                size_t* offsets = realloc(p->keyframe_offsets, capacity * sizeof(size_t));
+                uint64_t* frames = realloc(p->keyframe_frames, capacity * sizeof(uint64_t));
+                if(offsets) p->keyframe_offsets = offsets;
+                if(frames) p->keyframe_frames = frames;
+                if(!offsets || !frames){
+                    fprintf(stderr, "out of memory\n");
+                    movie_close(p);
+                    return false;
+                }
+            }
+            p->keyframe_offsets[p->keyframe_count] = pos;
+            p->keyframe_frames[p->keyframe_count] = ch.value;
+            p->keyframe_count++;
+            p->frame_count = ch.value;
+        }
+        else if(ch.tag == CHUNK_END){
+            p->frame_count = ch.value;
+            ended = true;
+        }
+    }
+    if(p->keyframe_count == 0 || p->instructions_per_frame <= 0){
+        fprintf(stderr, "movie has no keyframes!!!\n");
+        movie_close(p);
+        return false;
+    }
+    if(!ended){
+        fprintf(stderr, "movie was cut short, playing up to frame %llu\n", (unsigned long long)p->frame_count);
+    }
+    return true;
+}
+
+void movie_close(movie_player* p){
+    if(p->data){
+        munmap(p->data, p->size);
+    }
+    free(p->keyframe_offsets);
+    free(p->keyframe_frames);
+    memset(p, 0, sizeof(*p));
+}
+
+bool movie_seek(movie_player* p, chip_8* c, const uint8_t* baseline, uint64_t frame){
+    if(frame > p->frame_count){
+        fprintf(stderr, "movie only has %llu frames\n", (unsigned long long)p->frame_count);
+        return false;
+    }
+    int k = 0;
+    while(k + 1 < p->keyframe_count && p->keyframe_frames[k + 1] <= frame){
+        k++;
+    }
+    chunk ch;
+    read_chunk(p, p->keyframe_offsets[k], &ch);
+    if(!load_state(c, NULL, baseline, ch.state, ch.state_size)){
+        return false;
+    }
+    p->pos = ch.next;
+    p->frame = ch.value;
+    p->last_cycle = c->cycles;
+    while(p->frame < frame){
+        movie_play_frame(p, c);
+    }
+    return true;
+}
+
+bool movie_play_frame(movie_player* p, chip_8* c){
+    if(p->frame >= p->frame_count){
+        return false;
+    }
+    chunk ch;
+    while(read_chunk(p, p->pos, &ch)){
+        if(ch.tag == CHUNK_EVENT){
+            if(p->last_cycle + ch.value > c->cycles) break; //belongs to a later frame
+            for(int i = 0; i < 16; i++){
+                c->keys[i] = (ch.keys >> i) & 1;
+            }
+            p->last_cycle += ch.value;
+        }
+        else if(ch.tag == CHUNK_KEYFRAME){
+            if(ch.value > p->frame) break;
+            p->last_cycle = c->cycles;
+        }
+        else{
+            break;
+        }
+        p->pos = ch.next;
+    }
+    run_frame(c, p->instructions_per_frame);
+    p->frame++;
+    return true;
+}
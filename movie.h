@@ -0,0 +1,58 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+
+//input movies. A movie is a header ("C8MV", version u16, instructions per frame u32, keyframe interval u16,
+//quirk profile u8) followed by chunks:
+//  event     tag 1, varint cycles since the previous event or keyframe, keys u16
+//  keyframe  tag 2, varint frame, varint size, save state (see savestate.h)
+//  end       tag 3, varint frame count
+//keys only change at frame starts. A keyframe is written at frame 0 and every keyframe interval frames
+//after that frame's key events, so seeking restores the closest keyframe and replays the rest
+
+#define MOVIE_VERSION 5
+#define MOVIE_KEYFRAME_INTERVAL 600 //ten seconds
+
+typedef struct{
+    FILE* fp;
+    const uint8_t* baseline;
+    int keyframe_interval;
+    uint64_t frame;
+    uint64_t last_cycle;
+    uint16_t keys;
+}movie_recorder;
+
+typedef struct{
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+    int instructions_per_frame;
+    uint8_t quirks; //the profile the movie was recorded with, its keyframes only load into it
+    uint64_t frame;
+    uint64_t frame_count;
+    uint64_t last_cycle;
+    size_t* keyframe_offsets; //chunk offsets, in frame order
+    uint64_t* keyframe_frames;
+    int keyframe_count;
+}movie_player;
+
+bool movie_record_start(movie_recorder* m, const char* filename, const uint8_t* baseline, int instructions_per_frame, uint8_t quirks);
+//call right before every run_frame(), after c->keys was updated
+void movie_record_frame(movie_recorder* m, const chip_8* c);
+bool movie_record_finish(movie_recorder* m);
+
+bool movie_open(movie_player* p, const char* filename);
+void movie_close(movie_player* p);
+//leaves c at the start of the given frame, false if the movie is shorter or the rom differs
+bool movie_seek(movie_player* p, chip_8* c, const uint8_t* baseline, uint64_t frame);
+//applies the frame's input and runs it, false once the movie has ended
+bool movie_play_frame(movie_player* p, chip_8* c);
+
+#endif
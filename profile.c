@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+
+#define LOOKUP_SIZE (1 << PROFILE_LOOKUP_BITS)
+#define REPORT_LOOPS 16
+
+bool profile_init(profiler* p){
+    memset(p, 0, sizeof(*p));
+    p->nodes = malloc(PROFILE_MAX_NODES * sizeof(profile_node));
+    p->lookup = calloc(LOOKUP_SIZE, sizeof(int32_t));
+    if(!p->nodes || !p->lookup){
+        profile_free(p);
+        return false;
+    }
+    p->nodes[0].parent = -1;
+    p->nodes[0].address = 0;
+    p->nodes[0].self = 0;
+    p->node_count = 1;
+    return true;
+}
+
+void profile_free(profiler* p){
+    free(p->nodes);
+    free(p->lookup);
+    p->nodes = NULL;
+    p->lookup = NULL;
+}
+
+static void enter(profiler* p, uint16_t address){
+    uint32_t key = ((uint32_t)p->current << 12) | address;
+    uint32_t slot = (key * 2654435761u) >> (32 - PROFILE_LOOKUP_BITS);
+    while(p->lookup[slot]){
+        int node = p->lookup[slot] - 1;
+        if(p->nodes[node].parent == p->current && p->nodes[node].address == address){
+            p->current = node;
+            return;
+        }
+        slot = (slot + 1) & (LOOKUP_SIZE - 1);
+    }
+    if(p->node_count == PROFILE_MAX_NODES){
+        p->lost_depth++;
+        return;
+    }
+    int node = p->node_count++;
+    p->nodes[node].parent = p->current;
+    p->nodes[node].address = address;
+    p->nodes[node].self = 0;
+    p->lookup[slot] = node + 1;
+    p->current = node;
+}
+
+static void leave(profiler* p){
+    if(p->lost_depth > 0){
+        p->lost_depth--;
+    }
+    else if(p->nodes[p->current].parent >= 0){
+        p->current = p->nodes[p->current].parent;
+    }
+}
+
+bool profile_run_instructions(profiler* p, chip_8* c, int count){
+    if(c->faulted || (c->debug && c->debug->event != DEBUG_NONE)){
+        return false;
+    }
+    bool drew = false;
+    int i = 0;
+    while(i < count){
+        uint16_t pc = c->program_counter & (MEMORY_SIZE - 1);
+        uint8_t stack_pos = c->stack_pos;
+        int res = step(c);
+        if(res == 1 || res == 3 || c->faulted){
+            //the rest of the budget goes to the key wait
+            if(res == 1) p->waiting += count - i;
+            step_budget(c, res, &i, count);
+            break;
+        }
+        //step() just filled the cache entry, unless the instruction overwrote itself
+        uint8_t op = c->decoded[pc].op;
+        if(op == OP_UNDECODED){
+            uint16_t instr = (c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+            op = profile_instruction(decode_instruction(instr), quirk_flags[c->quirks]).op;
+        }
+        p->hits[pc]++;
+        p->op_hits[op]++;
+        p->nodes[p->current].self++;
+        if(res == 2){
+            drew = true;
+        }
+        uint16_t next = c->program_counter & (MEMORY_SIZE - 1);
+        if(c->stack_pos > stack_pos){
+            enter(p, next);
+        }
+        else if(c->stack_pos < stack_pos){
+            leave(p);
+        }
+        else if(next <= pc){
+            p->loop_hits[pc]++;
+            p->loop_target[pc] = next;
+        }
+        if(!step_budget(c, res, &i, count)) break;
+    }
+    p->instructions += i;
+    c->cycles += i;
+    return drew;
+}
+
+bool profile_run_frame(profiler* p, chip_8* c, int instructions_per_frame){
+    if(c->faulted || (c->debug && c->debug->event != DEBUG_NONE)){
+        return false;
+    }
+    bool drew = profile_run_instructions(p, c, instructions_per_frame);
+    tick_timers(c);
+    return drew;
+}
+
+//frames from the root down, separated by ';'
+static void write_path(FILE* fp, const profiler* p, int node){
+    if(p->nodes[node].parent >= 0){
+        write_path(fp, p, p->nodes[node].parent);
+        fprintf(fp, ";sub_0x%03x", p->nodes[node].address);
+    }
+    else{
+        fprintf(fp, "main");
+    }
+}
+
+typedef struct{
+    uint64_t iterations;
+    uint64_t instructions; //executed inside the loop body
+    uint16_t from;
+    uint16_t to;
+}loop;
+
+static int compare_loops(const void* a, const void* b){
+    const loop* x = a;
+    const loop* y = b;
+    if(x->instructions != y->instructions) return x->instructions < y->instructions ? 1 : -1;
+    return x->from - y->from;
+}
+
+typedef struct{
+    uint64_t hits;
+    int op;
+}op_count;
+
+static int compare_ops(const void* a, const void* b){
+    const op_count* x = a;
+    const op_count* y = b;
+    if(x->hits != y->hits) return x->hits < y->hits ? 1 : -1;
+    return x->op - y->op;
+}
+
+static double percent(uint64_t part, uint64_t total){
+    return total ? 100.0 * part / total : 0.0;
+}
+
+bool profile_write(const profiler* p, const chip_8* c, const char* prefix){
+    size_t length = strlen(prefix);
+    char* filename = malloc(length + 8);
+    if(!filename){
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+
+    memcpy(filename, prefix, length);
+    strcpy(filename + length, ".folded");
+    FILE* fp = fopen(filename, "w");
+    if(!fp){
+        fprintf(stderr, "could not open file!!!\n");
+        free(filename);
+        return false;
+    }
+    for(int i = 0; i < p->node_count; i++){
+        if(p->nodes[i].self == 0) continue;
+        write_path(fp, p, i);
+        fprintf(fp, " %llu\n", (unsigned long long)p->nodes[i].self);
+    }
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+
+    strcpy(filename + length, ".txt");
+    fp = fopen(filename, "w");
+    free(filename);
+    if(!fp){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    const uint64_t total = p->instructions - p->waiting;
+    fprintf(fp, "instructions: %llu\n", (unsigned long long)total);
+    fprintf(fp, "waiting for a key: %llu steps\n", (unsigned long long)p->waiting);
+    fprintf(fp, "call paths: %d%s\n\n", p->node_count, p->node_count == PROFILE_MAX_NODES ? " (table full)" : "");
+
+    fprintf(fp, "opcodes:\n");
+    op_count ops[OP_COUNT];
+    for(int i = 0; i < OP_COUNT; i++){
+        ops[i].hits = p->op_hits[i];
+        ops[i].op = i;
+    }
+    qsort(ops, OP_COUNT, sizeof(ops[0]), compare_ops);
+    for(int i = 0; i < OP_COUNT && ops[i].hits != 0; i++){
+        fprintf(fp, "  %-24s %14llu %6.2f%%\n", op_name(ops[i].op), (unsigned long long)ops[i].hits, percent(ops[i].hits, total));
+    }
+
+    //a loop is a backward jump, its body everything from the target up to the jump
+    loop loops[MEMORY_SIZE];
+    int loop_count = 0;
+    for(int from = 0; from < MEMORY_SIZE; from++){
+        if(p->loop_hits[from] == 0) continue;
+        loop* l = &loops[loop_count++];
+        l->iterations = p->loop_hits[from];
+        l->from = from;
+        l->to = p->loop_target[from];
+        l->instructions = 0;
+        for(int a = l->to; a <= from; a++){
+            l->instructions += p->hits[a];
+        }
+    }
+    qsort(loops, loop_count, sizeof(loops[0]), compare_loops);
+    fprintf(fp, "\nhottest loops:\n");
+    for(int i = 0; i < loop_count && i < REPORT_LOOPS; i++){
+        fprintf(fp, "  0x%03x-0x%03x %14llu iterations %14llu instructions %6.2f%%\n", loops[i].to, loops[i].from,
+                (unsigned long long)loops[i].iterations, (unsigned long long)loops[i].instructions,
+                percent(loops[i].instructions, total));
+    }
+
+    fprintf(fp, "\ndisassembly:\n");
+    for(int a = 0; a < MEMORY_SIZE; a++){
+        if(p->hits[a] == 0) continue;
+        uint16_t instr = (c->memory[a] << 8) | c->memory[(a + 1) & (MEMORY_SIZE - 1)];
+        fprintf(fp, "  0x%03x %14llu %6.2f%%  %04x  ", a, (unsigned long long)p->hits[a], percent(p->hits[a], total), instr);
+        fprint_instruction(fp, instr);
+        fprintf(fp, "\n");
+    }
+    ok = !ferror(fp) && ok;
+    ok = fclose(fp) == 0 && ok;
+    if(!ok){
+        fprintf(stderr, "could not write profile!!!\n");
+    }
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//guest profiler. Runs the rom through step() and counts every executed instruction per address,
+//per opcode and per call path. Call paths follow the stack pointer, so a call is any instruction
+//that grows the stack and a return any that shrinks it. Backward jumps are counted per source
+//address to find the loops. The jit is bypassed while profiling
+
+#define PROFILE_MAX_NODES 4096 //call paths, deeper or further paths are charged to their parent
+#define PROFILE_LOOKUP_BITS 13
+
+typedef struct{
+    int32_t parent; //-1 for the root, the code outside any subroutine
+    uint16_t address; //entry point of the subroutine
+    uint64_t self; //instructions executed with this path on top
+}profile_node;
+
+typedef struct{
+    uint64_t hits[MEMORY_SIZE];
+    uint64_t op_hits[OP_COUNT];
+    uint64_t loop_hits[MEMORY_SIZE]; //backward jumps taken from each address
+    uint16_t loop_target[MEMORY_SIZE];
+    uint64_t instructions;
+    uint64_t waiting; //steps spent waiting for a key
+    profile_node* nodes;
+    int node_count;
+    int current;
+    int lost_depth; //calls made while the node table was full
+    int32_t* lookup; //(parent, address) -> node + 1, open addressing
+}profiler;
+
+bool profile_init(profiler* p);
+void profile_free(profiler* p);
+//same contract as run_instructions()/run_frame()
+bool profile_run_instructions(profiler* p, chip_8* c, int count);
+bool profile_run_frame(profiler* p, chip_8* c, int instructions_per_frame);
+//writes prefix.folded, collapsed stacks for flamegraph tools, and prefix.txt with the opcode
+//histogram, the hottest loops and a disassembly of every executed address with its count
+bool profile_write(const profiler* p, const chip_8* c, const char* prefix);
+
+#endif
@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "romindex.h"
+
+
+#define ROM_INDEX_MIN_CAPACITY 16
+#define ROM_INDEX_MAX_CAPACITY (1U << 30)
+
+_Static_assert(sizeof(rom_entry) == 32, "index entries are written to disk as is");
+_Static_assert(sizeof(rom_index_header) == 32, "index headers are written to disk as is");
+
+bool rom_index_open(rom_index* x, const char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(rom_index_header)){
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED){
+        fprintf(stderr, "not a rom index!!!\n");
+        return false;
+    }
+    const rom_index_header* h = map;
+    uint32_t capacity = h->capacity;
+    bool valid = memcmp(h->magic, ROM_INDEX_MAGIC, sizeof(ROM_INDEX_MAGIC)) == 0 && h->version == ROM_INDEX_VERSION
+                 && h->entry_size == sizeof(rom_entry) && capacity > 0 && capacity <= ROM_INDEX_MAX_CAPACITY
+                 && (capacity & (capacity - 1)) == 0 && h->count < capacity
+                 && (size_t)st.st_size >= sizeof(rom_index_header) + (size_t)capacity * sizeof(rom_entry);
+    if(!valid){
+        fprintf(stderr, "not a rom index!!!\n");
+        munmap(map, st.st_size);
+        return false;
+    }
+    x->header = h;
+    x->entries = (const rom_entry*)(h + 1);
+    x->map_size = st.st_size;
+    return true;
+}
+
+void rom_index_close(rom_index* x){
+    munmap((void*)x->header, x->map_size);
+    x->header = NULL;
+    x->entries = NULL;
+}
+
+//the slot holding the rom, or the empty slot it would go in. mask + 1 if there is neither, which
+//only a damaged file can have, rom_index_write() keeps the table at most half full
+static uint32_t find_slot(const rom_entry* entries, uint32_t mask, uint64_t rom_hash, uint32_t size){
+    uint32_t slot = rom_hash & mask;
+    for(uint32_t probes = 0; probes <= mask; probes++){
+        const rom_entry* e = &entries[slot];
+        if(!(e->flags & ROM_ENTRY_USED) || (e->rom_hash == rom_hash && e->size == size)){
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return mask + 1;
+}
+
+const rom_entry* rom_index_find(const rom_index* x, uint64_t rom_hash, uint32_t size){
+    uint32_t slot = find_slot(x->entries, x->header->capacity - 1, rom_hash, size);
+    if(slot == x->header->capacity){
+        return NULL;
+    }
+    const rom_entry* e = &x->entries[slot];
+    return e->flags & ROM_ENTRY_USED ? e : NULL;
+}
+
+bool rom_index_write(const char* path, const rom_entry* entries, int count){
+    uint32_t capacity = ROM_INDEX_MIN_CAPACITY;
+    while(capacity < ROM_INDEX_MAX_CAPACITY && capacity < 2 * (uint64_t)count){
+        capacity <<= 1;
+    }
+    if(capacity < 2 * (uint64_t)count){
+        fprintf(stderr, "index too large!!!\n");
+        return false;
+    }
+    size_t size = sizeof(rom_index_header) + (size_t)capacity * sizeof(rom_entry);
+    rom_index_header* h = calloc(1, size);
+    char* temporary = malloc(strlen(path) + 5);
+    if(!h || !temporary){
+        fprintf(stderr, "out of memory\n");
+        free(h);
+        free(temporary);
+        return false;
+    }
+    memcpy(h->magic, ROM_INDEX_MAGIC, sizeof(ROM_INDEX_MAGIC));
+    h->version = ROM_INDEX_VERSION;
+    h->entry_size = sizeof(rom_entry);
+    h->capacity = capacity;
+    rom_entry* table = (rom_entry*)(h + 1);
+    for(int i = 0; i < count; i++){
+        rom_entry* e = &table[find_slot(table, capacity - 1, entries[i].rom_hash, entries[i].size)];
+        if(!(e->flags & ROM_ENTRY_USED)){
+            h->count++;
+        }
+        *e = entries[i];
+        e->flags |= ROM_ENTRY_USED;
+    }
+
+    strcpy(temporary, path);
+    strcat(temporary, ".tmp");
+    FILE* fp = fopen(temporary, "wb");
+    bool ok = fp != NULL;
+    if(!ok){
+        fprintf(stderr, "could not open file!!!\n");
+    }
+    else{
+        ok = fwrite(h, 1, size, fp) == size;
+        ok = fclose(fp) == 0 && ok;
+        ok = ok && rename(temporary, path) == 0;
+        if(!ok){
+            fprintf(stderr, "could not write index!!!\n");
+            remove(temporary);
+        }
+    }
+    free(h);
+    free(temporary);
+    return ok;
+}
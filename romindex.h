@@ -0,0 +1,55 @@
+#ifndef ROMINDEX_H
+#define ROMINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+//on-disk index of known roms keyed by data_hash() of the file. It is an open addressed hash table
+//kept at most half full and mapped read-only, so a lookup is a hash of the rom that was read anyway
+//and usually a single probe. batch.out --write-index builds it, --index reads it in both programs
+
+#define ROM_INDEX_MAGIC "C8INDEX"
+#define ROM_INDEX_VERSION 1
+
+//entry flags
+#define ROM_ENTRY_USED 1
+#define ROM_ENTRY_CHECKED 2 //framebuffer_hash is what the rom shows after frames frames from a fresh start
+
+typedef struct{
+    uint64_t rom_hash;
+    uint64_t framebuffer_hash;
+    uint32_t frames;
+    uint32_t instructions_per_frame;
+    uint32_t size; //of the rom, a second check against hash collisions
+    uint8_t quirks;
+    uint8_t flags;
+    uint8_t reserved[2];
+}rom_entry;
+
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t capacity; //slots, a power of two
+    uint32_t count; //used slots
+    uint8_t reserved[8];
+}rom_index_header;
+
+typedef struct{
+    const rom_index_header* header;
+    const rom_entry* entries;
+    size_t map_size;
+}rom_index;
+
+bool rom_index_open(rom_index* x, const char* path);
+void rom_index_close(rom_index* x);
+//NULL if the rom isn't in the index
+const rom_entry* rom_index_find(const rom_index* x, uint64_t rom_hash, uint32_t size);
+
+//writes a new index with the given entries through a temporary file, so a reader never maps a half
+//written one. Of entries with the same rom the last one wins
+bool rom_index_write(const char* path, const rom_entry* entries, int count);
+
+#endif
@@ -0,0 +1,442 @@
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include "savestate.h"
+
+
+#define STATE_FLAG_DEBUGGER 1
+//a run ends once this many equal bytes follow, shorter gaps are cheaper to store than a new run header
+#define RUN_GAP 4
+
+//crc32c (Castagnoli), which SSE4.2 computes eight bytes at a time. The fallback does one table lookup per nibble
+uint32_t crc32c(const uint8_t* data, size_t size){
+    uint32_t crc = 0xffffffff;
+    size_t i = 0;
+#if defined(__SSE4_2__)
+    uint64_t crc64 = crc;
+    for(; i + 8 <= size; i += 8){
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for(; i < size; i++){
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+#else
+    static const uint32_t table[16] = {
+        0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+        0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+    };
+    for(; i < size; i++){
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+#endif
+    return ~crc;
+}
+
+typedef struct{
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+}writer;
+
+typedef struct{
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+}reader;
+
+static void put_bytes(writer* w, const void* data, size_t size){
+    if(w->pos + size <= w->size){
+        memcpy(w->data + w->pos, data, size);
+    }
+    w->pos += size;
+}
+
+static void put_u8(writer* w, uint8_t v){
+    put_bytes(w, &v, 1);
+}
+
+static void put_u16(writer* w, uint16_t v){
+    uint8_t b[2] = {v & 0xff, v >> 8};
+    put_bytes(w, b, 2);
+}
+
+static void put_u32(writer* w, uint32_t v){
+    put_u16(w, v & 0xffff);
+    put_u16(w, v >> 16);
+}
+
+static void put_u64(writer* w, uint64_t v){
+    put_u32(w, v & 0xffffffff);
+    put_u32(w, v >> 32);
+}
+
+//reads past the end return zeros, callers check r->pos > r->size once at the end
+static const uint8_t* get_bytes(reader* r, size_t size){
+    static const uint8_t zeros[EXTENDED_MEMORY_SIZE];
+    const uint8_t* p = r->pos + size <= r->size ? r->data + r->pos : zeros;
+    r->pos += size;
+    return p;
+}
+
+static uint8_t get_u8(reader* r){
+    return *get_bytes(r, 1);
+}
+
+static uint16_t get_u16(reader* r){
+    const uint8_t* b = get_bytes(r, 2);
+    return b[0] | (b[1] << 8);
+}
+
+static uint32_t get_u32(reader* r){
+    uint32_t lo = get_u16(r);
+    return lo | ((uint32_t)get_u16(r) << 16);
+}
+
+static uint64_t get_u64(reader* r){
+    uint64_t lo = get_u32(r);
+    return lo | ((uint64_t)get_u32(r) << 32);
+}
+
+//a run is at most 0xffff bytes, its length has to fit a u16
+static void put_memory_runs(writer* w, const uint8_t* memory, const uint8_t* baseline, int size){
+    size_t count_pos = w->pos;
+    uint16_t runs = 0;
+    put_u16(w, 0);
+    int i = 0;
+    while(i < size){
+        if(memory[i] == baseline[i]){
+            i++;
+            continue;
+        }
+        int start = i;
+        int end = i + 1;
+        for(int equal = 0; i < size && i - start < 0xffff && equal <= RUN_GAP; i++){
+            if(memory[i] != baseline[i]){
+                equal = 0;
+                end = i + 1;
+            }
+            else{
+                equal++;
+            }
+        }
+        put_u16(w, start);
+        put_u16(w, end - start);
+        put_bytes(w, memory + start, end - start);
+        runs++;
+        i = end;
+    }
+    if(count_pos + 2 <= w->size){
+        w->data[count_pos] = runs & 0xff;
+        w->data[count_pos + 1] = runs >> 8;
+    }
+}
+
+size_t save_state(const chip_8* c, const debugger* d, const uint8_t* baseline, uint8_t* buffer, size_t size){
+    writer w = {buffer, size, STATE_HEADER_SIZE};
+    for(int i = 0; i < 16; i++){
+        put_u8(&w, c->registers[i]);
+    }
+    put_u16(&w, c->address_register);
+    put_u16(&w, c->program_counter);
+    for(int i = 0; i < STACK_SIZE; i++){
+        put_u16(&w, c->stack[i]);
+    }
+    put_u8(&w, c->stack_pos);
+    put_u8(&w, c->delay_timer);
+    put_u8(&w, c->sound_timer);
+    put_u8(&w, c->waiting_for_key);
+    put_u8(&w, c->key_target_reg);
+    put_u8(&w, c->pressed_key);
+    put_u8(&w, c->faulted);
+    put_u16(&w, c->fault_instruction);
+    put_u32(&w, c->random_state);
+    put_u64(&w, c->cycles);
+    put_u8(&w, c->quirks);
+    uint16_t keys = 0;
+    for(int i = 0; i < 16; i++){
+        keys |= (c->keys[i] != 0) << i;
+    }
+    put_u16(&w, keys);
+    put_u8(&w, c->hires);
+    put_u8(&w, c->planes);
+    put_u8(&w, c->pitch);
+    put_bytes(&w, c->flags, FLAG_REGISTERS);
+    put_bytes(&w, c->audio_pattern, AUDIO_PATTERN_SIZE);
+    const int words = display_words(c);
+    put_u16(&w, words);
+    for(int y = 0; y < words; y++){
+        put_u64(&w, c->display[y]);
+    }
+    put_memory_runs(&w, c->memory, baseline, memory_size(c));
+    if(d){
+        put_u16(&w, d->previous_instruction);
+        put_u16(&w, d->current_instruction);
+        put_u16(&w, d->next_instruction);
+        for(int i = 0; i < MEMORY_SIZE / 64; i++){
+            put_u64(&w, d->breakpoints[i]);
+        }
+        put_u16(&w, d->no_break_instructions);
+        for(int i = 0; i < d->no_break_instructions; i++){
+            put_u16(&w, d->break_instruction_masks[i]);
+            put_u16(&w, d->break_instruction_values[i]);
+        }
+        put_u16(&w, d->no_break_address_regs);
+        for(int i = 0; i < d->no_break_address_regs; i++){
+            put_u16(&w, d->break_address_reg[i]);
+        }
+        put_u16(&w, d->no_watchpoints);
+        for(int i = 0; i < d->no_watchpoints; i++){
+            put_u16(&w, d->watch_start[i]);
+            put_u16(&w, d->watch_length[i]);
+            put_u8(&w, d->watch_kind[i]);
+        }
+    }
+    if(w.pos > size){
+        return 0;
+    }
+
+    size_t payload = w.pos - STATE_HEADER_SIZE;
+    w.pos = 0;
+    put_bytes(&w, "C8ST", 4);
+    put_u16(&w, STATE_VERSION);
+    put_u16(&w, d ? STATE_FLAG_DEBUGGER : 0);
+    put_u32(&w, payload);
+    put_u32(&w, crc32c(buffer + STATE_HEADER_SIZE, payload));
+    put_u32(&w, crc32c(baseline, memory_size(c)));
+    return STATE_HEADER_SIZE + payload;
+}
+
+bool load_state(chip_8* c, debugger* d, const uint8_t* baseline, const uint8_t* buffer, size_t size){
+    reader r = {buffer, size, 0};
+    if(size < STATE_HEADER_SIZE || memcmp(get_bytes(&r, 4), "C8ST", 4) != 0){
+        fprintf(stderr, "not a save state!!!\n");
+        return false;
+    }
+    uint16_t version = get_u16(&r);
+    uint16_t flags = get_u16(&r);
+    uint32_t payload = get_u32(&r);
+    uint32_t crc = get_u32(&r);
+    uint32_t baseline_crc = get_u32(&r);
+    if(version != STATE_VERSION){
+        fprintf(stderr, "save state version %d, expected %d!!!\n", version, STATE_VERSION);
+        return false;
+    }
+    if(payload != size - STATE_HEADER_SIZE || crc32c(buffer + STATE_HEADER_SIZE, payload) != crc){
+        fprintf(stderr, "save state is damaged!!!\n");
+        return false;
+    }
+
+    //first pass only checks the layout, nothing is modified until it is known to be good
+    reader check = r;
+    get_bytes(&check, 16 + 2 + 2 + 2 * STACK_SIZE);
+    uint8_t stack_pos = get_u8(&check);
+    get_bytes(&check, 3);
+    uint8_t key_target_reg = get_u8(&check);
+    uint8_t pressed_key = get_u8(&check);
+    get_bytes(&check, 1 + 2 + 4 + 8);
+    uint8_t quirks = get_u8(&check);
+    //the cores were set up for c's profile when the rom was loaded. Checked before the baseline,
+    //which covers as much memory as the profile has
+    if(quirks != c->quirks){
+        fprintf(stderr, "save state was made with the %s quirks, not %s!!!\n", quirks_name(quirks), quirks_name(c->quirks));
+        return false;
+    }
+    if(baseline_crc != crc32c(baseline, memory_size(c))){
+        fprintf(stderr, "save state belongs to another rom!!!\n");
+        return false;
+    }
+    get_bytes(&check, 2 + 1);
+    uint8_t planes = get_u8(&check);
+    get_bytes(&check, 1 + FLAG_REGISTERS + AUDIO_PATTERN_SIZE);
+    uint16_t words = get_u16(&check);
+    get_bytes(&check, 8 * words);
+    uint16_t runs = get_u16(&check);
+    bool valid = stack_pos < STACK_SIZE && key_target_reg < 16 && (pressed_key < 16 || pressed_key == NO_KEY)
+                 && planes < (1 << DISPLAY_PLANES) && words <= DISPLAY_WORDS;
+    for(int i = 0; i < runs && valid; i++){
+        uint16_t start = get_u16(&check);
+        uint16_t length = get_u16(&check);
+        valid = start + length <= memory_size(c);
+        get_bytes(&check, length);
+    }
+    if(flags & STATE_FLAG_DEBUGGER){
+        get_bytes(&check, 6 + MEMORY_SIZE / 8);
+        uint16_t break_instructions = get_u16(&check);
+        valid = valid && break_instructions <= DEBUG_MAX_ENTRIES;
+        get_bytes(&check, 4 * break_instructions);
+        uint16_t break_address_regs = get_u16(&check);
+        valid = valid && break_address_regs <= DEBUG_MAX_ENTRIES;
+        get_bytes(&check, 2 * break_address_regs);
+        uint16_t watchpoints = get_u16(&check);
+        valid = valid && watchpoints <= DEBUG_MAX_ENTRIES;
+        for(int i = 0; i < watchpoints && valid; i++){
+            uint16_t start = get_u16(&check);
+            uint16_t length = get_u16(&check);
+            uint8_t kind = get_u8(&check);
+            valid = start + length <= MEMORY_SIZE && kind != 0 && (kind & ~(WATCH_READ | WATCH_WRITE)) == 0;
+        }
+    }
+    if(!valid || check.pos != size){
+        fprintf(stderr, "save state is damaged!!!\n");
+        return false;
+    }
+
+    for(int i = 0; i < 16; i++){
+        c->registers[i] = get_u8(&r);
+    }
+    c->address_register = get_u16(&r);
+    c->program_counter = get_u16(&r);
+    for(int i = 0; i < STACK_SIZE; i++){
+        c->stack[i] = get_u16(&r);
+    }
+    c->stack_pos = get_u8(&r);
+    c->delay_timer = get_u8(&r);
+    c->sound_timer = get_u8(&r);
+    c->waiting_for_key = get_u8(&r);
+    c->key_target_reg = get_u8(&r);
+    c->pressed_key = get_u8(&r);
+    c->faulted = get_u8(&r);
+    c->fault_instruction = get_u16(&r);
+    c->random_state = get_u32(&r);
+    c->cycles = get_u64(&r);
+    get_u8(&r); //quirks, checked above
+    uint16_t keys = get_u16(&r);
+    for(int i = 0; i < 16; i++){
+        c->keys[i] = (keys >> i) & 1;
+    }
+    c->hires = get_u8(&r);
+    c->planes = get_u8(&r);
+    c->pitch = get_u8(&r);
+    memcpy(c->flags, get_bytes(&r, FLAG_REGISTERS), FLAG_REGISTERS);
+    memcpy(c->audio_pattern, get_bytes(&r, AUDIO_PATTERN_SIZE), AUDIO_PATTERN_SIZE);
+    words = get_u16(&r);
+    memset(c->display, 0, sizeof(c->display));
+    for(int y = 0; y < words; y++){
+        c->display[y] = get_u64(&r);
+    }
+
+    uint8_t memory[EXTENDED_MEMORY_SIZE];
+    const int memory_bytes = memory_size(c);
+    memcpy(memory, baseline, memory_bytes);
+    runs = get_u16(&r);
+    for(int i = 0; i < runs; i++){
+        uint16_t start = get_u16(&r);
+        uint16_t length = get_u16(&r);
+        memcpy(memory + start, get_bytes(&r, length), length);
+    }
+    //only bytes that really change go through memory_written, so the decode cache and the jit
+    //keep everything else. Nothing runs from above MEMORY_SIZE
+    for(int block = 0; block < memory_bytes; block += 64){
+        if(memcmp(memory + block, c->memory + block, 64) == 0) continue;
+        for(int i = block; i < block + 64; i++){
+            if(memory[i] == c->memory[i]) continue;
+            int start = i;
+            while(i < block + 64 && memory[i] != c->memory[i]) i++;
+            memcpy(c->memory + start, memory + start, i - start);
+            if(start < MEMORY_SIZE){
+                memory_written(c, start, i - start);
+            }
+        }
+    }
+
+    if(flags & STATE_FLAG_DEBUGGER){
+        debugger loaded;
+        loaded.previous_instruction = get_u16(&r);
+        loaded.current_instruction = get_u16(&r);
+        loaded.next_instruction = get_u16(&r);
+        for(int i = 0; i < MEMORY_SIZE / 64; i++){
+            loaded.breakpoints[i] = get_u64(&r);
+        }
+        loaded.no_break_instructions = get_u16(&r);
+        for(int i = 0; i < loaded.no_break_instructions; i++){
+            loaded.break_instruction_masks[i] = get_u16(&r);
+            loaded.break_instruction_values[i] = get_u16(&r);
+        }
+        loaded.no_break_address_regs = get_u16(&r);
+        for(int i = 0; i < loaded.no_break_address_regs; i++){
+            loaded.break_address_reg[i] = get_u16(&r);
+        }
+        loaded.no_watchpoints = get_u16(&r);
+        for(int i = 0; i < loaded.no_watchpoints; i++){
+            loaded.watch_start[i] = get_u16(&r);
+            loaded.watch_length[i] = get_u16(&r);
+            loaded.watch_kind[i] = get_u8(&r);
+        }
+        if(d){
+            d->previous_instruction = loaded.previous_instruction;
+            d->current_instruction = loaded.current_instruction;
+            d->next_instruction = loaded.next_instruction;
+            memcpy(d->breakpoints, loaded.breakpoints, sizeof(d->breakpoints));
+            d->no_break_instructions = loaded.no_break_instructions;
+            memcpy(d->break_instruction_masks, loaded.break_instruction_masks, sizeof(d->break_instruction_masks));
+            memcpy(d->break_instruction_values, loaded.break_instruction_values, sizeof(d->break_instruction_values));
+            d->no_break_address_regs = loaded.no_break_address_regs;
+            memcpy(d->break_address_reg, loaded.break_address_reg, sizeof(d->break_address_reg));
+            d->no_watchpoints = loaded.no_watchpoints;
+            memcpy(d->watch_start, loaded.watch_start, sizeof(d->watch_start));
+            memcpy(d->watch_length, loaded.watch_length, sizeof(d->watch_length));
+            memcpy(d->watch_kind, loaded.watch_kind, sizeof(d->watch_kind));
+            d->event = DEBUG_NONE;
+            debugger_changed(d);
+        }
+    }
+    return true;
+}
+
+bool save_state_file(const chip_8* c, const debugger* d, const uint8_t* baseline, const char* filename){
+    uint8_t buffer[STATE_MAX_SIZE];
+    size_t size = save_state(c, d, baseline, buffer, sizeof(buffer));
+    //checked before the file is opened, so a failed save leaves an existing state alone
+    if(size == 0){
+        fprintf(stderr, "save state too large!!!\n");
+        return false;
+    }
+    FILE* fp = fopen(filename, "wb");
+    if(!fp){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    bool ok = fwrite(buffer, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+    if(!ok){
+        fprintf(stderr, "could not write save state!!!\n");
+    }
+    return ok;
+}
+
+bool load_state_file(chip_8* c, debugger* d, const uint8_t* baseline, const char* filename){
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "could not open file!!!\n");
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < STATE_HEADER_SIZE || st.st_size > STATE_MAX_SIZE){
+        fprintf(stderr, "not a save state!!!\n");
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "could not map file!!!\n");
+        return false;
+    }
+    bool ok = load_state(c, d, baseline, data, st.st_size);
+    munmap(data, st.st_size);
+    return ok;
+}
@@ -0,0 +1,36 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//binary save states. All values are little endian:
+//  header  "C8ST", version u16, flags u16, payload size u32, payload crc32c u32, baseline crc32c u32
+//  payload cpu state, quirk profile, keys, display mode, planes, pitch, flag registers, audio pattern,
+//          display word count and words, memory runs, optional debugger section (breakpoint bitmap and
+//          the opcode, address register and watchpoint lists)
+//memory is stored as runs of bytes that differ from the baseline, the memory image init_chip_8()
+//and load_program() produce for the rom. Loading needs the same baseline and quirk profile and
+//restores every other field.
+//the debugger pointer may be NULL on either side, the section is then skipped
+
+#define STATE_VERSION 5
+#define STATE_HEADER_SIZE 20
+#define STATE_MAX_SIZE 0x12000 //header, fixed fields and the worst case memory diff of XO-CHIP's 64 KB
+
+//returns the number of bytes written to buffer, 0 if it is too small
+size_t save_state(const chip_8* c, const debugger* d, const uint8_t* baseline, uint8_t* buffer, size_t size);
+//checks the whole state before changing c or d, false if it is damaged or for another rom
+bool load_state(chip_8* c, debugger* d, const uint8_t* baseline, const uint8_t* buffer, size_t size);
+
+bool save_state_file(const chip_8* c, const debugger* d, const uint8_t* baseline, const char* filename);
+//maps the file instead of reading it, the state is copied out of the mapping once
+bool load_state_file(chip_8* c, debugger* d, const uint8_t* baseline, const char* filename);
+
+uint32_t crc32c(const uint8_t* data, size_t size);
+
+#endif
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "server.h"
+
+
+//serves chip_8 sessions to other processes over a unix domain socket, see server.h for the
+//protocol. One thread, level triggered epoll. Every complete request in a read is handled before
+//the next epoll_wait, and each reply goes out with one writev straight from the session's chip.
+//Only when the socket is full is the rest of a reply copied, and the session then waits for it
+//to drain before handling more requests
+
+#define MAX_EVENTS 64
+#define READ_BUFFER_SIZE (sizeof(server_request) + sizeof(server_load) + SERVER_MAX_ROM_SIZE)
+#define OUT_BUFFER_SIZE (sizeof(server_reply) + DISPLAY_WORDS * sizeof(uint64_t) + 16)
+
+_Static_assert(sizeof(server_request) == 8, "requests are read as is");
+_Static_assert(sizeof(server_load) == 16, "requests are read as is");
+_Static_assert(sizeof(server_step) == 8, "requests are read as is");
+_Static_assert(sizeof(server_reply) == 32, "replies are written as is");
+
+typedef struct{
+    int fd;
+    chip_8* chip;
+    bool loaded;
+    int instructions_per_frame;
+    uint32_t seed;
+    uint8_t core;
+    uint8_t rom[SERVER_MAX_ROM_SIZE]; //kept for SERVER_RESET
+    int rom_size;
+    uint8_t in[READ_BUFFER_SIZE];
+    size_t in_used;
+    uint8_t out[OUT_BUFFER_SIZE]; //the part of the last reply the socket didn't take
+    size_t out_pending;
+    size_t out_sent;
+}session;
+
+typedef struct{
+    const char* path;
+}server_options;
+
+void print_usage(void){
+    fprintf(stderr, "./server.out socketpath\n");
+    fprintf(stderr, "listens on a unix domain socket, one chip-8 per connection, protocol in server.h\n");
+}
+
+bool parse_args(server_options* opt, int argc, char** argv){
+    opt->path = NULL;
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        if(arg[0] == '-' || opt->path != NULL){
+            return false;
+        }
+        opt->path = arg;
+    }
+    return opt->path != NULL;
+}
+
+static session* open_session(int fd){
+    session* s = malloc(sizeof(session));
+    chip_8* c = malloc(sizeof(chip_8));
+    if(!s || !c){
+        free(s);
+        free(c);
+        return NULL;
+    }
+    s->fd = fd;
+    s->chip = c;
+    s->loaded = false;
+    s->in_used = 0;
+    s->out_pending = 0;
+    s->out_sent = 0;
+    init_chip_8(c);
+    return s;
+}
+
+static void close_session(int epoll_fd, session* s){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    jit_free(s->chip);
+    free(s->chip);
+    free(s);
+}
+
+//starts the kept rom over, false if the profile or the core doesn't take it
+static bool start_session(session* s, uint8_t quirks){
+    chip_8* c = s->chip;
+    jit_free(c);
+    init_chip_8(c);
+    c->quirks = quirks;
+    seed_random(c, s->seed);
+    if(!load_program_data(c, s->rom, s->rom_size)){
+        return false;
+    }
+    c->core = s->core;
+    return s->core != CORE_JIT || jit_init(c);
+}
+
+static uint8_t load_session(session* s, const uint8_t* payload, uint32_t size){
+    server_load load;
+    if(size < sizeof(load) || size - sizeof(load) > SERVER_MAX_ROM_SIZE){
+        return SERVER_BAD_REQUEST;
+    }
+    memcpy(&load, payload, sizeof(load));
+    if(load.quirks >= QUIRKS_COUNT || load.core > CORE_JIT || load.instructions_per_frame == 0
+       || load.instructions_per_frame > INT32_MAX){
+        return SERVER_BAD_REQUEST;
+    }
+    s->rom_size = size - sizeof(load);
+    memcpy(s->rom, payload + sizeof(load), s->rom_size);
+    s->instructions_per_frame = load.instructions_per_frame;
+    s->seed = load.seed;
+    s->core = load.core;
+    s->loaded = start_session(s, load.quirks);
+    return s->loaded ? SERVER_OK : SERVER_LOAD_FAILED;
+}
+
+static uint8_t step_session(session* s, const uint8_t* payload, uint32_t size){
+    server_step step;
+    if(size != sizeof(step)){
+        return SERVER_BAD_REQUEST;
+    }
+    if(!s->loaded){
+        return SERVER_NOT_LOADED;
+    }
+    memcpy(&step, payload, sizeof(step));
+    chip_8* c = s->chip;
+    for(int k = 0; k < 16; k++){
+        c->keys[k] = (step.keys >> k) & 1;
+    }
+    for(uint32_t f = 0; f < step.frames && !c->faulted; f++){
+        run_frame(c, s->instructions_per_frame);
+    }
+    return SERVER_OK;
+}
+
+static uint8_t handle_request(session* s, const server_request* r, const uint8_t* payload){
+    switch(r->type){
+        case SERVER_LOAD:
+            return load_session(s, payload, r->size);
+        case SERVER_RESET:
+            if(r->size != 0) return SERVER_BAD_REQUEST;
+            if(!s->loaded) return SERVER_NOT_LOADED;
+            s->loaded = start_session(s, s->chip->quirks);
+            return s->loaded ? SERVER_OK : SERVER_LOAD_FAILED;
+        case SERVER_STEP:
+            return step_session(s, payload, r->size);
+        default:
+            return SERVER_BAD_REQUEST;
+    }
+}
+
+//false if the connection is gone
+static bool send_reply(session* s, uint8_t type, uint8_t status){
+    const chip_8* c = s->chip;
+    server_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = type;
+    reply.status = status;
+    struct iovec iov[3];
+    int count = 1;
+    iov[0].iov_base = &reply;
+    iov[0].iov_len = sizeof(reply);
+    if(status == SERVER_OK){
+        int words = display_words(c);
+        reply.hires = c->hires;
+        reply.planes = quirk_flags[c->quirks] & QUIRK_XO ? DISPLAY_PLANES : 1;
+        reply.cycles = c->cycles;
+        reply.program_counter = c->program_counter;
+        reply.address_register = c->address_register;
+        reply.display_words = words;
+        reply.fault_instruction = c->fault_instruction;
+        reply.stack_pos = c->stack_pos;
+        reply.delay_timer = c->delay_timer;
+        reply.sound_timer = c->sound_timer;
+        reply.faulted = c->faulted;
+        iov[1].iov_base = (void*)c->display;
+        iov[1].iov_len = words * sizeof(c->display[0]);
+        iov[2].iov_base = (void*)c->registers;
+        iov[2].iov_len = sizeof(c->registers);
+        reply.size = iov[1].iov_len + iov[2].iov_len;
+        count = 3;
+    }
+    size_t total = sizeof(reply) + reply.size;
+    ssize_t sent = writev(s->fd, iov, count);
+    if(sent < 0){
+        if(errno != EAGAIN && errno != EWOULDBLOCK) return false;
+        sent = 0;
+    }
+    if((size_t)sent == total){
+        return true;
+    }
+    //the socket is full, keep what it didn't take
+    size_t pending = 0;
+    for(int i = 0; i < count; i++){
+        size_t skip = (size_t)sent < iov[i].iov_len ? (size_t)sent : iov[i].iov_len;
+        sent -= skip;
+        memcpy(s->out + pending, (const uint8_t*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        pending += iov[i].iov_len - skip;
+    }
+    s->out_pending = pending;
+    s->out_sent = 0;
+    return true;
+}
+
+//false if the connection is gone
+static bool flush_pending(session* s){
+    while(s->out_sent < s->out_pending){
+        ssize_t sent = write(s->fd, s->out + s->out_sent, s->out_pending - s->out_sent);
+        if(sent < 0){
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        s->out_sent += sent;
+    }
+    s->out_pending = 0;
+    s->out_sent = 0;
+    return true;
+}
+
+//handles every complete request in the buffer, stops early while a reply is pending.
+//false if the session has to be closed
+static bool handle_requests(session* s){
+    size_t pos = 0;
+    while(s->out_pending == 0 && s->in_used - pos >= sizeof(server_request)){
+        server_request r;
+        memcpy(&r, s->in + pos, sizeof(r));
+        if(r.size > READ_BUFFER_SIZE - sizeof(r)){
+            return false;
+        }
+        if(s->in_used - pos < sizeof(r) + r.size) break;
+        uint8_t status = handle_request(s, &r, s->in + pos + sizeof(r));
+        pos += sizeof(r) + r.size;
+        if(!send_reply(s, r.type, status)){
+            return false;
+        }
+    }
+    memmove(s->in, s->in + pos, s->in_used - pos);
+    s->in_used -= pos;
+    return true;
+}
+
+//reading stops while a reply is pending, so a client that doesn't read can't grow the queue
+static void watch_session(int epoll_fd, session* s){
+    struct epoll_event ev;
+    ev.events = s->out_pending ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = s;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+static bool session_event(session* s, uint32_t events){
+    if(events & EPOLLOUT){
+        if(!flush_pending(s)) return false;
+        //requests may have been left in the buffer while the reply was pending
+        return s->out_pending != 0 || handle_requests(s);
+    }
+    if(events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)){
+        return false;
+    }
+    ssize_t got = read(s->fd, s->in + s->in_used, sizeof(s->in) - s->in_used);
+    if(got == 0){
+        return false;
+    }
+    if(got < 0){
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    s->in_used += got;
+    return handle_requests(s);
+}
+
+static int open_listener(const char* path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "socket path too long!!!\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    //a socket left behind by an earlier run, anything else is left alone and bind() fails
+    struct stat st;
+    if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode)){
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+        fprintf(stderr, "could not open socket!!!\n");
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_sessions(int epoll_fd, int listen_fd){
+    for(;;){
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) return;
+        session* s = open_session(fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        if(!s || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0){
+            fprintf(stderr, "out of memory\n");
+            if(s){
+                jit_free(s->chip);
+                free(s->chip);
+                free(s);
+            }
+            close(fd);
+        }
+    }
+}
+
+int main(int argc, char** argv){
+    server_options opt;
+    if(!parse_args(&opt, argc, argv)){
+        print_usage();
+        return 1;
+    }
+    //a client going away mid reply shows up as EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+    int listen_fd = open_listener(opt.path);
+    if(listen_fd < 0){
+        return 1;
+    }
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; //the listener, sessions carry their session
+    if(epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0){
+        fprintf(stderr, "could not open socket!!!\n");
+        return 1;
+    }
+    fprintf(stderr, "listening on %s\n", opt.path);
+    struct epoll_event events[MAX_EVENTS];
+    for(;;){
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            fprintf(stderr, "epoll_wait failed!!!\n");
+            return 1;
+        }
+        for(int i = 0; i < n; i++){
+            session* s = events[i].data.ptr;
+            if(!s){
+                accept_sessions(epoll_fd, listen_fd);
+                continue;
+            }
+            bool was_pending = s->out_pending != 0;
+            if(!session_event(s, events[i].events)){
+                close_session(epoll_fd, s);
+            }
+            else if(was_pending != (s->out_pending != 0)){
+                watch_session(epoll_fd, s);
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+
+//protocol of server.out, which runs one chip_8 per connection on a unix domain stream socket.
+//Every request is a server_request followed by size bytes of payload and gets exactly one
+//server_reply back, followed by the observation when the status is SERVER_OK. Requests may be
+//pipelined, replies come in order. All fields are in host byte order, both ends are on one machine
+//
+//  SERVER_LOAD   server_load followed by the rom, starts the session over with it
+//  SERVER_RESET  no payload, starts the loaded rom over with the seed it was loaded with
+//  SERVER_STEP   server_step, sets the keys and runs frames frames, 0 only observes
+//
+//the observation is the display, reply.display_words words laid out as chip_8.display (bit 63 of
+//a word is the leftmost pixel), followed by V0..VF
+
+#define SERVER_MAX_ROM_SIZE (0x10000 - 0x200) //EXTENDED_MEMORY_SIZE - LOAD_ADDRESS
+
+enum{
+    SERVER_LOAD = 1,
+    SERVER_RESET,
+    SERVER_STEP
+};
+
+//reply status
+enum{
+    SERVER_OK = 0,
+    SERVER_BAD_REQUEST, //unknown type, wrong payload size or bad field
+    SERVER_NOT_LOADED, //SERVER_RESET or SERVER_STEP before a rom was loaded
+    SERVER_LOAD_FAILED //rom too large for the profile, or the core isn't available
+};
+
+typedef struct{
+    uint32_t size; //payload bytes that follow
+    uint8_t type;
+    uint8_t reserved[3];
+}server_request;
+
+typedef struct{
+    uint8_t quirks; //quirk_profile
+    uint8_t core; //CORE_CACHED, CORE_SWITCH or CORE_JIT
+    uint8_t reserved[2];
+    uint32_t instructions_per_frame;
+    uint32_t seed;
+    uint32_t reserved2;
+}server_load;
+
+typedef struct{
+    uint16_t keys; //bit n set while key n is down
+    uint8_t reserved[2];
+    uint32_t frames;
+}server_step;
+
+typedef struct{
+    uint32_t size; //observation bytes that follow, 0 unless status is SERVER_OK
+    uint8_t type; //of the request
+    uint8_t status;
+    uint8_t hires; //rows are two words in the 128x64 mode, one in 64x32
+    uint8_t planes; //the rows of the second plane follow those of the first
+    uint64_t cycles;
+    uint16_t program_counter;
+    uint16_t address_register;
+    uint16_t display_words;
+    uint16_t fault_instruction;
+    uint8_t stack_pos;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t faulted;
+    uint8_t reserved[4];
+}server_reply;
+
+#endif
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "trace.h"
+
+
+#define TRACE_MIN_RECORDS 16
+#define TRACE_MAX_RECORDS (1ULL << 32)
+
+_Static_assert(sizeof(trace_record) == 32, "trace records are written to disk as is");
+_Static_assert(sizeof(trace_header) == 64, "trace headers are written to disk as is");
+
+bool trace_open(chip_8* c, const char* path, uint64_t records){
+    if(records > TRACE_MAX_RECORDS){
+        chip8_error("trace too large!!!\n");
+        return false;
+    }
+    uint64_t capacity = TRACE_MIN_RECORDS;
+    while(capacity < records){
+        capacity <<= 1;
+    }
+    struct tracer* t = malloc(sizeof(struct tracer));
+    if(!t){
+        chip8_error("out of memory\n");
+        return false;
+    }
+    t->map_size = sizeof(trace_header) + capacity * sizeof(trace_record);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        chip8_error("could not open file!!!\n");
+        free(t);
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if(ftruncate(fd, t->map_size) == 0){
+        map = mmap(NULL, t->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    //the mapping keeps the file
+    close(fd);
+    if(map == MAP_FAILED){
+        chip8_error("could not map trace file!!!\n");
+        free(t);
+        return false;
+    }
+    t->header = map;
+    t->records = (trace_record*)(t->header + 1);
+    t->mask = capacity - 1;
+    t->written = 0;
+    //faults every page in now instead of one at a time while tracing
+    memset(t->header, 0, t->map_size);
+    memcpy(t->header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    t->header->version = TRACE_VERSION;
+    t->header->record_size = sizeof(trace_record);
+    t->header->capacity = capacity;
+    c->trace = t;
+    return true;
+}
+
+bool trace_close(chip_8* c){
+    struct tracer* t = c->trace;
+    if(!t){
+        return true;
+    }
+    t->header->written = t->written;
+    bool ok = munmap(t->header, t->map_size) == 0;
+    free(t);
+    c->trace = NULL;
+    if(!ok){
+        chip8_error("could not write trace file!!!\n");
+    }
+    return ok;
+}
+
+//which registers each instruction writes. Reading back just those is much cheaper than comparing
+//the whole register file: a 16 byte load right after step()'s single byte stores can't be
+//forwarded from the store buffer and stalls until they reach the cache
+#define WRITES_X 1
+#define WRITES_VF 2
+#define WRITES_MANY 4 //Fx65 and the like, which are rare enough to take the stall
+
+static const uint8_t register_writes[OP_COUNT] = {
+    [OP_LOAD_IMM] = WRITES_X,
+    [OP_ADD_IMM] = WRITES_X,
+    [OP_MOV] = WRITES_X,
+    [OP_BIT_OR] = WRITES_X,
+    [OP_BIT_AND] = WRITES_X,
+    [OP_BIT_XOR] = WRITES_X,
+    [OP_ADD_REG] = WRITES_X | WRITES_VF,
+    [OP_SUB_REG] = WRITES_X | WRITES_VF,
+    [OP_SHIFT_RIGHT] = WRITES_X | WRITES_VF,
+    [OP_SUB_REG_SWITCH] = WRITES_X | WRITES_VF,
+    [OP_SHIFT_LEFT] = WRITES_X | WRITES_VF,
+    [OP_RAND_MOD] = WRITES_X,
+    [OP_DRAW_SPRITE] = WRITES_VF,
+    [OP_GET_DELAY] = WRITES_X,
+    [OP_REG_LOAD] = WRITES_MANY,
+    [OP_LOAD_FLAGS] = WRITES_MANY,
+    [OP_LOAD_RANGE] = WRITES_MANY
+};
+
+#if defined(__SSE2__)
+typedef __m128i register_file;
+
+static inline register_file load_registers(const chip_8* c){
+    return _mm_loadu_si128((const __m128i*)c->registers);
+}
+
+//the register file after an instruction with the given writes to x, and the registers that changed
+static inline register_file update_registers(register_file before, const chip_8* c, uint8_t writes, uint8_t x, uint16_t* changed){
+    register_file after;
+    if(writes & WRITES_MANY){
+        after = load_registers(c);
+    }
+    else{
+        const __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i lane_x = _mm_and_si128(_mm_cmpeq_epi8(_mm_set1_epi8(x), lanes), _mm_set1_epi8(-(writes & WRITES_X)));
+        __m128i lane_vf = _mm_and_si128(_mm_cmpeq_epi8(_mm_set1_epi8(VF), lanes), _mm_set1_epi8(-((writes & WRITES_VF) >> 1)));
+        after = _mm_or_si128(_mm_andnot_si128(lane_x, before), _mm_and_si128(lane_x, _mm_set1_epi8(c->registers[x])));
+        after = _mm_or_si128(_mm_andnot_si128(lane_vf, after), _mm_and_si128(lane_vf, _mm_set1_epi8(c->registers[VF])));
+    }
+    *changed = ~_mm_movemask_epi8(_mm_cmpeq_epi8(before, after));
+    return after;
+}
+
+static inline void store_registers(uint8_t* out, register_file r){
+    _mm_storeu_si128((__m128i*)out, r);
+}
+#else
+typedef struct{
+    uint8_t v[16];
+}register_file;
+
+static inline register_file load_registers(const chip_8* c){
+    register_file r;
+    memcpy(r.v, c->registers, sizeof(r.v));
+    return r;
+}
+
+static inline register_file update_registers(register_file before, const chip_8* c, uint8_t writes, uint8_t x, uint16_t* changed){
+    (void)writes;
+    (void)x;
+    register_file after = load_registers(c);
+    *changed = 0;
+    for(int k = 0; k < 16; k++){
+        *changed |= (uint16_t)(before.v[k] != after.v[k]) << k;
+    }
+    return after;
+}
+
+static inline void store_registers(uint8_t* out, register_file r){
+    memcpy(out, r.v, sizeof(r.v));
+}
+#endif
+
+//the same loop as run_steps() in chip8.c with a record after every instruction. The ring position
+//stays in locals, record stores would otherwise make the compiler reload it every time
+bool trace_run_instructions(chip_8* c, int count){
+    struct tracer* t = c->trace;
+    trace_record* const records = t->records;
+    const uint64_t mask = t->mask;
+    uint64_t written = t->written;
+    bool drew = false;
+    int i = 0;
+    //registers may have been changed from outside since the last call
+    register_file registers = load_registers(c);
+    while(i < count){
+        uint16_t pc = c->program_counter & (MEMORY_SIZE - 1);
+        uint16_t opcode = (c->memory[pc] << 8) | c->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+        uint32_t cycles = c->cycles + i;
+        bool waiting = c->waiting_for_key;
+        //decoded before it runs, in case it overwrites itself. The cache has it unless a
+        //breakpoint sits on it
+        decoded_instruction d = c->decoded[pc];
+        if(d.op == OP_UNDECODED || d.op >= OP_NOT_IMPLEMENTED){
+            d = profile_instruction(decode_instruction(opcode), quirk_flags[c->quirks]);
+        }
+        int res = step(c);
+        //neither a key wait nor a breakpoint stop has run an instruction worth a record
+        if(res == 1 || res == 3){
+            step_budget(c, res, &i, count);
+            break;
+        }
+        //the end of a key wait wrote another register before the instruction ran
+        uint8_t writes = waiting ? WRITES_MANY : register_writes[d.op];
+        uint16_t changed;
+        registers = update_registers(registers, c, writes, d.x, &changed);
+        trace_record* r = &records[written++ & mask];
+        r->pc = pc;
+        r->opcode = opcode;
+        r->address_register = c->address_register;
+        r->changed = changed;
+        store_registers(r->registers, registers);
+        r->stack_pos = c->stack_pos;
+        r->delay_timer = c->delay_timer;
+        r->sound_timer = c->sound_timer;
+        r->flags = (res == 2 ? TRACE_DREW : 0) | (waiting ? TRACE_KEY : 0) | (c->faulted ? TRACE_FAULT : 0);
+        r->cycles = cycles;
+        if(res == 2){
+            drew = true;
+        }
+        //a faulting instruction hasn't run either, but its record is the one worth having
+        if(!step_budget(c, res, &i, count)) break;
+    }
+    c->cycles += i;
+    t->written = written;
+    t->header->written = written;
+    return drew;
+}
+
+bool trace_file_open(trace_file* f, const char* path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        chip8_error("could not open file!!!\n");
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(trace_header)){
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED){
+        chip8_error("not a trace file!!!\n");
+        return false;
+    }
+    const trace_header* h = map;
+    uint64_t capacity = h->capacity;
+    bool valid = memcmp(h->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && h->version == TRACE_VERSION
+                 && h->record_size == sizeof(trace_record) && capacity > 0 && capacity <= TRACE_MAX_RECORDS
+                 && (capacity & (capacity - 1)) == 0
+                 && (size_t)st.st_size >= sizeof(trace_header) + capacity * sizeof(trace_record);
+    if(!valid){
+        chip8_error("not a trace file!!!\n");
+        munmap(map, st.st_size);
+        return false;
+    }
+    f->header = h;
+    f->records = (const trace_record*)(h + 1);
+    f->map_size = st.st_size;
+    //a trace that is still being written keeps moving, this is where it was on opening
+    f->end = h->written;
+    f->first = f->end > capacity ? f->end - capacity : 0;
+    return true;
+}
+
+void trace_file_close(trace_file* f){
+    munmap((void*)f->header, f->map_size);
+    f->header = NULL;
+    f->records = NULL;
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//binary execution trace. While a trace is open run_instructions() goes through step() and writes
+//one fixed-size record per instruction into a ring file mapped into memory, so the newest records
+//survive even when the process dies. The header's record count is brought up to date at the end
+//of every run_instructions() call. tracedump.out prints, filters and diffs the files
+
+#define TRACE_MAGIC "C8TRACE"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RECORDS (1 << 20) //32 MiB
+
+//record flags
+#define TRACE_DREW 1
+#define TRACE_KEY 2 //an Fx0A wait ended right before this instruction, which may explain a changed register
+#define TRACE_FAULT 4 //not implemented, the state is the one the fault left
+
+typedef struct{
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t address_register; //after the instruction, like everything below
+    uint16_t changed; //bit n set if Vn changed
+    uint8_t registers[16];
+    uint8_t stack_pos;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t flags;
+    uint32_t cycles; //low bits of chip_8.cycles before the instruction
+}trace_record;
+
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity; //records in the ring, a power of two
+    uint64_t written; //records ever written, record n is at n % capacity
+    uint8_t reserved[32];
+}trace_header;
+
+struct tracer{
+    trace_header* header;
+    trace_record* records;
+    uint64_t mask;
+    uint64_t written;
+    size_t map_size;
+};
+
+//creates or truncates path with room for records records, rounded up to a power of two, and
+//starts tracing every instruction c runs
+bool trace_open(chip_8* c, const char* path, uint64_t records);
+//false if the file couldn't be finished
+bool trace_close(chip_8* c);
+
+//same contract as run_instructions(), which calls it while a trace is open
+bool trace_run_instructions(chip_8* c, int count);
+
+//a finished or still growing trace file, mapped read-only
+typedef struct{
+    const trace_header* header;
+    const trace_record* records;
+    size_t map_size;
+    uint64_t first; //oldest record still in the ring
+    uint64_t end; //one past the newest
+}trace_file;
+
+bool trace_file_open(trace_file* f, const char* path);
+void trace_file_close(trace_file* f);
+//record n, first <= n < end
+static inline const trace_record* trace_file_record(const trace_file* f, uint64_t n){
+    return &f->records[n & (f->header->capacity - 1)];
+}
+
+#endif
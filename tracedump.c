@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "trace.h"
+
+
+//prints the records of a --trace file, oldest first, or finds where two traces diverge
+
+#define DIFF_CONTEXT 8 //records shown before the first difference
+
+typedef struct{
+    bool diff;
+    const char* files[2];
+    int file_count;
+    uint16_t pc_low, pc_high;
+    uint16_t op_low, op_high;
+    uint64_t last; //0 for all
+}options;
+
+void print_usage(void){
+    fprintf(stderr, "./tracedump.out [options] tracefile\n");
+    fprintf(stderr, "./tracedump.out --diff tracefile tracefile\n");
+    fprintf(stderr, "  --pc LOW[-HIGH]     only records with pc in the range, hex\n");
+    fprintf(stderr, "  --op LOW[-HIGH]     only records with the opcode in the range, hex, e.g. 8000-8fff\n");
+    fprintf(stderr, "  --last N            only the newest N records\n");
+    fprintf(stderr, "  --diff              compare two traces record by record, stop at the first difference\n");
+}
+
+static bool parse_range(const char* s, uint16_t* low, uint16_t* high){
+    char* end;
+    unsigned long a = strtoul(s, &end, 16);
+    unsigned long b = a;
+    if(*end == '-'){
+        b = strtoul(end + 1, &end, 16);
+    }
+    if(*end != '\0' || a > 0xffff || b > 0xffff || a > b){
+        return false;
+    }
+    *low = a;
+    *high = b;
+    return true;
+}
+
+bool parse_args(options* opt, int argc, char** argv){
+    opt->diff = false;
+    opt->file_count = 0;
+    opt->pc_low = 0;
+    opt->pc_high = 0xffff;
+    opt->op_low = 0;
+    opt->op_high = 0xffff;
+    opt->last = 0;
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if(strcmp(arg, "--diff") == 0){
+            opt->diff = true;
+        }
+        else if(strcmp(arg, "--pc") == 0 && has_value){
+            if(!parse_range(argv[++i], &opt->pc_low, &opt->pc_high)) return false;
+        }
+        else if(strcmp(arg, "--op") == 0 && has_value){
+            if(!parse_range(argv[++i], &opt->op_low, &opt->op_high)) return false;
+        }
+        else if(strcmp(arg, "--last") == 0 && has_value){
+            opt->last = strtoull(argv[++i], NULL, 0);
+        }
+        else if(arg[0] == '-' || opt->file_count == 2){
+            return false;
+        }
+        else{
+            opt->files[opt->file_count++] = arg;
+        }
+    }
+    return opt->file_count == (opt->diff ? 2 : 1);
+}
+
+static void print_record(uint64_t n, const trace_record* r){
+    char mnemonic[64];
+    FILE* fp = fmemopen(mnemonic, sizeof(mnemonic), "w");
+    if(fp){
+        fprint_instruction(fp, r->opcode);
+        fclose(fp);
+    }
+    else{
+        mnemonic[0] = '\0';
+    }
+    printf("%10llu  %10u  0x%03x  %04x  %-32s I=0x%04x sp=%d dt=%d st=%d",
+           (unsigned long long)n, r->cycles, r->pc, r->opcode, mnemonic,
+           r->address_register, r->stack_pos, r->delay_timer, r->sound_timer);
+    for(int k = 0; k < 16; k++){
+        if(r->changed & (1 << k)){
+            printf(" V%X=0x%02x", k, r->registers[k]);
+        }
+    }
+    if(r->flags & TRACE_DREW) printf(" drew");
+    if(r->flags & TRACE_KEY) printf(" key");
+    if(r->flags & TRACE_FAULT) printf(" fault");
+    printf("\n");
+}
+
+static void print_heading(void){
+    printf("%10s  %10s  %-5s  %-4s  %-32s state after\n", "#record", "cycles", "pc", "op", "instruction");
+}
+
+static int dump(const options* opt){
+    trace_file f;
+    if(!trace_file_open(&f, opt->files[0])){
+        return 1;
+    }
+    uint64_t first = f.first;
+    if(opt->last > 0 && f.end - first > opt->last){
+        first = f.end - opt->last;
+    }
+    printf("#%llu records written, %llu kept\n", (unsigned long long)f.end, (unsigned long long)(f.end - f.first));
+    print_heading();
+    for(uint64_t n = first; n < f.end; n++){
+        const trace_record* r = trace_file_record(&f, n);
+        if(r->pc < opt->pc_low || r->pc > opt->pc_high || r->opcode < opt->op_low || r->opcode > opt->op_high) continue;
+        print_record(n, r);
+    }
+    trace_file_close(&f);
+    return 0;
+}
+
+static void print_differences(const trace_record* a, const trace_record* b){
+    printf("differs in:");
+    if(a->pc != b->pc) printf(" pc");
+    if(a->opcode != b->opcode) printf(" opcode");
+    if(a->address_register != b->address_register) printf(" I");
+    for(int k = 0; k < 16; k++){
+        if(a->registers[k] != b->registers[k]) printf(" V%X", k);
+    }
+    if(a->stack_pos != b->stack_pos) printf(" sp");
+    if(a->delay_timer != b->delay_timer) printf(" dt");
+    if(a->sound_timer != b->sound_timer) printf(" st");
+    if(a->flags != b->flags) printf(" flags");
+    if(a->cycles != b->cycles) printf(" cycles");
+    printf("\n");
+}
+
+//records with the same number ran at the same point of both runs if both started from the same state
+static int diff(const options* opt){
+    trace_file a, b;
+    if(!trace_file_open(&a, opt->files[0])){
+        return 1;
+    }
+    if(!trace_file_open(&b, opt->files[1])){
+        trace_file_close(&a);
+        return 1;
+    }
+    uint64_t first = a.first > b.first ? a.first : b.first;
+    uint64_t end = a.end < b.end ? a.end : b.end;
+    int res = 0;
+    if(first >= end){
+        printf("no records in common: %s has %llu-%llu, %s has %llu-%llu\n",
+               opt->files[0], (unsigned long long)a.first, (unsigned long long)a.end,
+               opt->files[1], (unsigned long long)b.first, (unsigned long long)b.end);
+        res = 1;
+    }
+    for(uint64_t n = first; n < end && res == 0; n++){
+        const trace_record* ra = trace_file_record(&a, n);
+        const trace_record* rb = trace_file_record(&b, n);
+        if(memcmp(ra, rb, sizeof(trace_record)) == 0) continue;
+        printf("first difference at record %llu\n", (unsigned long long)n);
+        print_heading();
+        uint64_t context = n - first > DIFF_CONTEXT ? n - DIFF_CONTEXT : first;
+        for(uint64_t k = context; k < n; k++){
+            print_record(k, trace_file_record(&a, k));
+        }
+        printf("%s:\n", opt->files[0]);
+        print_record(n, ra);
+        printf("%s:\n", opt->files[1]);
+        print_record(n, rb);
+        print_differences(ra, rb);
+        res = 1;
+    }
+    if(res == 0){
+        printf("identical over records %llu-%llu\n", (unsigned long long)first, (unsigned long long)end);
+        if(a.end != b.end){
+            printf("%s has %llu records, %s has %llu\n", opt->files[0], (unsigned long long)a.end,
+                   opt->files[1], (unsigned long long)b.end);
+        }
+    }
+    trace_file_close(&a);
+    trace_file_close(&b);
+    return res;
+}
+
+int main(int argc, char** argv){
+    options opt;
+    if(!parse_args(&opt, argc, argv)){
+        print_usage();
+        return 1;
+    }
+    return opt.diff ? diff(&opt) : dump(&opt);
+}
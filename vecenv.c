@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "vecenv.h"
+#include "jit.h"
+
+
+//the 8 pixels of a display byte as 8 bytes of 0 or 1, leftmost first in memory
+#define PIXEL(b, n) ((uint64_t)(((b) >> (7 - (n))) & 1) << (8 * (n)))
+#define PIXELS(b) (PIXEL(b, 0) | PIXEL(b, 1) | PIXEL(b, 2) | PIXEL(b, 3) | PIXEL(b, 4) | PIXEL(b, 5) | PIXEL(b, 6) | PIXEL(b, 7))
+#define PIXELS4(b) PIXELS(b), PIXELS(b + 1), PIXELS(b + 2), PIXELS(b + 3)
+#define PIXELS16(b) PIXELS4(b), PIXELS4(b + 4), PIXELS4(b + 8), PIXELS4(b + 12)
+#define PIXELS64(b) PIXELS16(b), PIXELS16(b + 16), PIXELS16(b + 32), PIXELS16(b + 48)
+static const uint64_t pixel_bytes[256] = {PIXELS64(0), PIXELS64(64), PIXELS64(128), PIXELS64(192)};
+
+bool vec_env_init(vec_env* e, const uint8_t* rom, int size, uint8_t quirks, int instructions_per_frame){
+    if(quirks >= QUIRKS_COUNT || instructions_per_frame <= 0 || size < 0){
+        return false;
+    }
+    const int memory = quirk_flags[quirks] & QUIRK_XO ? EXTENDED_MEMORY_SIZE : MEMORY_SIZE;
+    if(size > memory - LOAD_ADDRESS){
+        return false;
+    }
+    memcpy(e->rom, rom, size);
+    e->rom_size = size;
+    e->chips = NULL;
+    e->count = 0;
+    e->capacity = 0;
+    e->quirks = quirks;
+    e->core = CORE_CACHED;
+    e->instructions_per_frame = instructions_per_frame;
+    const bool extended = quirk_flags[quirks] & QUIRK_HIRES;
+    e->width = extended ? HIRES_SCREEN_WIDTH : VIRTUAL_SCREEN_WIDTH;
+    e->height = extended ? HIRES_SCREEN_HEIGHT : VIRTUAL_SCREEN_HEIGHT;
+    e->planes = quirk_flags[quirks] & QUIRK_XO ? DISPLAY_PLANES : 1;
+    e->format = OBSERVATION_PACKED;
+    e->observations = NULL;
+    return true;
+}
+
+void vec_env_free(vec_env* e){
+    for(int i = 0; i < e->count; i++){
+        jit_free(&e->chips[i]);
+    }
+    free(e->chips);
+    e->chips = NULL;
+    e->count = 0;
+    e->capacity = 0;
+}
+
+size_t vec_env_observation_size(const vec_env* e, observation_format format){
+    size_t pixels = (size_t)e->width * e->height;
+    return format == OBSERVATION_PACKED ? e->planes * pixels / 8 : pixels;
+}
+
+void vec_env_observe_into(vec_env* e, void* buffer, observation_format format){
+    e->observations = buffer;
+    e->format = format;
+}
+
+//each bit of x twice, a 32 pixel half row of the 64x32 mode as a 128 pixel wide row's word
+static inline uint64_t double_bits(uint32_t x){
+    uint64_t v = x;
+    v = (v | v << 16) & 0x0000ffff0000ffffULL;
+    v = (v | v << 8) & 0x00ff00ff00ff00ffULL;
+    v = (v | v << 4) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | v << 2) & 0x3333333333333333ULL;
+    v = (v | v << 1) & 0x5555555555555555ULL;
+    return v | v << 1;
+}
+
+//the display at the observation's size, a straight copy unless the 64x32 mode is shown at 128x64
+static void write_packed(const vec_env* e, const chip_8* c, uint64_t* out){
+    const int words = e->planes * e->height * e->width / 64;
+    if(e->width == VIRTUAL_SCREEN_WIDTH || c->hires){
+        memcpy(out, c->display, words * sizeof(out[0]));
+        return;
+    }
+    for(int p = 0; p < e->planes; p++){
+        const uint64_t* rows = c->display + p * VIRTUAL_SCREEN_HEIGHT;
+        uint64_t* plane = out + p * HIRES_SCREEN_HEIGHT * 2;
+        for(int y = 0; y < VIRTUAL_SCREEN_HEIGHT; y++){
+            uint64_t left = double_bits(rows[y] >> 32);
+            uint64_t right = double_bits((uint32_t)rows[y]);
+            plane[4 * y] = left;
+            plane[4 * y + 1] = right;
+            plane[4 * y + 2] = left;
+            plane[4 * y + 3] = right;
+        }
+    }
+}
+
+static void write_bytes(const vec_env* e, const chip_8* c, uint8_t* out){
+    uint64_t packed[DISPLAY_WORDS];
+    write_packed(e, c, packed);
+    const int plane_bytes = e->height * e->width / 8;
+    const uint8_t* first = (const uint8_t*)packed;
+    const uint8_t* second = first + plane_bytes;
+    //bytes of a word are in memory lowest first, the leftmost pixels are in its highest
+    for(int i = 0; i < plane_bytes; i++){
+        const int byte = (i & ~7) | (7 - (i & 7));
+        uint64_t pixels = pixel_bytes[first[byte]];
+        if(e->planes > 1){
+            pixels |= pixel_bytes[second[byte]] << 1;
+        }
+        memcpy(out + 8 * i, &pixels, sizeof(pixels));
+    }
+}
+
+static void observe(const vec_env* e, int i){
+    if(!e->observations){
+        return;
+    }
+    uint8_t* out = (uint8_t*)e->observations + i * vec_env_observation_size(e, e->format);
+    if(e->format == OBSERVATION_PACKED){
+        write_packed(e, &e->chips[i], (uint64_t*)out);
+    }
+    else{
+        write_bytes(e, &e->chips[i], out);
+    }
+}
+
+bool vec_env_reset(vec_env* e, int count){
+    for(int i = 0; i < e->count; i++){
+        jit_free(&e->chips[i]);
+    }
+    e->count = 0;
+    if(count > e->capacity){
+        chip_8* grown = realloc(e->chips, count * sizeof(chip_8));
+        if(!grown){
+            return false;
+        }
+        e->chips = grown;
+        e->capacity = count;
+    }
+    for(int i = 0; i < count; i++){
+        chip_8* c = &e->chips[i];
+        init_chip_8(c);
+        c->quirks = e->quirks;
+        seed_random(c, i + 1);
+        //vec_env_init() made sure the rom fits
+        load_program_data(c, e->rom, e->rom_size);
+        c->core = e->core == CORE_SWITCH || e->core == CORE_JIT ? e->core : CORE_CACHED;
+        if(c->core == CORE_JIT && !jit_init(c)){
+            c->core = CORE_CACHED;
+        }
+        observe(e, i);
+    }
+    e->count = count;
+    return true;
+}
+
+//one instance at a time, its state stays in cache for all its frames
+void vec_env_step(vec_env* e, const uint16_t* actions, int frames){
+    for(int i = 0; i < e->count; i++){
+        chip_8* c = &e->chips[i];
+        for(int k = 0; k < 16; k++){
+            c->keys[k] = (actions[i] >> k) & 1;
+        }
+        for(int f = 0; f < frames && !c->faulted; f++){
+            run_frame(c, e->instructions_per_frame);
+        }
+        observe(e, i);
+    }
+}
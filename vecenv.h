@@ -0,0 +1,56 @@
+#ifndef VECENV_H
+#define VECENV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+
+//many instances of one rom stepped together, for training loops that link libchip8 (make lib).
+//Observations go straight into a buffer the caller owns, one after another in instance order, so
+//the caller can hand the whole batch on without copying it again. An observation is always the
+//profile's largest screen: 64x32, or 128x64 for SCHIP and XO-CHIP, which show the 64x32 mode at
+//twice the size. Nothing is printed, failures are only reported through return values
+
+typedef enum{
+    //rows of 64 bit words, bit 63 leftmost, a row is width / 64 words. With XO-CHIP the rows of
+    //the second plane follow those of the first
+    OBSERVATION_PACKED = 0,
+    //a byte per pixel, 1 if set. With XO-CHIP bit 0 is the first plane and bit 1 the second
+    OBSERVATION_BYTES
+}observation_format;
+
+typedef struct{
+    chip_8* chips; //count of them, readable between calls for registers, timers and faults
+    int count;
+    int capacity;
+    uint8_t quirks;
+    uint8_t core; //CORE_CACHED, CORE_SWITCH or CORE_JIT, used from the next vec_env_reset()
+    int instructions_per_frame;
+    int width;
+    int height;
+    int planes;
+    observation_format format;
+    void* observations; //NULL until vec_env_observe_into()
+    int rom_size;
+    uint8_t rom[EXTENDED_MEMORY_SIZE - LOAD_ADDRESS];
+}vec_env;
+
+//false if the rom doesn't fit the profile or an argument is out of range. No instances yet
+bool vec_env_init(vec_env* e, const uint8_t* rom, int size, uint8_t quirks, int instructions_per_frame);
+void vec_env_free(vec_env* e);
+//bytes of one instance's observation
+size_t vec_env_observation_size(const vec_env* e, observation_format format);
+//from now on vec_env_reset() and vec_env_step() write every instance's observation to buffer,
+//which has to hold count * vec_env_observation_size() bytes, 8 byte aligned for packed ones.
+//NULL stops writing observations
+void vec_env_observe_into(vec_env* e, void* buffer, observation_format format);
+//starts count fresh instances, instance i seeded with i + 1. false if out of memory
+bool vec_env_reset(vec_env* e, int count);
+//runs frames frames on every instance with the keys in actions[i] held, bit n for key n. A faulted
+//instance stays where it faulted until the next reset
+void vec_env_step(vec_env* e, const uint16_t* actions, int frames);
+
+#endif